@@ -29,32 +29,68 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <compare>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <unordered_map>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BINARY_RELATIONS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BINARY_RELATIONS_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(BINARY_RELATIONS_SSE2)
+#define BINARY_RELATIONS_PREFETCH(address) _mm_prefetch((const char *)(address), _MM_HINT_T0)
+#else
+#define BINARY_RELATIONS_PREFETCH(address) ((void)(address))
+#endif
+
 namespace BinaryRelations
 {
 // -------- Manipulate vector with unique sorted elements --------
 
-template <typename T> bool containsInSortedVector(const std::vector<T> *vector, const T &value) noexcept
+template <typename VectorType, typename ValueType>
+bool containsInSortedVector(const VectorType *vector, const ValueType &value) noexcept
 {
-    typename std::vector<T>::const_iterator it = std::lower_bound(vector->cbegin(), vector->cend(), value);
+    typename VectorType::const_iterator it = std::lower_bound(vector->cbegin(), vector->cend(), value);
     return it != vector->cend() && *it == value;
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator findInSortedVector(const std::vector<T> *vector, const T &value) noexcept
+template <typename VectorType, typename ValueType>
+typename VectorType::const_iterator findInSortedVector(const VectorType *vector, const ValueType &value) noexcept
 {
-    typename std::vector<T>::const_iterator it = std::lower_bound(vector->cbegin(), vector->cend(), value);
+    typename VectorType::const_iterator it = std::lower_bound(vector->cbegin(), vector->cend(), value);
     if (it != vector->cend() && *it == value)
         return it;
     else
         return vector->cend();
 }
 
-template <typename T> int insertIntoSortedVector(std::vector<T> *vector, const T &value) noexcept
+template <typename VectorType>
+int insertIntoSortedVector(VectorType *vector, const typename VectorType::value_type &value) noexcept
 {
-    typename std::vector<T>::iterator it = std::lower_bound(vector->begin(), vector->end(), value);
+    typename VectorType::iterator it = std::lower_bound(vector->begin(), vector->end(), value);
     if (it != vector->end() && *it == value)
         return 0; // It's already there
     else
@@ -64,9 +100,10 @@ template <typename T> int insertIntoSortedVector(std::vector<T> *vector, const T
     }
 }
 
-template <typename T> int eraseFromSortedVector(std::vector<T> *vector, const T &value) noexcept
+template <typename VectorType>
+int eraseFromSortedVector(VectorType *vector, const typename VectorType::value_type &value) noexcept
 {
-    typename std::vector<T>::iterator it = std::lower_bound(vector->begin(), vector->end(), value);
+    typename VectorType::iterator it = std::lower_bound(vector->begin(), vector->end(), value);
     if (it != vector->end() && *it == value)
     {
         vector->erase(it);
@@ -76,11 +113,12 @@ template <typename T> int eraseFromSortedVector(std::vector<T> *vector, const T
         return 0;
 }
 
-template <typename T>
-void insertIntoSortedVector(const std::vector<T> *sourceVector, const std::vector<T> *insertVector, std::vector<T> *outVector) noexcept
+template <typename SourceVectorType, typename InsertVectorType, typename OutVectorType>
+void insertIntoSortedVector(const SourceVectorType *sourceVector, const InsertVectorType *insertVector,
+                            OutVectorType *outVector) noexcept
 {
-    typename std::vector<T>::const_iterator source_it = sourceVector->cbegin();
-    typename std::vector<T>::const_iterator insert_it = insertVector->cbegin();
+    auto source_it = sourceVector->cbegin();
+    auto insert_it = insertVector->cbegin();
     
     outVector->clear();
     outVector->reserve(sourceVector->size() + insertVector->size());
@@ -113,16 +151,17 @@ void insertIntoSortedVector(const std::vector<T> *sourceVector, const std::vecto
     }
 }
 
-template <typename T>
-void eraseFromSortedVector(const std::vector<T> *sourceVector, const std::vector<T> *eraseVector, std::vector<T> *outVector) noexcept
+template <typename SourceVectorType, typename EraseVectorType, typename OutVectorType>
+void eraseFromSortedVector(const SourceVectorType *sourceVector, const EraseVectorType *eraseVector,
+                           OutVectorType *outVector) noexcept
 {
-    typename std::vector<T>::const_iterator source_it = sourceVector->cbegin();
-    typename std::vector<T>::const_iterator erase_it = eraseVector->cbegin();
-    typename std::vector<T>::const_iterator source_end = sourceVector->cend();
-    typename std::vector<T>::const_iterator erase_end = eraseVector->cend();
+    auto source_it = sourceVector->cbegin();
+    auto erase_it = eraseVector->cbegin();
+    auto source_end = sourceVector->cend();
+    auto erase_end = eraseVector->cend();
 
     outVector->clear();
-    outVector->reserve(std::max(sourceVector->size(), eraseVector->size()));
+    outVector->reserve(sourceVector->size());
 
     while (source_it != source_end && erase_it != erase_end)
     {
@@ -137,7 +176,7 @@ void eraseFromSortedVector(const std::vector<T> *sourceVector, const std::vector
         }
         else
         {
-            outVector->push_back(*erase_it++);
+            erase_it++; // Not in the source - nothing to erase
         }
     }
 
@@ -147,922 +186,7924 @@ void eraseFromSortedVector(const std::vector<T> *sourceVector, const std::vector
     }
 }
 
-// ----------------------------------------------------------------------------
+// Count the values that are not in a vector with unique sorted elements yet. The values are sorted, and may contain
+// duplicates.
+template <typename VectorType, typename InsertVectorType>
+int countNewValues(const VectorType *vector, const InsertVectorType *insertVector) noexcept
+{
+    auto insert_begin = insertVector->begin();
+    auto insert_end = insertVector->end();
 
-/// @cond
-template <typename KeyType, typename ValueType> class UnorderedMapHelper
+    int added = 0;
+    auto source_it = vector->cbegin();
+    auto source_end = vector->cend();
+    for (auto insert_it = insert_begin; insert_it != insert_end; insert_it++)
+    {
+        if (insert_it != insert_begin && *(insert_it - 1) == *insert_it)
+            continue; // Duplicate
+        while (source_it != source_end && *source_it < *insert_it)
+            source_it++;
+        if (source_it == source_end || !(*source_it == *insert_it))
+            added++;
+    }
+    return added;
+}
+
+// Merge sorted values into the first oldSize elements of a vector, from the back. The vector must already have grown
+// by exactly the number of new values, so only the elements that have to make room are moved.
+template <typename VectorType, typename InsertVectorType>
+void mergeBackward(VectorType *vector, size_t oldSize, const InsertVectorType *insertVector) noexcept
 {
-public:
-    const std::unordered_map<KeyType, ValueType>* m_Map;
-    
-    UnorderedMapHelper(const std::unordered_map<KeyType, ValueType>* map)
-    : m_Map(map)
-    {}
-    
-    class Iterator
+    auto insert_begin = insertVector->begin();
+    auto insert_it = insertVector->end();
+    auto source_begin = vector->begin();
+    auto source_back = source_begin + oldSize;
+    auto write_it = vector->end();
+    while (write_it != source_back)
     {
-    public:
-        typename std::unordered_map<KeyType, ValueType>::const_iterator it;
+        auto &value = *(insert_it - 1);
+        if (insert_it - 1 != insert_begin && *(insert_it - 2) == value)
+        {
+            insert_it--; // Duplicate
+        }
+        else if (source_back != source_begin && value < *(source_back - 1))
+        {
+            *--write_it = std::move(*--source_back);
+        }
+        else if (source_back != source_begin && *(source_back - 1) == value)
+        {
+            insert_it--; // Already there
+        }
+        else
+        {
+            *--write_it = value;
+            insert_it--;
+        }
+    }
+}
 
-        inline KeyType operator*() const noexcept
+// Merge sorted values into a vector with unique sorted elements, in place. The vector grows once, and then the merge
+// runs from the back. The values may contain duplicates, and values that are already in the vector. Returns the number
+// of values added.
+template <typename VectorType, typename InsertVectorType>
+int mergeIntoSortedVector(VectorType *vector, const InsertVectorType *insertVector) noexcept
+{
+    int added = countNewValues(vector, insertVector);
+    if (0 == added)
+        return 0;
+
+    size_t old_size = vector->size();
+    vector->resize(old_size + added);
+    mergeBackward(vector, old_size, insertVector);
+    return added;
+}
+
+// Remove sorted values from a vector with unique sorted elements, in place, in a single pass. Values that are not in
+// the vector are ignored. Returns the number of values removed.
+template <typename VectorType, typename EraseVectorType>
+int removeFromSortedVector(VectorType *vector, const EraseVectorType *eraseVector) noexcept
+{
+    auto erase_it = eraseVector->cbegin();
+    auto erase_end = eraseVector->cend();
+    auto read_it = vector->begin();
+    auto read_end = vector->end();
+    auto write_it = read_it;
+
+    while (read_it != read_end)
+    {
+        while (erase_it != erase_end && *erase_it < *read_it)
+            erase_it++;
+        if (erase_it != erase_end && *erase_it == *read_it)
         {
-            return it->first;
+            read_it++;
         }
-        
-        inline bool operator==(const Iterator &other) const noexcept
+        else
         {
-            return it == other.it;
+            if (write_it != read_it)
+                *write_it = std::move(*read_it);
+            write_it++;
+            read_it++;
         }
-        
-        inline bool operator!=(const Iterator &other) const noexcept
+    }
+
+    int removed = (int)(read_end - write_it);
+    vector->erase(write_it, read_end);
+    return removed;
+}
+
+// Compact a vector with unique sorted elements in place, in a single pass. With kKeepMatches, keep only the values
+// that are also in the other vector; without, keep only the values that are not. The other vector is sorted too. The
+// values that are dropped are appended to removedVector, unless it is nullptr. Returns the number of values removed.
+template <bool kKeepMatches, typename VectorType, typename OtherVectorType, typename RemovedVectorType>
+int filterSortedVector(VectorType *vector, const OtherVectorType *otherVector, RemovedVectorType *removedVector) noexcept
+{
+    auto other_it = otherVector->begin();
+    auto other_end = otherVector->end();
+    auto read_it = vector->begin();
+    auto read_end = vector->end();
+    auto write_it = read_it;
+
+    while (read_it != read_end)
+    {
+        while (other_it != other_end && *other_it < *read_it)
+            other_it++;
+        bool match = other_it != other_end && *other_it == *read_it;
+        if (match != kKeepMatches)
         {
-            return it != other.it;
+            if (removedVector != nullptr)
+                removedVector->push_back(std::move(*read_it));
+            read_it++;
         }
-        
-        inline Iterator operator++() noexcept
+        else
         {
-            it++;
-            return *this;
+            if (write_it != read_it)
+                *write_it = std::move(*read_it);
+            write_it++;
+            read_it++;
         }
-    };
-    
-    Iterator begin() const noexcept
+    }
+
+    int removed = (int)(read_end - write_it);
+    vector->erase(write_it, read_end);
+    return removed;
+}
+
+// -------- Sort pairs --------
+
+/// @cond
+// Integer and enum keys of up to 32 bits are sorted by radix instead of by comparison
+template <typename T>
+constexpr bool kIsRadixSortable =
+    (std::is_integral_v<T> || std::is_enum_v<T>) && !std::is_same_v<T, bool> && sizeof(T) <= 4;
+
+// Map a key to an unsigned integer with the same order
+template <typename T> uint64_t radixKeyOf(const T &value) noexcept
+{
+    using UnderlyingType =
+        typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, std::type_identity<T>>::type;
+    using UnsignedType = std::make_unsigned_t<UnderlyingType>;
+    UnsignedType key = (UnsignedType)value;
+    if constexpr (std::is_signed_v<UnderlyingType>)
+        key ^= (UnsignedType)1 << (sizeof(UnsignedType) * 8 - 1); // Negative values go first
+    return (uint64_t)key;
+}
+
+struct LessLeftThenRight
+{
+    template <typename PairType> bool operator()(const PairType &a, const PairType &b) const noexcept
     {
-        Iterator it;
-        it.it = m_Map->begin();
-        return it;
+        if(a.left < b.left) return true;
+        if(b.left < a.left) return false;
+        return a.right < b.right;
     }
 
-    Iterator end() const noexcept
+    template <typename PairType> static uint64_t radixKey(const PairType &pair) noexcept
     {
-        Iterator it;
-        it.it = m_Map->end();
-        return it;
+        return radixKeyOf(pair.left) << 32 | radixKeyOf(pair.right);
     }
 };
-/// @endcond
 
-// ----------------------------------------------------------------------------
-
-/**
- A one-to-many set of (left, right) pairs. The left side can have any number of right counterparts. The right side can only be in a pair with one left side.
- @image html binary-relations-one-to-many.png "one-to-many"
- */
-template <typename LeftType, typename RightType> class OneToMany
+struct LessRightThenLeft
 {
-    std::unordered_map<LeftType, std::vector<RightType> *> m_LeftToRight;
-    std::unordered_map<RightType, LeftType> m_RightToLeft;
-    std::vector<RightType> m_EmptyRightVector;
-    bool m_RightIsSorted = false;
+    template <typename PairType> bool operator()(const PairType &a, const PairType &b) const noexcept
+    {
+        if(a.right < b.right) return true;
+        if(b.right < a.right) return false;
+        return a.left < b.left;
+    }
 
-public:
-    /**
-    @brief A pair of (left, right) values.
-     */
-    struct Pair
+    template <typename PairType> static uint64_t radixKey(const PairType &pair) noexcept
     {
-        LeftType left;
-        RightType right;
-        Pair(LeftType left, RightType right)
-        : left(left), right(right)
-        {}
-        Pair()
-        {}
-    };
+        return radixKeyOf(pair.right) << 32 | radixKeyOf(pair.left);
+    }
+};
 
-    /**
-     @brief Default constructor.
-     */
-    OneToMany() noexcept
-    {}
+// LSD radix sort on a 64-bit key, one byte per pass. Passes where all keys have the same byte are skipped, so small
+// key ranges take few passes.
+template <typename PairType, typename KeyFunction>
+void radixSortPairs(std::span<PairType> pairs, KeyFunction keyOf) noexcept
+{
+    constexpr int kPassCount = 8;
+    size_t count = pairs.size();
 
-    /**
-     @brief Insert a pair into the set.
-     The rule for one-to-many is that if the right value is part of an existing pair in the set, that relation will be erased.
-     @param pair The pair to insert.
-     */
-    void insert(const Pair &pair) noexcept
+    std::vector<size_t> histograms(kPassCount * 256, 0);
+    for (auto &pair : pairs)
     {
-        insert(pair.left, pair.right);
+        uint64_t key = keyOf(pair);
+        for (int pass = 0; pass < kPassCount; ++pass)
+            histograms[pass * 256 + ((key >> (pass * 8)) & 0xff)]++;
     }
 
-    /**
-     @brief Insert a pair into the set.
-     The rule for one-to-many is that if the right value is part of an existing pair in the set, that relation will be erased.
-     @param left The left side of the pair to add.
-     @param right The right side of the pair to add.
-     */
-    void insert(const LeftType &left, const RightType &right) noexcept
+    std::vector<PairType> buffer(count);
+    PairType *from = pairs.data();
+    PairType *to = buffer.data();
+    uint64_t first_key = keyOf(*from);
+    for (int pass = 0; pass < kPassCount; ++pass)
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        if (r2l_it != m_RightToLeft.end())
-        {
-            if (r2l_it->second == left)
-                return; // We already have this pair - do nothing
+        size_t *histogram = &histograms[pass * 256];
+        int shift = pass * 8;
+        if (histogram[(first_key >> shift) & 0xff] == count)
+            continue; // All keys have the same byte
 
-            erase(r2l_it->second, right); // Erase old relation
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; ++digit)
+        {
+            size_t digit_count = histogram[digit];
+            histogram[digit] = offset;
+            offset += digit_count;
         }
+        for (size_t index = 0; index < count; ++index)
+            to[histogram[(keyOf(from[index]) >> shift) & 0xff]++] = std::move(from[index]);
+        std::swap(from, to);
+    }
+
+    if (from != pairs.data())
+        std::move(from, from + count, pairs.data());
+}
 
-        auto l2r_vec = m_LeftToRight[left]; // Will insert if it isn't already there.
-        if (l2r_vec == nullptr)
+template <typename PairType, typename Less> void sortPairs(std::span<PairType> pairs, Less less) noexcept
+{
+    using LeftType = decltype(PairType::left);
+    using RightType = decltype(PairType::right);
+    if constexpr (kIsRadixSortable<LeftType> && kIsRadixSortable<RightType>)
+    {
+        if (pairs.size() >= 256)
         {
-            l2r_vec = new std::vector<RightType>();
-            m_LeftToRight[left] = l2r_vec;
+            radixSortPairs(pairs, [](const PairType &pair) { return Less::radixKey(pair); });
+            return;
         }
-        insertIntoSortedVector(l2r_vec, right);
-
-        m_RightToLeft[right] = left;
     }
+    std::sort(pairs.begin(), pairs.end(), less);
+}
 
-    /**
-     @brief Insert multiple  pairs into the set.
-     This is faster than inserting the pairs one by one.
-     The rule for one-to-many is that if the right value is part of an existing pair in the set, that pair will be erased.
-     @param pairs The pairs to add.
-     */
-    void insert(const std::vector<Pair> &pairs) noexcept
+template <typename PairType> void sortLeftThenRight(std::vector<PairType> *pairs) noexcept
+{
+    sortPairs(std::span<PairType>(*pairs), LessLeftThenRight());
+}
+
+template <typename PairType> void sortRightThenLeft(std::vector<PairType> *pairs) noexcept
+{
+    sortPairs(std::span<PairType>(*pairs), LessRightThenLeft());
+}
+/// @endcond
+
+// -------- Run in parallel --------
+
+/// @cond
+inline int resolveThreadCount(int threadCount) noexcept
+{
+    if (threadCount > 0)
+        return threadCount;
+    return (int)std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Run task(index) for every index in [0, taskCount), on up to threadCount threads including the calling thread.
+// Threads take the next task as they finish one, so tasks of uneven size are balanced.
+template <typename TaskFunction> void runParallel(size_t taskCount, int threadCount, TaskFunction task) noexcept
+{
+    threadCount = (int)std::min((size_t)resolveThreadCount(threadCount), taskCount);
+    std::atomic<size_t> next_task = 0;
+    auto worker = [&]()
     {
-        if(0 == pairs.size())
-            return;
+        for (size_t index = next_task++; index < taskCount; index = next_task++)
+            task(index);
+    };
 
-        auto compare_left_then_right = [](const Pair &a, const Pair &b)
-        {
-            if(a.left < b.left) return true;
-            if(b.left < a.left) return false;
-            return a.right < b.right;
-        };
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < threadCount; ++thread)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+}
 
-        std::vector<Pair> pairs_to_insert = pairs;  // Deep copy...
-        std::sort(pairs_to_insert.begin(), pairs_to_insert.end(), compare_left_then_right); // ...so I can sort
+// Call function(key, value) for every pair of a map from keys to sorted vectors, on up to threadCount threads. The
+// pairs are divided into chunks of about the same number of pairs, rather than keys, so a key with many values is
+// spread over several chunks instead of holding up one thread. Listing the keys takes one pass on the calling thread.
+template <typename ValueType, typename MapType, typename ValuesFunction, typename PairFunction>
+void forEachPairParallel(const MapType &map, ValuesFunction valuesOf, int threadCount, PairFunction function) noexcept
+{
+    constexpr size_t kMinChunkSize = 1024;
+    struct Entry
+    {
+        const typename MapType::key_type *key;
+        std::span<const ValueType> values;
+        size_t end; // Number of pairs up to and including this entry
+    };
 
-        std::vector<Pair> pairs_to_erase;
-        for (auto pair : pairs_to_insert)
+    std::vector<Entry> entries;
+    entries.reserve(map.size());
+    size_t pair_count = 0;
+    for (auto &item : map)
+    {
+        std::span<const ValueType> values = valuesOf(item.second);
+        pair_count += values.size();
+        entries.push_back(Entry{&item.first, values, pair_count});
+    }
+
+    threadCount = resolveThreadCount(threadCount);
+    size_t chunk_count = std::clamp(pair_count / kMinChunkSize, (size_t)1, (size_t)threadCount * 4);
+    runParallel(chunk_count, threadCount, [&](size_t chunk)
+    {
+        size_t first = pair_count * chunk / chunk_count;
+        size_t last = pair_count * (chunk + 1) / chunk_count;
+        auto entry_it = std::ranges::upper_bound(entries, first, {}, &Entry::end);
+        for (size_t position = first; position < last; ++entry_it)
         {
-            auto r2l_it = m_RightToLeft.find(pair.right);
-            if (r2l_it != m_RightToLeft.end())
-            {
-                pairs_to_erase.push_back(Pair(r2l_it->second, r2l_it->first));
-                m_RightToLeft.erase(r2l_it);
-            }
+            size_t entry_begin = entry_it->end - entry_it->values.size();
+            size_t stop = std::min(last, entry_it->end);
+            for (size_t index = position - entry_begin; index < stop - entry_begin; ++index)
+                function(*entry_it->key, entry_it->values[index]);
+            position = stop;
         }
+    });
+}
 
-        if (0 != pairs_to_erase.size())
-        {
-            std::sort(pairs_to_erase.begin(), pairs_to_erase.end(), compare_left_then_right);
+// Sort runs of the pairs on separate threads, then merge the runs pairwise, also in parallel
+template <typename PairType, typename Less>
+void parallelSortPairs(std::vector<PairType> *pairs, int threadCount, Less less) noexcept
+{
+    constexpr size_t kMinRunSize = 4096;
+    size_t count = pairs->size();
+    size_t run_count = std::clamp(count / kMinRunSize, (size_t)1, (size_t)resolveThreadCount(threadCount));
 
-            std::vector<RightType> right_to_erase;
-            auto end_it = pairs_to_erase.cend();
-            for (auto it = pairs_to_erase.cbegin(); it != end_it; )
-            {
-                // Collect all right values that have the same left value
-                right_to_erase.clear();
-                auto left = it->left;
-                while(it != end_it && it->left == left)
-                {
-                    right_to_erase.push_back(it->right);
-                    it++;
-                }
+    std::vector<size_t> run_starts;
+    for (size_t run = 0; run <= run_count; ++run)
+        run_starts.push_back(count * run / run_count);
 
-                // Erase them in one go
-                auto l2r_it = m_LeftToRight.find(left);
-                if (l2r_it != m_LeftToRight.end())
-                {
-                    auto l2r_vec = l2r_it->second;
-                    eraseFromSortedVector(l2r_vec, &right_to_erase, l2r_vec);
-                    
-                    if(0 == l2r_vec->size())
-                    {
-                        m_LeftToRight.erase(l2r_it);
-                        delete l2r_vec;
-                    }
-                }
-            }
-        }
+    PairType *data = pairs->data();
+    runParallel(run_count, threadCount, [&](size_t run)
+    {
+        sortPairs(std::span<PairType>(data + run_starts[run], data + run_starts[run + 1]), less);
+    });
 
-        std::vector<RightType> right_to_insert;
-        auto it_end = pairs_to_insert.cend();
-        for (auto it = pairs_to_insert.cbegin(); it != it_end; )
+    for (size_t width = 1; width < run_count; width *= 2)
+    {
+        runParallel((run_count + 2 * width - 1) / (2 * width), threadCount, [&](size_t merge)
         {
-            // Collect all right values that have the same left value
-            right_to_insert.clear();
-            auto left = it->left;
-            while(it != it_end && it->left == left)
-            {
-                m_RightToLeft[it->right] = it->left;
-                right_to_insert.push_back(it->right);
-                it++;
-            }
+            size_t first = merge * 2 * width;
+            size_t middle = std::min(first + width, run_count);
+            size_t last = std::min(first + 2 * width, run_count);
+            if (middle < last)
+                std::inplace_merge(data + run_starts[first], data + run_starts[middle], data + run_starts[last], less);
+        });
+    }
+}
 
-            // Insert them in one go
-            auto l2r_it = m_LeftToRight.find(left);
-            if (l2r_it != m_LeftToRight.end())
-            {
-                auto l2r_vec = l2r_it->second;
-                auto temp = *l2r_vec;   // Deep copy
-                insertIntoSortedVector(&temp, &right_to_insert, l2r_vec);
-            }
-            else
+// One side of a parallel bulk insert: the batch grouped by key, and for each key the vector to merge into.
+// Counting and merging can run on many threads at once. Growing the vectors allocates, so that runs on one thread.
+template <typename KeyType, typename ValueType, typename VectorType> class ParallelMerge
+{
+public:
+    std::vector<KeyType> m_Keys;
+    std::vector<size_t> m_GroupStarts;      // Where the values of each key start, plus the end
+    std::vector<ValueType> m_Values;        // The values of all keys, sorted per key
+    std::vector<VectorType *> m_Vectors;
+    std::vector<size_t> m_OldSizes;
+    std::vector<int> m_Added;
+    std::vector<size_t> m_TaskStarts;       // The keys divided into tasks with about the same number of values
+
+    // Group a batch that is sorted by key, then by value
+    template <typename PairType, typename KeyOf, typename ValueOf>
+    void group(const std::vector<PairType> &pairs, KeyOf keyOf, ValueOf valueOf, int taskCount) noexcept
+    {
+        m_Values.reserve(pairs.size());
+        for (size_t index = 0; index < pairs.size(); ++index)
+        {
+            if (0 == index || !(keyOf(pairs[index]) == keyOf(pairs[index - 1])))
             {
-                // insert new value
-                auto l2r_vec = new std::vector<RightType>(right_to_insert);
-                m_LeftToRight[left] = l2r_vec;
+                m_Keys.push_back(keyOf(pairs[index]));
+                m_GroupStarts.push_back(index);
             }
+            m_Values.push_back(valueOf(pairs[index]));
+        }
+        m_GroupStarts.push_back(pairs.size());
+
+        size_t task_size = pairs.size() / taskCount + 1;
+        m_TaskStarts.push_back(0);
+        for (size_t group = 0; group < m_Keys.size(); ++group)
+        {
+            if (m_GroupStarts[group + 1] - m_GroupStarts[m_TaskStarts.back()] >= task_size)
+                m_TaskStarts.push_back(group + 1);
         }
+        if (m_TaskStarts.back() != m_Keys.size())
+            m_TaskStarts.push_back(m_Keys.size());
+
+        m_Vectors.resize(m_Keys.size());
+        m_OldSizes.resize(m_Keys.size());
+        m_Added.resize(m_Keys.size());
     }
 
-    /**
-     @brief Erase a pair from the set.
-     If there is no matching pair in the set, nothing happens.
-     @param pair The pair to erase.
-     */
-    void erase(const Pair &pair) noexcept
+    size_t taskCount() const noexcept
     {
-        erase(pair.left, pair.right);
+        return m_TaskStarts.size() - 1;
     }
 
-    /**
-     @brief Erase a pair from the set.
-     If there is no matching pair in the set, nothing happens.
-     @param left The left side of the pair to erase.
-     @param right The right side of the pair to erase.
-     */
-    void erase(const LeftType &left, const RightType &right) noexcept
+    // Only reads the map, so tasks can run in parallel
+    template <typename MapType> void count(const MapType &map, size_t task) noexcept
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        if (r2l_it == m_RightToLeft.end())
-            return; // (*,right) not in the set - do nothing
+        VectorType empty;
+        for (size_t group = m_TaskStarts[task]; group < m_TaskStarts[task + 1]; ++group)
+        {
+            auto values = valuesOf(group);
+            auto it = map.find(m_Keys[group]);
+            m_Added[group] = countNewValues(it != map.end() ? &it->second : &empty, &values);
+        }
+    }
 
-        if (r2l_it->second != left)
-            return; // (left,right) is not in the set - do nothing
+    // Add the new keys to the map, and grow the vectors. Single threaded. Returns the number of values added.
+    template <typename MapType, typename AllocatorType> int grow(MapType *map, const AllocatorType &allocator) noexcept
+    {
+        for (auto &key : m_Keys)
+            map->try_emplace(key, allocator);
 
-        auto l2r_it = m_LeftToRight.find(left);
-        auto l2r_vec = l2r_it->second;
-        auto l2r_vec_it = findInSortedVector(l2r_vec, right);
-        if (l2r_vec_it != l2r_vec->cend())
+        // Take the pointers after all keys are in, because adding keys may move the vectors of other keys
+        int added = 0;
+        for (size_t group = 0; group < m_Keys.size(); ++group)
         {
-            l2r_vec->erase(l2r_vec_it);
-            if (l2r_vec->size() == 0)
-            {
-                m_LeftToRight.erase(l2r_it);
-                delete l2r_vec; // Vector is empty now
-            }
-            m_RightToLeft.erase(r2l_it);
+            auto vector = &map->find(m_Keys[group])->second;
+            m_Vectors[group] = vector;
+            m_OldSizes[group] = vector->size();
+            vector->resize(m_OldSizes[group] + m_Added[group]);
+            added += m_Added[group];
         }
+        return added;
     }
 
-    /**
-     @brief Erase all pairs with the given left value.
-     If there is no matching pair in the set, nothing happens.
-     @param left The left side of the pairs to erase.
-     */
-    void eraseLeft(const LeftType &left) noexcept
+    // Only touches the vectors of this task, so tasks can run in parallel
+    void merge(size_t task) noexcept
     {
-        auto l2r_it = m_LeftToRight.find(left);
-        if (l2r_it == m_LeftToRight.end())
-            return;
-
-        auto l2r_vec = l2r_it->second;
-        for (auto right : l2r_vec)
+        for (size_t group = m_TaskStarts[task]; group < m_TaskStarts[task + 1]; ++group)
         {
-            auto r2l_it = m_RightToLeft.find(right);
-            m_RightToLeft.erase(r2l_it);
+            if (0 == m_Added[group])
+                continue;
+            auto values = valuesOf(group);
+            mergeBackward(m_Vectors[group], m_OldSizes[group], &values);
         }
+    }
 
-        m_LeftToRight.erase(l2r_it);
-        delete l2r_vec; // Vector is empty now
+private:
+    std::span<const ValueType> valuesOf(size_t group) const noexcept
+    {
+        return std::span<const ValueType>(m_Values.data() + m_GroupStarts[group],
+                                          m_GroupStarts[group + 1] - m_GroupStarts[group]);
     }
+};
+/// @endcond
 
-    /**
-     @brief Erase the pair with the given right value.
-     If there is no matching pair in the set, nothing happens.
-     @param right The right side of the pairs to erase.
-     */
-    void eraseRight(const RightType &right) noexcept
+// ----------------------------------------------------------------------------
+
+/**
+ A vector that keeps up to InlineCapacity elements inside the object itself, and only allocates when it grows beyond
+ that. It has the part of the `std::vector` interface that the relations use.
+ Like the standard containers, it keeps its allocator on assignment, and gets it from the source on move construction.
+ */
+template <typename T, int InlineCapacity, typename Allocator = std::allocator<T>> class SmallVector
+{
+    static_assert(InlineCapacity > 0, "Use std::vector if you don't want inline storage");
+
+    T *m_Data;
+    uint32_t m_Size = 0;
+    uint32_t m_Capacity = InlineCapacity;
+    [[no_unique_address]] Allocator m_Allocator;
+    alignas(T) unsigned char m_Inline[sizeof(T) * InlineCapacity];
+
+public:
+    /// @cond
+    using value_type = T;
+    using size_type = size_t;
+    using allocator_type = Allocator;
+    using iterator = T *;
+    using const_iterator = const T *;
+    /// @endcond
+
+    SmallVector() noexcept
+    : m_Data(inlineData())
+    {}
+
+    explicit SmallVector(const Allocator &allocator) noexcept
+    : m_Data(inlineData()), m_Allocator(allocator)
+    {}
+
+    SmallVector(const SmallVector &other) noexcept
+    : m_Data(inlineData()),
+      m_Allocator(std::allocator_traits<Allocator>::select_on_container_copy_construction(other.m_Allocator))
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        if (r2l_it == m_RightToLeft.end())
-            return;
-        erase(r2l_it->second, right);
+        assign(other.cbegin(), other.cend());
     }
 
-    /**
-     @brief Erase multiple  pairs from the set.
-     This is faster than erasing the pairs one by one.
-     @param pairs The pairs to erase.
-     */
-    void erase(const std::vector<Pair> &pairs) noexcept
+    SmallVector(const SmallVector &other, const Allocator &allocator) noexcept
+    : m_Data(inlineData()), m_Allocator(allocator)
     {
-        if(0 == pairs.size())
-            return;
+        assign(other.cbegin(), other.cend());
+    }
 
-        auto compare_left_then_right = [](const Pair &a, const Pair &b)
-        {
-            if(a.left < b.left) return true;
-            if(b.left < a.left) return false;
-            return a.right < b.right;
-        };
+    SmallVector(SmallVector &&other) noexcept
+    : m_Data(inlineData()), m_Allocator(other.m_Allocator)
+    {
+        moveFrom(other);
+    }
 
-        std::vector<Pair> pairs_to_erase = pairs;  // Deep copy...
-        std::sort(pairs_to_erase.begin(), pairs_to_erase.end(), compare_left_then_right); // ...so I can sort
+    template <typename InputIterator>
+    SmallVector(InputIterator first, InputIterator last, const Allocator &allocator = Allocator()) noexcept
+    : m_Data(inlineData()), m_Allocator(allocator)
+    {
+        assign(first, last);
+    }
 
-        std::vector<RightType> right_to_erase;
-        auto end_it = pairs_to_erase.cend();
-        for (auto it = pairs_to_erase.cbegin(); it != end_it; )
+    SmallVector &operator=(const SmallVector &other) noexcept
+    {
+        if (this != &other)
         {
-            // Collect all right values that have the same left value
-            right_to_erase.clear();
-            auto left = it->left;
-            while(it != end_it && it->left == left)
-            {
-                right_to_erase.push_back(it->right);
-                auto r2l_it = m_RightToLeft.find(it->right);
-                if (r2l_it != m_RightToLeft.end())
-                {
-                    m_RightToLeft.erase(r2l_it);
-                }
-                it++;
-            }
+            clear();
+            assign(other.cbegin(), other.cend());
+        }
+        return *this;
+    }
 
-            // Erase them in one go
-            auto l2r_it = m_LeftToRight.find(left);
-            if (l2r_it != m_LeftToRight.end())
-            {
-                auto l2r_vec = l2r_it->second;
-                eraseFromSortedVector(l2r_vec, &right_to_erase, l2r_vec);
-                
-                if(0 == l2r_vec->size())
-                {
-                    m_LeftToRight.erase(l2r_it);
-                    delete l2r_vec;
-                }
-            }
+    SmallVector &operator=(SmallVector &&other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            release();
+            moveFrom(other);
         }
+        return *this;
     }
 
-    /**
-     @brief Erase all pairs from the set.
-     */
-    void clear() noexcept
+    ~SmallVector() noexcept
     {
-        m_RightToLeft.clear();
-        m_LeftToRight.clear();
+        clear();
+        release();
     }
 
-    /**
-     @brief Test whether a given pair is in the set.
-     @param pair The pair to look for.
-     */
-    bool contains(const Pair &pair) const noexcept
+    iterator begin() noexcept
     {
-        return contains(pair.left, pair.right);
+        return m_Data;
     }
 
-    /**
-     @brief Test whether a given pair is in the set.
-     @param left The left side of the pair to look for.
-     @param right The right side of the pair to look for.
-     */
-    bool contains(const LeftType &left, const RightType &right) const noexcept
+    iterator end() noexcept
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        return r2l_it != m_RightToLeft.cend() && r2l_it->second == left;
+        return m_Data + m_Size;
     }
 
-    /**
-     @brief Test whether any pair in the set has this left value.
-     @param left The left side of the pair to look for.
-     */
-    bool containsLeft(const LeftType &left) const noexcept
+    const_iterator begin() const noexcept
     {
-        return m_LeftToRight.contains(left);
+        return m_Data;
     }
 
-    /**
-     @brief Test whether any pair in the set has this right value.
-     @param right The right side of the pair to look for.
-     */
-    bool containsRight(const RightType &right) const noexcept
+    const_iterator end() const noexcept
     {
-        return m_RightToLeft.contains(right);
+        return m_Data + m_Size;
     }
 
-    /**
-     @brief Find all right values that are paired with this left value.
-     If nothing is found, you will get an empty array.
-     This works well with range-based-for.
-     @param left The left side of the pair to look for.
-     @return The vector of right values.
-     */
-    const std::vector<RightType>* findRight(const LeftType &left) const noexcept
+    const_iterator cbegin() const noexcept
     {
-        auto l2r_it = m_LeftToRight.find(left);
-        if (l2r_it == m_LeftToRight.end())
-            return &m_EmptyRightVector;
+        return m_Data;
+    }
 
-        return l2r_it->second;
+    const_iterator cend() const noexcept
+    {
+        return m_Data + m_Size;
     }
 
-    /**
-     @brief Find the single left value that is paired with this right value.
-     If nothing is found, you will get the notFoundValue.
-     @param right The right side of the pair to look for.
-     @param notFoundValue The value to return if no matching pair is found.
-     @return The singular left value.
-     */
-    LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
+    T *data() noexcept
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        if (r2l_it == m_RightToLeft.end())
-            return notFoundValue;
+        return m_Data;
+    }
 
-        return r2l_it->second;
+    const T *data() const noexcept
+    {
+        return m_Data;
     }
 
-    /**
-     @brief Count the number of left values in the set.
-     @return The number of left values in the set.
-     */
-    int countLeft() const noexcept
+    size_t size() const noexcept
     {
-        return (int)m_LeftToRight.size();
+        return m_Size;
     }
 
-    /**
-     @brief Count the number of right values in the set.
-     @return The number of right values in the set.
-     */
-    int countRight() const noexcept
+    size_t capacity() const noexcept
     {
-        return (int)m_RightToLeft.size();
+        return m_Capacity;
     }
 
-    /**
-     @brief Count the number of pairs in the set.
-     @return The number of pairs in the set.
-     */
-    int count() const noexcept
+    bool empty() const noexcept
     {
-        return (int)m_RightToLeft.size();
+        return m_Size == 0;
     }
 
-    /**
-     @brief List all left elements.
-     @return A helper object to iterate over left elements using range-based-for.
-     */
-    UnorderedMapHelper<LeftType, std::vector<RightType> *> allLeft() const noexcept
+    T &operator[](size_t index) noexcept
     {
-        return UnorderedMapHelper(&m_LeftToRight);
+        return m_Data[index];
     }
 
-    /**
-     @brief List all right elements.
-     @return A helper object to iterate over right elements using range-based-for.
-     */
-    UnorderedMapHelper<RightType, LeftType> allRight() const noexcept
+    const T &operator[](size_t index) const noexcept
     {
-        return UnorderedMapHelper(&m_RightToLeft);
+        return m_Data[index];
     }
 
     /**
-     @brief A range-based-for compatible iterator.
+     @brief Test whether the elements are stored inside the object.
      */
-    class Iterator
+    bool isInline() const noexcept
     {
-        /// @cond
-      public:
-        typename std::unordered_map<LeftType, std::vector<RightType> *>::const_iterator l2r_it;
-        typename std::unordered_map<LeftType, std::vector<RightType> *>::const_iterator l2r_it_end;
-        typename std::vector<RightType>::const_iterator l2r_vec_it;
+        return m_Data == inlineData();
+    }
 
-        inline Pair operator*() const noexcept
+    void clear() noexcept
+    {
+        std::destroy(m_Data, m_Data + m_Size);
+        m_Size = 0;
+    }
+
+    void reserve(size_t capacity) noexcept
+    {
+        if (capacity > m_Capacity)
+            grow(capacity);
+    }
+
+    void resize(size_t size) noexcept
+    {
+        if (size < m_Size)
         {
-            auto left = l2r_it->first;
-            auto right = *l2r_vec_it;
-            return Pair(left, right);
+            std::destroy(m_Data + size, m_Data + m_Size);
         }
-
-        inline bool operator==(const Iterator &other) const noexcept
+        else
         {
-            return l2r_it == other.l2r_it;
+            reserve(size);
+            std::uninitialized_value_construct(m_Data + m_Size, m_Data + size);
         }
+        m_Size = (uint32_t)size;
+    }
 
-        inline bool operator!=(const Iterator &other) const noexcept
+    void push_back(const T &value) noexcept
+    {
+        T temp(value); // value may live in this vector
+        if (m_Size == m_Capacity)
+            grow(m_Capacity * 2);
+        std::construct_at(m_Data + m_Size, std::move(temp));
+        m_Size += 1;
+    }
+
+    iterator insert(const_iterator pos, const T &value) noexcept
+    {
+        size_t index = pos - m_Data;
+        T temp(value); // value may live in this vector
+        if (m_Size == m_Capacity)
+            grow(m_Capacity * 2);
+
+        if (index == m_Size)
         {
-            return l2r_it != other.l2r_it;
+            std::construct_at(m_Data + m_Size, std::move(temp));
         }
-
-        inline Iterator operator++() noexcept
+        else
         {
-            l2r_vec_it++;
-            if (l2r_vec_it == l2r_it->second->cend())
-            {
-                l2r_it++;
-                if (l2r_it != l2r_it_end)
-                {
-                    l2r_vec_it = l2r_it->second->cbegin();
-                }
-            }
-            return *this;
+            std::construct_at(m_Data + m_Size, std::move(m_Data[m_Size - 1]));
+            std::move_backward(m_Data + index, m_Data + m_Size - 1, m_Data + m_Size);
+            m_Data[index] = std::move(temp);
         }
-        /// @endcond
-    };
+        m_Size += 1;
+        return m_Data + index;
+    }
 
-    /**
-     @brief Required member to get range-based-for.
-     @return an Iterator set to the first pair in the set.
-     */
-    Iterator begin() const noexcept
+    iterator erase(const_iterator pos) noexcept
     {
-        Iterator it;
-        it.l2r_it = m_LeftToRight.cbegin();
-        it.l2r_it_end = m_LeftToRight.cend();
-        if (it.l2r_it != it.l2r_it_end)
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(const_iterator first, const_iterator last) noexcept
+    {
+        T *dst = m_Data + (first - m_Data);
+        T *src = m_Data + (last - m_Data);
+        T *new_end = std::move(src, m_Data + m_Size, dst);
+        std::destroy(new_end, m_Data + m_Size);
+        m_Size = (uint32_t)(new_end - m_Data);
+        return dst;
+    }
+
+private:
+    T *inlineData() noexcept
+    {
+        return std::launder(reinterpret_cast<T *>(m_Inline));
+    }
+
+    const T *inlineData() const noexcept
+    {
+        return std::launder(reinterpret_cast<const T *>(m_Inline));
+    }
+
+    template <typename InputIterator> void assign(InputIterator first, InputIterator last) noexcept
+    {
+        reserve(std::distance(first, last));
+        T *end = std::uninitialized_copy(first, last, m_Data);
+        m_Size = (uint32_t)(end - m_Data);
+    }
+
+    void grow(size_t capacity) noexcept
+    {
+        T *data = std::allocator_traits<Allocator>::allocate(m_Allocator, capacity);
+        std::uninitialized_move(m_Data, m_Data + m_Size, data);
+        std::destroy(m_Data, m_Data + m_Size);
+        release();
+        m_Data = data;
+        m_Capacity = (uint32_t)capacity;
+    }
+
+    // Free the heap buffer, if any. Elements must have been destroyed or moved out.
+    void release() noexcept
+    {
+        if (!isInline())
         {
-            auto l2r_vec = it.l2r_it->second;
-            it.l2r_vec_it = l2r_vec->cbegin();
+            std::allocator_traits<Allocator>::deallocate(m_Allocator, m_Data, m_Capacity);
+            m_Data = inlineData();
+            m_Capacity = InlineCapacity;
         }
-        return it;
     }
 
-    /**
-     @brief Required member to get range-based-for.
-     @return an Iterator set to one after the last pair in the set.
-     */
-    Iterator end() const noexcept
+    void moveFrom(SmallVector &other) noexcept
     {
-        Iterator it;
-        it.l2r_it = m_LeftToRight.cend();
-        return it;
+        if (other.isInline() || m_Allocator != other.m_Allocator)
+        {
+            reserve(other.m_Size);
+            std::uninitialized_move(other.m_Data, other.m_Data + other.m_Size, m_Data);
+            m_Size = other.m_Size;
+            other.clear();
+        }
+        else
+        {
+            m_Data = other.m_Data;
+            m_Size = other.m_Size;
+            m_Capacity = other.m_Capacity;
+            other.m_Data = other.inlineData();
+            other.m_Size = 0;
+            other.m_Capacity = InlineCapacity;
+        }
     }
 };
 
 // ----------------------------------------------------------------------------
 
-/**
- A many-to-many set of (left, right) pairs.
- @image html binary-relations-many-to-many.png "many-to-many"
- */
-template <typename LeftType, typename RightType> class ManyToMany
+/// @cond
+// A memory resource that hands out memory from one block, front to back, and passes everything that does not fit on
+// to its upstream resource. Memory in the block is not reused when it is freed. It goes back upstream with the block.
+class BlockResource : public std::pmr::memory_resource
 {
-    std::unordered_map<LeftType, std::vector<RightType> *> m_LeftToRight;
-    std::unordered_map<RightType, std::vector<LeftType> *> m_RightToLeft;
-    std::vector<RightType> m_EmptyRightVector;
-    std::vector<LeftType> m_EmptyLeftVector;
-    int m_Count;
+    std::pmr::memory_resource *m_Upstream;
+    char *m_Block;
+    char *m_Next;
+    size_t m_Size;
 
 public:
-    /**
-    @brief A pair of (left, right) values.
+    BlockResource(std::pmr::memory_resource *upstream, size_t size) noexcept
+    : m_Upstream(upstream), m_Size(size)
+    {
+        m_Block = static_cast<char *>(m_Upstream->allocate(m_Size, alignof(std::max_align_t)));
+        m_Next = m_Block;
+    }
+
+    BlockResource(const BlockResource &) = delete;
+    BlockResource &operator=(const BlockResource &) = delete;
+
+    ~BlockResource() noexcept
+    {
+        m_Upstream->deallocate(m_Block, m_Size, alignof(std::max_align_t));
+    }
+
+    // The size to reserve for an allocation of this many bytes, so that a block of the sum of these is large enough
+    static size_t roundUp(size_t bytes) noexcept
+    {
+        constexpr size_t kAlignment = alignof(std::max_align_t);
+        return (bytes + kAlignment - 1) & ~(kAlignment - 1);
+    }
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        char *data = m_Block + ((m_Next - m_Block + alignment - 1) & ~(alignment - 1));
+        if (data + bytes > m_Block + m_Size)
+            return m_Upstream->allocate(bytes, alignment);
+        m_Next = data + bytes;
+        return data;
+    }
+
+    void do_deallocate(void *data, size_t bytes, size_t alignment) override
+    {
+        if (data >= m_Block && data < m_Block + m_Size)
+            return; // Released with the block
+        m_Upstream->deallocate(data, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// The memory resource that a relation allocates its per-key vectors from. Either the caller's, or a pool that
+// belongs to the relation and is created on first use. The pool recycles freed blocks by size class, so churn does not
+// go back to the global heap. A bulk-loaded relation puts a block in front of that, which holds all its initial
+// vectors in one allocation.
+class VectorResource
+{
+    std::unique_ptr<std::pmr::unsynchronized_pool_resource> m_Pool;
+    std::pmr::memory_resource *m_Resource = nullptr;
+    std::unique_ptr<BlockResource> m_Block; // Last, so it goes back to the pool before the pool goes
+
+public:
+    VectorResource() noexcept
+    {}
+
+    explicit VectorResource(std::pmr::memory_resource *resource) noexcept
+    : m_Resource(resource)
+    {}
+
+    // A copy shares the caller's resource, but not the pool or the block
+    VectorResource(const VectorResource &other) noexcept
+    : m_Resource(other.m_Pool ? nullptr : other.m_Resource)
+    {}
+
+    VectorResource(VectorResource &&other) noexcept
+    : m_Pool(std::move(other.m_Pool)), m_Resource(other.m_Resource), m_Block(std::move(other.m_Block))
+    {
+        if (m_Pool)
+            other.m_Resource = nullptr;
+    }
+
+    // Vectors keep their allocator on copy assignment, so the resource stays too
+    VectorResource &operator=(const VectorResource &) noexcept
+    {
+        return *this;
+    }
+
+    // Swap, so the old pool lives on in the source until the old vectors are gone
+    VectorResource &operator=(VectorResource &&other) noexcept
+    {
+        std::swap(m_Pool, other.m_Pool);
+        std::swap(m_Resource, other.m_Resource);
+        std::swap(m_Block, other.m_Block);
+        return *this;
+    }
+
+    std::pmr::memory_resource *get() noexcept
+    {
+        if (m_Block)
+            return m_Block.get();
+        if (m_Resource == nullptr)
+        {
+            m_Pool = std::make_unique<std::pmr::unsynchronized_pool_resource>();
+            m_Resource = m_Pool.get();
+        }
+        return m_Resource;
+    }
+
+    // Allocate one block of this size, for vectors made from now on. Only for a relation that has no vectors yet.
+    void reserveBlock(size_t size) noexcept
+    {
+        if (size != 0)
+            m_Block = std::make_unique<BlockResource>(get(), size);
+    }
+};
+/// @endcond
+
+// ----------------------------------------------------------------------------
+
+/**
+ An open-addressing hash map with the part of the `std::unordered_map` interface that the relations use.
+ All elements live in one flat array, next to an array of one-byte tags. A lookup compares 16 tags at once (with SSE2
+ where available) before it touches any element. Erase shifts the elements that follow back into the hole, so there
+ are no tombstones, and lookups do not degrade after heavy churn.
+ Unlike `std::unordered_map`, insert and erase invalidate all iterators and element pointers.
+ */
+template <typename KeyType, typename ValueType, typename Hash = std::hash<KeyType>,
+          typename KeyEqual = std::equal_to<KeyType>>
+class FlatHashMap
+{
+public:
+    /// @cond
+    using key_type = KeyType;
+    using mapped_type = ValueType;
+    using value_type = std::pair<KeyType, ValueType>;
+    using size_type = size_t;
+    /// @endcond
+
+private:
+    static constexpr size_t kGroupWidth = 16;
+    static constexpr uint8_t kEmpty = 0x80;
+
+    template <typename Key>
+    static constexpr bool kIsTransparent = !std::is_same_v<Key, KeyType> && requires {
+        typename Hash::is_transparent;
+        typename KeyEqual::is_transparent;
+    };
+
+    uint8_t *m_Ctrl = nullptr;  // One tag per slot, followed by a copy of the first kGroupWidth tags
+    value_type *m_Slots = nullptr;
+    size_t m_Capacity = 0;      // Zero, or a power of two no smaller than kGroupWidth
+    size_t m_Size = 0;
+    Hash m_Hash;
+    KeyEqual m_Equal;
+
+public:
+    /**
+     @brief A forward iterator over the (key, value) pairs.
+     */
+    template <bool IsConst> class IteratorBase
+    {
+        /// @cond
+        friend class FlatHashMap;
+        template <bool> friend class IteratorBase;
+
+        using MapPointer = std::conditional_t<IsConst, const FlatHashMap *, FlatHashMap *>;
+        using ValuePointer = std::conditional_t<IsConst, const value_type *, value_type *>;
+        using ValueReference = std::conditional_t<IsConst, const value_type &, value_type &>;
+
+        MapPointer m_Map = nullptr;
+        size_t m_Index = 0;
+
+        IteratorBase(MapPointer map, size_t index) noexcept
+        : m_Map(map), m_Index(index)
+        {}
+
+      public:
+        IteratorBase() noexcept
+        {}
+
+        template <bool OtherIsConst, typename = std::enable_if_t<IsConst && !OtherIsConst>>
+        IteratorBase(const IteratorBase<OtherIsConst> &other) noexcept
+        : m_Map(other.m_Map), m_Index(other.m_Index)
+        {}
+
+        inline ValueReference operator*() const noexcept
+        {
+            return m_Map->m_Slots[m_Index];
+        }
+
+        inline ValuePointer operator->() const noexcept
+        {
+            return &m_Map->m_Slots[m_Index];
+        }
+
+        template <bool OtherIsConst> inline bool operator==(const IteratorBase<OtherIsConst> &other) const noexcept
+        {
+            return m_Index == other.m_Index;
+        }
+
+        template <bool OtherIsConst> inline bool operator!=(const IteratorBase<OtherIsConst> &other) const noexcept
+        {
+            return m_Index != other.m_Index;
+        }
+
+        inline IteratorBase &operator++() noexcept
+        {
+            m_Index = m_Map->nextFull(m_Index + 1);
+            return *this;
+        }
+
+        inline IteratorBase operator++(int) noexcept
+        {
+            IteratorBase result = *this;
+            ++*this;
+            return result;
+        }
+        /// @endcond
+    };
+
+    /// @cond
+    using iterator = IteratorBase<false>;
+    using const_iterator = IteratorBase<true>;
+    /// @endcond
+
+    /**
+     @brief Default constructor. Does not allocate.
+     */
+    FlatHashMap() noexcept
+    {}
+
+    /**
+     @brief Copy constructor.
+     */
+    FlatHashMap(const FlatHashMap &other) noexcept
+    : m_Hash(other.m_Hash), m_Equal(other.m_Equal)
+    {
+        if (other.m_Capacity == 0)
+            return;
+
+        allocate(other.m_Capacity);
+        std::memcpy(m_Ctrl, other.m_Ctrl, m_Capacity + kGroupWidth);
+        for (size_t index = 0; index < m_Capacity; ++index)
+        {
+            if (m_Ctrl[index] != kEmpty)
+                std::construct_at(&m_Slots[index], other.m_Slots[index]);
+        }
+        m_Size = other.m_Size;
+    }
+
+    /**
+     @brief Move constructor.
+     */
+    FlatHashMap(FlatHashMap &&other) noexcept
+    {
+        swap(other);
+    }
+
+    /**
+     @brief Assignment.
+     */
+    FlatHashMap &operator=(FlatHashMap other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~FlatHashMap() noexcept
+    {
+        clear();
+        deallocate();
+    }
+
+    /**
+     @brief Exchange the contents of two maps.
+     */
+    void swap(FlatHashMap &other) noexcept
+    {
+        std::swap(m_Ctrl, other.m_Ctrl);
+        std::swap(m_Slots, other.m_Slots);
+        std::swap(m_Capacity, other.m_Capacity);
+        std::swap(m_Size, other.m_Size);
+        std::swap(m_Hash, other.m_Hash);
+        std::swap(m_Equal, other.m_Equal);
+    }
+
+    iterator begin() noexcept
+    {
+        return iterator(this, nextFull(0));
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(this, nextFull(0));
+    }
+
+    const_iterator cbegin() const noexcept
+    {
+        return begin();
+    }
+
+    iterator end() noexcept
+    {
+        return iterator(this, m_Capacity);
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator(this, m_Capacity);
+    }
+
+    const_iterator cend() const noexcept
+    {
+        return end();
+    }
+
+    size_t size() const noexcept
+    {
+        return m_Size;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_Size == 0;
+    }
+
+    iterator find(const KeyType &key) noexcept
+    {
+        return iterator(this, findIndex(key, hashOf(key)));
+    }
+
+    const_iterator find(const KeyType &key) const noexcept
+    {
+        return const_iterator(this, findIndex(key, hashOf(key)));
+    }
+
+    bool contains(const KeyType &key) const noexcept
+    {
+        return findIndex(key, hashOf(key)) != m_Capacity;
+    }
+
+    /**
+     @brief Start loading the memory that a find of this key touches first, without waiting for it.
+     @return The hash of the key, to pass to find().
+     */
+    size_t prefetch(const KeyType &key) const noexcept
+    {
+        size_t hash = hashOf(key);
+        if (m_Size != 0)
+        {
+            BINARY_RELATIONS_PREFETCH(m_Ctrl + homeOf(hash));
+            BINARY_RELATIONS_PREFETCH(m_Slots + homeOf(hash));
+        }
+        return hash;
+    }
+
+    /**
+     @brief Find a key, with the hash that prefetch() returned for it.
+     */
+    const_iterator find(const KeyType &key, size_t hash) const noexcept
+    {
+        return const_iterator(this, findIndex(key, hash));
+    }
+
+    /**
+     @brief Find by any type that hashes and compares like the key. Only if both Hash and KeyEqual are transparent.
+     */
+    template <typename Key>
+        requires kIsTransparent<Key>
+    iterator find(const Key &key) noexcept
+    {
+        return iterator(this, findIndex(key, hashOf(key)));
+    }
+
+    /**
+     @brief Find by any type that hashes and compares like the key. Only if both Hash and KeyEqual are transparent.
+     */
+    template <typename Key>
+        requires kIsTransparent<Key>
+    const_iterator find(const Key &key) const noexcept
+    {
+        return const_iterator(this, findIndex(key, hashOf(key)));
+    }
+
+    /**
+     @brief Test by any type that hashes and compares like the key. Only if both Hash and KeyEqual are transparent.
+     */
+    template <typename Key>
+        requires kIsTransparent<Key>
+    bool contains(const Key &key) const noexcept
+    {
+        return findIndex(key, hashOf(key)) != m_Capacity;
+    }
+
+    /**
+     @brief Insert a value constructed from args, unless the key is already present.
+     @return An iterator to the element with this key, and true if it was inserted.
+     */
+    template <typename... Args> std::pair<iterator, bool> try_emplace(const KeyType &key, Args &&...args) noexcept
+    {
+        size_t hash = hashOf(key);
+        size_t index = findIndex(key, hash);
+        if (index != m_Capacity)
+            return std::pair<iterator, bool>(iterator(this, index), false);
+
+        index = insertNew(hash, std::piecewise_construct, std::forward_as_tuple(key),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+        return std::pair<iterator, bool>(iterator(this, index), true);
+    }
+
+    ValueType &operator[](const KeyType &key) noexcept
+    {
+        return try_emplace(key).first->second;
+    }
+
+    /**
+     @brief Erase the element at this position.
+     Elements that follow may be shifted back into its place, so unlike `std::unordered_map`, no iterator is returned.
+     */
+    void erase(const_iterator it) noexcept
+    {
+        eraseIndex(it.m_Index);
+    }
+
+    /**
+     @brief Erase the element with this key, if present.
+     @return The number of elements erased.
+     */
+    size_t erase(const KeyType &key) noexcept
+    {
+        size_t index = findIndex(key, hashOf(key));
+        if (index == m_Capacity)
+            return 0;
+        eraseIndex(index);
+        return 1;
+    }
+
+    /**
+     @brief Erase all elements. The memory is kept for reuse.
+     */
+    void clear() noexcept
+    {
+        for (size_t index = 0; index < m_Capacity; ++index)
+        {
+            if (m_Ctrl[index] != kEmpty)
+                std::destroy_at(&m_Slots[index]);
+        }
+        if (m_Capacity != 0)
+            std::memset(m_Ctrl, kEmpty, m_Capacity + kGroupWidth);
+        m_Size = 0;
+    }
+
+    /**
+     @brief Make room for at least count elements without rehashing.
+     */
+    void reserve(size_t count) noexcept
+    {
+        size_t capacity = kGroupWidth;
+        while (capacity * 3 < count * 4)
+            capacity *= 2;
+        if (capacity > m_Capacity)
+            rehash(capacity);
+    }
+
+private:
+    static size_t mixHash(size_t hash) noexcept
+    {
+        // std::hash is the identity for integers, but the probe position and the tag need well mixed bits
+        if constexpr (sizeof(size_t) == 8)
+        {
+            hash ^= hash >> 33;
+            hash *= 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 33;
+            hash *= 0xc4ceb9fe1a85ec53ULL;
+            hash ^= hash >> 33;
+        }
+        else
+        {
+            hash ^= hash >> 16;
+            hash *= 0x85ebca6bU;
+            hash ^= hash >> 13;
+            hash *= 0xc2b2ae35U;
+            hash ^= hash >> 16;
+        }
+        return hash;
+    }
+
+    template <typename Key> size_t hashOf(const Key &key) const noexcept
+    {
+        return mixHash(m_Hash(key));
+    }
+
+    static uint8_t tagOf(size_t hash) noexcept
+    {
+        return (uint8_t)(hash & 0x7f);
+    }
+
+    size_t homeOf(size_t hash) const noexcept
+    {
+        return (hash >> 7) & (m_Capacity - 1);
+    }
+
+    static uint32_t matchTag(const uint8_t *group, uint8_t tag) noexcept
+    {
+#ifdef BINARY_RELATIONS_SSE2
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i)
+            mask |= (uint32_t)(group[i] == tag) << i;
+        return mask;
+#endif
+    }
+
+    static uint32_t matchEmpty(const uint8_t *group) noexcept
+    {
+#ifdef BINARY_RELATIONS_SSE2
+        // kEmpty is the only tag with the high bit set
+        return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(group)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i)
+            mask |= (uint32_t)(group[i] == kEmpty) << i;
+        return mask;
+#endif
+    }
+
+    void setCtrl(size_t index, uint8_t tag) noexcept
+    {
+        m_Ctrl[index] = tag;
+        if (index < kGroupWidth)
+            m_Ctrl[m_Capacity + index] = tag; // Keep the copy in sync, so a group can be loaded across the wrap
+    }
+
+    size_t nextFull(size_t index) const noexcept
+    {
+        while (index < m_Capacity && m_Ctrl[index] == kEmpty)
+            ++index;
+        return index;
+    }
+
+    template <typename Key> size_t findIndex(const Key &key, size_t hash) const noexcept
+    {
+        if (m_Size == 0)
+            return m_Capacity;
+
+        uint8_t tag = tagOf(hash);
+        size_t mask = m_Capacity - 1;
+        size_t pos = homeOf(hash);
+        while (true)
+        {
+            const uint8_t *group = m_Ctrl + pos;
+            for (uint32_t bits = matchTag(group, tag); bits != 0; bits &= bits - 1)
+            {
+                size_t index = (pos + std::countr_zero(bits)) & mask;
+                if (m_Equal(m_Slots[index].first, key))
+                    return index;
+            }
+            if (matchEmpty(group) != 0)
+                return m_Capacity; // The probe sequence ends at the first empty slot
+            pos = (pos + kGroupWidth) & mask;
+        }
+    }
+
+    size_t findInsertIndex(size_t hash) const noexcept
+    {
+        size_t mask = m_Capacity - 1;
+        size_t pos = homeOf(hash);
+        while (true)
+        {
+            uint32_t bits = matchEmpty(m_Ctrl + pos);
+            if (bits != 0)
+                return (pos + std::countr_zero(bits)) & mask;
+            pos = (pos + kGroupWidth) & mask;
+        }
+    }
+
+    template <typename... Args> size_t insertNew(size_t hash, Args &&...args) noexcept
+    {
+        if ((m_Size + 1) * 4 > m_Capacity * 3)
+            rehash(m_Capacity == 0 ? kGroupWidth : m_Capacity * 2);
+
+        size_t index = findInsertIndex(hash);
+        std::construct_at(&m_Slots[index], std::forward<Args>(args)...);
+        setCtrl(index, tagOf(hash));
+        m_Size += 1;
+        return index;
+    }
+
+    void eraseIndex(size_t index) noexcept
+    {
+        size_t mask = m_Capacity - 1;
+        size_t hole = index;
+        std::destroy_at(&m_Slots[hole]);
+
+        // Backward shift: pull later elements of the probe run into the hole, as long as that keeps them reachable
+        for (size_t next = (hole + 1) & mask; m_Ctrl[next] != kEmpty; next = (next + 1) & mask)
+        {
+            size_t home = homeOf(hashOf(m_Slots[next].first));
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                std::construct_at(&m_Slots[hole], std::move(m_Slots[next]));
+                std::destroy_at(&m_Slots[next]);
+                setCtrl(hole, m_Ctrl[next]);
+                hole = next;
+            }
+        }
+        setCtrl(hole, kEmpty);
+        m_Size -= 1;
+    }
+
+    void allocate(size_t capacity) noexcept
+    {
+        m_Ctrl = new uint8_t[capacity + kGroupWidth];
+        std::memset(m_Ctrl, kEmpty, capacity + kGroupWidth);
+        m_Slots = static_cast<value_type *>(
+            ::operator new(capacity * sizeof(value_type), std::align_val_t(alignof(value_type))));
+        m_Capacity = capacity;
+    }
+
+    void deallocate() noexcept
+    {
+        if (m_Capacity == 0)
+            return;
+        delete[] m_Ctrl;
+        ::operator delete(m_Slots, std::align_val_t(alignof(value_type)));
+        m_Ctrl = nullptr;
+        m_Slots = nullptr;
+        m_Capacity = 0;
+    }
+
+    void rehash(size_t capacity) noexcept
+    {
+        uint8_t *old_ctrl = m_Ctrl;
+        value_type *old_slots = m_Slots;
+        size_t old_capacity = m_Capacity;
+
+        allocate(capacity);
+        for (size_t old_index = 0; old_index < old_capacity; ++old_index)
+        {
+            if (old_ctrl[old_index] == kEmpty)
+                continue;
+
+            size_t hash = hashOf(old_slots[old_index].first);
+            size_t index = findInsertIndex(hash);
+            std::construct_at(&m_Slots[index], std::move(old_slots[old_index]));
+            std::destroy_at(&old_slots[old_index]);
+            setCtrl(index, tagOf(hash));
+        }
+
+        if (old_capacity != 0)
+        {
+            delete[] old_ctrl;
+            ::operator delete(old_slots, std::align_val_t(alignof(value_type)));
+        }
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ Describes a key type that is a dense integer handle: small non-negative indices, allocated from zero with few gaps.
+ Specialize this for your handle type to make the relations store it in a `DenseHandleMap` instead of a hash map:
+
+     template <> struct BinaryRelations::DenseHandleTraits<Handle>
+     {
+         static constexpr bool kIsDense = true;
+         static constexpr Handle kInvalid = Handle(~0u); // Never used as a real handle
+         static size_t index(const Handle &handle) noexcept { return handle.m_Index; }
+     };
+ */
+template <typename KeyType> struct DenseHandleTraits
+{
+    /// True if the key type is a dense handle.
+    static constexpr bool kIsDense = false;
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A map from dense handles to values, with the part of the `std::unordered_map` interface that the relations use.
+ The elements live in one array, indexed by `DenseHandleTraits<KeyType>::index()`. A slot that holds no element has the
+ key `DenseHandleTraits<KeyType>::kInvalid`, so a lookup is a single array load and a compare. Iteration visits the
+ elements in order of index.
+ Like `FlatHashMap`, insert may invalidate all iterators and element pointers.
+ */
+template <typename KeyType, typename ValueType> class DenseHandleMap
+{
+    using Traits = DenseHandleTraits<KeyType>;
+    static_assert(Traits::kIsDense, "DenseHandleMap needs a DenseHandleTraits specialization for the key type");
+
+public:
+    /// @cond
+    // Like std::pair, but the value is only constructed while the slot holds an element
+    struct value_type
+    {
+        KeyType first = Traits::kInvalid;
+        union
+        {
+            ValueType second;
+        };
+
+        value_type() noexcept
+        {}
+
+        ~value_type() noexcept
+        {}
+    };
+
+    using key_type = KeyType;
+    using mapped_type = ValueType;
+    using size_type = size_t;
+    /// @endcond
+
+private:
+    value_type *m_Slots = nullptr;
+    size_t m_Capacity = 0;
+    size_t m_Size = 0;
+
+public:
+    /**
+     @brief A forward iterator over the (key, value) pairs.
+     */
+    template <bool IsConst> class IteratorBase
+    {
+        /// @cond
+        friend class DenseHandleMap;
+        template <bool> friend class IteratorBase;
+
+        using MapPointer = std::conditional_t<IsConst, const DenseHandleMap *, DenseHandleMap *>;
+        using ValuePointer = std::conditional_t<IsConst, const value_type *, value_type *>;
+        using ValueReference = std::conditional_t<IsConst, const value_type &, value_type &>;
+
+        MapPointer m_Map = nullptr;
+        size_t m_Index = 0;
+
+        IteratorBase(MapPointer map, size_t index) noexcept
+        : m_Map(map), m_Index(index)
+        {}
+
+      public:
+        IteratorBase() noexcept
+        {}
+
+        template <bool OtherIsConst, typename = std::enable_if_t<IsConst && !OtherIsConst>>
+        IteratorBase(const IteratorBase<OtherIsConst> &other) noexcept
+        : m_Map(other.m_Map), m_Index(other.m_Index)
+        {}
+
+        inline ValueReference operator*() const noexcept
+        {
+            return m_Map->m_Slots[m_Index];
+        }
+
+        inline ValuePointer operator->() const noexcept
+        {
+            return &m_Map->m_Slots[m_Index];
+        }
+
+        template <bool OtherIsConst> inline bool operator==(const IteratorBase<OtherIsConst> &other) const noexcept
+        {
+            return m_Index == other.m_Index;
+        }
+
+        template <bool OtherIsConst> inline bool operator!=(const IteratorBase<OtherIsConst> &other) const noexcept
+        {
+            return m_Index != other.m_Index;
+        }
+
+        inline IteratorBase &operator++() noexcept
+        {
+            m_Index = m_Map->nextFull(m_Index + 1);
+            return *this;
+        }
+
+        inline IteratorBase operator++(int) noexcept
+        {
+            IteratorBase result = *this;
+            ++*this;
+            return result;
+        }
+        /// @endcond
+    };
+
+    /// @cond
+    using iterator = IteratorBase<false>;
+    using const_iterator = IteratorBase<true>;
+    /// @endcond
+
+    /**
+     @brief Default constructor. Does not allocate.
+     */
+    DenseHandleMap() noexcept
+    {}
+
+    /**
+     @brief Copy constructor.
+     */
+    DenseHandleMap(const DenseHandleMap &other) noexcept
+    {
+        if (other.m_Capacity == 0)
+            return;
+
+        m_Slots = new value_type[other.m_Capacity];
+        m_Capacity = other.m_Capacity;
+        for (size_t index = 0; index < m_Capacity; ++index)
+        {
+            if (other.isFull(index))
+            {
+                std::construct_at(&m_Slots[index].second, other.m_Slots[index].second);
+                m_Slots[index].first = other.m_Slots[index].first;
+            }
+        }
+        m_Size = other.m_Size;
+    }
+
+    /**
+     @brief Move constructor.
+     */
+    DenseHandleMap(DenseHandleMap &&other) noexcept
+    {
+        swap(other);
+    }
+
+    /**
+     @brief Assignment.
+     */
+    DenseHandleMap &operator=(DenseHandleMap other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~DenseHandleMap() noexcept
+    {
+        clear();
+        delete[] m_Slots;
+    }
+
+    /**
+     @brief Exchange the contents of two maps.
+     */
+    void swap(DenseHandleMap &other) noexcept
+    {
+        std::swap(m_Slots, other.m_Slots);
+        std::swap(m_Capacity, other.m_Capacity);
+        std::swap(m_Size, other.m_Size);
+    }
+
+    iterator begin() noexcept
+    {
+        return iterator(this, nextFull(0));
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(this, nextFull(0));
+    }
+
+    const_iterator cbegin() const noexcept
+    {
+        return begin();
+    }
+
+    iterator end() noexcept
+    {
+        return iterator(this, m_Capacity);
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator(this, m_Capacity);
+    }
+
+    const_iterator cend() const noexcept
+    {
+        return end();
+    }
+
+    size_t size() const noexcept
+    {
+        return m_Size;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_Size == 0;
+    }
+
+    iterator find(const KeyType &key) noexcept
+    {
+        return iterator(this, findIndex(key));
+    }
+
+    const_iterator find(const KeyType &key) const noexcept
+    {
+        return const_iterator(this, findIndex(key));
+    }
+
+    bool contains(const KeyType &key) const noexcept
+    {
+        return findIndex(key) != m_Capacity;
+    }
+
+    /**
+     @brief Start loading the slot of this key, without waiting for it.
+     @return A value to pass to find(), for symmetry with `FlatHashMap`.
+     */
+    size_t prefetch(const KeyType &key) const noexcept
+    {
+        size_t index = Traits::index(key);
+        if (index < m_Capacity)
+            BINARY_RELATIONS_PREFETCH(m_Slots + index);
+        return index;
+    }
+
+    /**
+     @brief Find a key after prefetch().
+     */
+    const_iterator find(const KeyType &key, size_t) const noexcept
+    {
+        return const_iterator(this, findIndex(key));
+    }
+
+    /**
+     @brief Insert a value constructed from args, unless the key is already present.
+     @param key The key. Must not be `DenseHandleTraits<KeyType>::kInvalid`.
+     @return An iterator to the element with this key, and true if it was inserted.
+     */
+    template <typename... Args> std::pair<iterator, bool> try_emplace(const KeyType &key, Args &&...args) noexcept
+    {
+        size_t index = Traits::index(key);
+        if (index >= m_Capacity)
+            grow(std::max(index + 1, m_Capacity * 2));
+        else if (isFull(index))
+            return std::pair<iterator, bool>(iterator(this, index), false);
+
+        std::construct_at(&m_Slots[index].second, std::forward<Args>(args)...);
+        m_Slots[index].first = key;
+        m_Size += 1;
+        return std::pair<iterator, bool>(iterator(this, index), true);
+    }
+
+    ValueType &operator[](const KeyType &key) noexcept
+    {
+        return try_emplace(key).first->second;
+    }
+
+    /**
+     @brief Erase the element at this position.
+     Other elements do not move, but for symmetry with `FlatHashMap`, no iterator is returned.
+     */
+    void erase(const_iterator it) noexcept
+    {
+        eraseIndex(it.m_Index);
+    }
+
+    /**
+     @brief Erase the element with this key, if present.
+     @return The number of elements erased.
+     */
+    size_t erase(const KeyType &key) noexcept
+    {
+        size_t index = findIndex(key);
+        if (index == m_Capacity)
+            return 0;
+        eraseIndex(index);
+        return 1;
+    }
+
+    /**
+     @brief Erase all elements. The memory is kept for reuse.
+     */
+    void clear() noexcept
+    {
+        for (size_t index = 0; m_Size != 0; ++index)
+        {
+            if (isFull(index))
+                eraseIndex(index);
+        }
+    }
+
+    /**
+     @brief Make room for handles with an index below count without reallocating.
+     */
+    void reserve(size_t count) noexcept
+    {
+        if (count > m_Capacity)
+            grow(count);
+    }
+
+    /**
+     @brief The number of handle indices that fit without reallocating.
+     */
+    size_t capacity() const noexcept
+    {
+        return m_Capacity;
+    }
+
+private:
+    bool isFull(size_t index) const noexcept
+    {
+        return !(m_Slots[index].first == Traits::kInvalid);
+    }
+
+    size_t nextFull(size_t index) const noexcept
+    {
+        while (index < m_Capacity && !isFull(index))
+            ++index;
+        return index;
+    }
+
+    size_t findIndex(const KeyType &key) const noexcept
+    {
+        size_t index = Traits::index(key);
+        if (index < m_Capacity && m_Slots[index].first == key && !(key == Traits::kInvalid))
+            return index;
+        return m_Capacity;
+    }
+
+    void eraseIndex(size_t index) noexcept
+    {
+        std::destroy_at(&m_Slots[index].second);
+        m_Slots[index].first = Traits::kInvalid;
+        m_Size -= 1;
+    }
+
+    void grow(size_t capacity) noexcept
+    {
+        capacity = std::max(capacity, (size_t)16);
+        value_type *slots = new value_type[capacity];
+        for (size_t index = 0; index < m_Capacity; ++index)
+        {
+            if (isFull(index))
+            {
+                std::construct_at(&slots[index].second, std::move(m_Slots[index].second));
+                std::destroy_at(&m_Slots[index].second);
+                slots[index].first = m_Slots[index].first;
+            }
+        }
+        delete[] m_Slots;
+        m_Slots = slots;
+        m_Capacity = capacity;
+    }
+};
+
+/// @cond
+template <typename KeyType, typename ValueType, typename HashMap>
+using DenseOrHashMap =
+    std::conditional_t<DenseHandleTraits<KeyType>::kIsDense, DenseHandleMap<KeyType, ValueType>, HashMap>;
+
+// Make room in a map for the keys of a batch. A hash map is sized by element count, key_count if the caller knows how
+// many distinct keys the batch has, but a dense handle map is indexed by handle, so there it takes the largest index in
+// the batch instead.
+template <typename MapType, typename Range, typename KeyOf>
+void reserveForKeys(MapType *map, const Range &items, KeyOf keyOf, size_t key_count) noexcept
+{
+    using KeyType = typename MapType::key_type;
+    if constexpr (!DenseHandleTraits<KeyType>::kIsDense)
+    {
+        map->reserve(map->size() + key_count);
+    }
+    else
+    {
+        size_t end = 0;
+        for (auto &item : items)
+            end = std::max(end, DenseHandleTraits<KeyType>::index(keyOf(item)) + 1);
+        map->reserve(end);
+    }
+}
+
+template <typename MapType, typename Range, typename KeyOf>
+void reserveForKeys(MapType *map, const Range &items, KeyOf keyOf) noexcept
+{
+    reserveForKeys(map, items, keyOf, std::size(items));
+}
+/// @endcond
+
+// ----------------------------------------------------------------------------
+
+/**
+ A 32-bit ID for a string in a `StringPool`. Use it as a key type in place of `std::string`: it is a dense handle (see
+ `DenseHandleTraits`), so the relations store it in direct-indexed arrays, and hashing, sorting and merging are integer
+ operations. Note that IDs sort in the order the strings were first interned, not alphabetically.
+ */
+struct StringId
+{
+    /// The index of the string in its pool. ~0u if the ID is invalid.
+    uint32_t m_Index = ~0u;
+
+    /// Default constructor. Makes an invalid ID.
+    constexpr StringId() noexcept
+    {}
+
+    /// Make an ID from an index.
+    constexpr explicit StringId(uint32_t index) noexcept
+    : m_Index(index)
+    {}
+
+    /// Test whether the ID refers to a string.
+    constexpr bool isValid() const noexcept
+    {
+        return m_Index != ~0u;
+    }
+
+    /// @cond
+    constexpr auto operator<=>(const StringId &other) const noexcept = default;
+    /// @endcond
+};
+
+/// @cond
+template <> struct DenseHandleTraits<StringId>
+{
+    static constexpr bool kIsDense = true;
+    static constexpr StringId kInvalid = StringId();
+
+    static size_t index(const StringId &id) noexcept
+    {
+        return id.m_Index;
+    }
+};
+/// @endcond
+
+/**
+ Stores each distinct string once, and hands out a `StringId` for it. Translate strings to IDs with `intern()` or
+ `find()` before you call a relation, and IDs back to strings with `str()`. One pool can be shared by any number of
+ relations.
+ The characters are kept in large blocks, and never move, so the views returned by `str()` stay valid for the lifetime
+ of the pool.
+ */
+class StringPool
+{
+    static constexpr size_t kBlockSize = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> m_Blocks;
+    char *m_Next = nullptr;
+    size_t m_Remaining = 0;
+    std::vector<std::string_view> m_Strings;
+    FlatHashMap<std::string_view, uint32_t> m_Ids;
+
+public:
+    /**
+     @brief Default constructor. Makes an empty pool.
+     */
+    StringPool() noexcept
+    {}
+
+    StringPool(const StringPool &) = delete;
+    StringPool &operator=(const StringPool &) = delete;
+
+    /**
+     @brief Move constructor. IDs and views handed out by the other pool now belong to this one.
+     */
+    StringPool(StringPool &&other) noexcept
+    {
+        swap(other);
+    }
+
+    /**
+     @brief Move assignment. IDs and views handed out by the other pool now belong to this one.
+     */
+    StringPool &operator=(StringPool &&other) noexcept
+    {
+        StringPool temp(std::move(other));
+        swap(temp);
+        return *this;
+    }
+
+    /**
+     @brief Exchange the contents of two pools.
+     */
+    void swap(StringPool &other) noexcept
+    {
+        m_Blocks.swap(other.m_Blocks);
+        std::swap(m_Next, other.m_Next);
+        std::swap(m_Remaining, other.m_Remaining);
+        m_Strings.swap(other.m_Strings);
+        m_Ids.swap(other.m_Ids);
+    }
+
+    /**
+     @brief Get the ID of a string, adding the string to the pool if it is not there yet.
+     @param string The string.
+     @return The ID of the string.
+     */
+    StringId intern(std::string_view string) noexcept
+    {
+        auto it = m_Ids.find(string);
+        if (it != m_Ids.end())
+            return StringId(it->second);
+
+        std::string_view stored = store(string);
+        uint32_t index = (uint32_t)m_Strings.size();
+        m_Strings.push_back(stored);
+        m_Ids.try_emplace(stored, index);
+        return StringId(index);
+    }
+
+    /**
+     @brief Get the ID of a string without adding it to the pool.
+     An invalid ID is not in any relation, so the result can be passed straight to a query.
+     @param string The string.
+     @return The ID of the string, or an invalid ID if the string is not in the pool.
+     */
+    StringId find(std::string_view string) const noexcept
+    {
+        auto it = m_Ids.find(string);
+        if (it == m_Ids.end())
+            return StringId();
+        return StringId(it->second);
+    }
+
+    /**
+     @brief Get the string of an ID.
+     @param id The ID. Must be valid, and come from this pool.
+     @return A view of the string.
+     */
+    std::string_view str(StringId id) const noexcept
+    {
+        return m_Strings[id.m_Index];
+    }
+
+    /**
+     @brief Count the number of distinct strings in the pool.
+     @return The number of strings.
+     */
+    int count() const noexcept
+    {
+        return (int)m_Strings.size();
+    }
+
+private:
+    std::string_view store(std::string_view string) noexcept
+    {
+        if (string.empty())
+            return std::string_view();
+
+        if (string.size() > m_Remaining)
+        {
+            // Strings too large for a block get a block of their own, and the current block stays in use
+            size_t size = std::max(string.size(), kBlockSize);
+            m_Blocks.push_back(std::make_unique<char[]>(size));
+            if (size == kBlockSize)
+            {
+                m_Next = m_Blocks.back().get();
+                m_Remaining = kBlockSize;
+            }
+            else
+            {
+                std::memcpy(m_Blocks.back().get(), string.data(), string.size());
+                return std::string_view(m_Blocks.back().get(), string.size());
+            }
+        }
+
+        std::memcpy(m_Next, string.data(), string.size());
+        std::string_view stored(m_Next, string.size());
+        m_Next += string.size();
+        m_Remaining -= string.size();
+        return stored;
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A hash function that also accepts lookup types that compare equal to the key, so a query does not need to construct a
+ temporary key. String keys are hashed as `std::string_view`, so a `std::string` key can be looked up by
+ `std::string_view` or `const char *` without an allocation. Other keys are hashed with `std::hash<KeyType>`.
+ */
+template <typename KeyType> struct TransparentHash
+{
+    /// @cond
+    using is_transparent = void;
+    using HashType = std::conditional_t<std::is_convertible_v<const KeyType &, std::string_view>,
+                                        std::hash<std::string_view>, std::hash<KeyType>>;
+
+    template <typename Key> size_t operator()(const Key &key) const noexcept
+    {
+        return HashType()(key);
+    }
+    /// @endcond
+};
+
+/**
+ Storage policy that keeps both sides of a relation in `std::unordered_map`. This is the default.
+ Keys that are dense handles (see `DenseHandleTraits`) are kept in a `DenseHandleMap` instead.
+ */
+struct StdStoragePolicy
+{
+    /// @cond
+    template <typename KeyType, typename ValueType>
+    using Map = DenseOrHashMap<KeyType, ValueType,
+                               std::unordered_map<KeyType, ValueType, TransparentHash<KeyType>, std::equal_to<>>>;
+    /// @endcond
+
+    /// The number of right values a `OneToMany` stores inline with each left value, before it allocates.
+    static constexpr int kInlineRightCount = 4;
+};
+
+/**
+ Storage policy that keeps both sides of a relation in a `FlatHashMap`.
+ This avoids a heap node per key and a pointer chase per lookup, at the cost of iterator stability.
+ Keys that are dense handles (see `DenseHandleTraits`) are kept in a `DenseHandleMap` instead.
+ */
+struct FlatStoragePolicy
+{
+    /// @cond
+    template <typename KeyType, typename ValueType>
+    using Map = DenseOrHashMap<KeyType, ValueType,
+                               FlatHashMap<KeyType, ValueType, TransparentHash<KeyType>, std::equal_to<>>>;
+    /// @endcond
+
+    /// The number of right values a `OneToMany` stores inline with each left value, before it allocates.
+    static constexpr int kInlineRightCount = 4;
+};
+
+// ----------------------------------------------------------------------------
+
+/// @cond
+// Find each key in a map, and call function(index, iterator) with the position of the key in the span, and the result
+// of the find. If the map can prefetch, each batch of keys is hashed and prefetched before any of them is looked up, so
+// the cache misses of the whole batch overlap instead of following each other. std::unordered_map cannot prefetch.
+template <typename MapType, typename KeyType, typename Function>
+void findEach(const MapType &map, std::span<const KeyType> keys, Function function) noexcept
+{
+    if constexpr (requires(const KeyType &key) { map.find(key, map.prefetch(key)); })
+    {
+        constexpr size_t kBatchSize = 16;
+        size_t hashes[kBatchSize];
+        for (size_t start = 0; start < keys.size(); start += kBatchSize)
+        {
+            size_t count = std::min(kBatchSize, keys.size() - start);
+            for (size_t i = 0; i < count; ++i)
+                hashes[i] = map.prefetch(keys[start + i]);
+            for (size_t i = 0; i < count; ++i)
+                function(start + i, map.find(keys[start + i], hashes[i]));
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < keys.size(); ++i)
+            function(i, map.find(keys[i]));
+    }
+}
+/// @endcond
+
+// ----------------------------------------------------------------------------
+
+/// @cond
+template <typename MapType> class UnorderedMapHelper
+{
+public:
+    using KeyType = typename MapType::key_type;
+
+    const MapType* m_Map;
+    
+    UnorderedMapHelper(const MapType* map)
+    : m_Map(map)
+    {}
+    
+    class Iterator
+    {
+    public:
+        typename MapType::const_iterator it;
+
+        inline KeyType operator*() const noexcept
+        {
+            return it->first;
+        }
+        
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return it == other.it;
+        }
+        
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return it != other.it;
+        }
+        
+        inline Iterator operator++() noexcept
+        {
+            it++;
+            return *this;
+        }
+    };
+    
+    Iterator begin() const noexcept
+    {
+        Iterator it;
+        it.it = m_Map->begin();
+        return it;
+    }
+
+    Iterator end() const noexcept
+    {
+        Iterator it;
+        it.it = m_Map->end();
+        return it;
+    }
+};
+/// @endcond
+
+// ----------------------------------------------------------------------------
+
+/**
+ Tag for bulk insert, to promise that the pairs are already sorted by left value, then by right value.
+ */
+struct AssumeSortedTag
+{};
+
+/// Pass this to bulk insert if the pairs are already sorted. For example: `set.insert(kAssumeSorted, pairs);`
+inline constexpr AssumeSortedTag kAssumeSorted;
+
+// ----------------------------------------------------------------------------
+
+template <typename LeftType, typename RightType> class FrozenOneToMany;
+template <typename LeftType, typename RightType> class FrozenManyToMany;
+template <typename LeftType, typename RightType, typename StoragePolicy> class TransposedManyToMany;
+
+// ----------------------------------------------------------------------------
+
+/**
+ A one-to-many set of (left, right) pairs. The left side can have any number of right counterparts. The right side can only be in a pair with one left side.
+ @image html binary-relations-one-to-many.png "one-to-many"
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy = StdStoragePolicy> class OneToMany
+{
+    // The right values of each left value are stored in the map slot itself, up to kInlineRightCount of them
+    using RightVector =
+        SmallVector<RightType, StoragePolicy::kInlineRightCount, std::pmr::polymorphic_allocator<RightType>>;
+    using LeftToRightMap = typename StoragePolicy::template Map<LeftType, RightVector>;
+    using RightToLeftMap = typename StoragePolicy::template Map<RightType, LeftType>;
+
+    VectorResource m_VectorResource; // Must outlive the vectors in the maps
+    LeftToRightMap m_LeftToRight;
+    RightToLeftMap m_RightToLeft;
+
+public:
+    /**
+    @brief A pair of (left, right) values.
+     */
+    struct Pair
+    {
+        LeftType left;
+        RightType right;
+        Pair(LeftType left, RightType right)
+        : left(left), right(right)
+        {}
+        Pair()
+        {}
+    };
+
+    /**
+     @brief Default constructor.
+     Right values that do not fit inline are allocated from a pool that belongs to the set.
+     */
+    OneToMany() noexcept
+    {}
+
+    /**
+     @brief Construct a set that allocates the right values that do not fit inline from the given memory resource.
+     @param resource The memory resource. It must outlive the set.
+     */
+    explicit OneToMany(std::pmr::memory_resource *resource) noexcept
+    : m_VectorResource(resource)
+    {}
+
+    /**
+     @brief Construct a set from a range of pairs, in one pass. The pairs do not have to be sorted, and can have
+     duplicates. If a right value is in more than one pair, the last one wins, as with insert.
+     Both maps are sized exactly, and the right values that do not fit inline are allocated from a single block.
+     @param first Iterator to the first pair.
+     @param last Iterator past the last pair.
+     @param resource The memory resource, or nullptr for a pool that belongs to the set. It must outlive the set.
+     */
+    template <std::input_iterator InputIterator>
+    OneToMany(InputIterator first, InputIterator last, std::pmr::memory_resource *resource = nullptr) noexcept
+    : m_VectorResource(resource)
+    {
+        load(std::vector<Pair>(first, last));
+    }
+
+    /**
+     @brief Construct a set from a span of pairs, in one pass. See the iterator range constructor.
+     @param pairs The pairs.
+     @param resource The memory resource, or nullptr for a pool that belongs to the set. It must outlive the set.
+     */
+    explicit OneToMany(std::span<const Pair> pairs, std::pmr::memory_resource *resource = nullptr) noexcept
+    : OneToMany(pairs.begin(), pairs.end(), resource)
+    {}
+
+    /**
+     @brief Copy constructor.
+     The copy allocates from its own pool, or from the same memory resource as the original if one was given.
+     */
+    OneToMany(const OneToMany &other) noexcept
+    : m_VectorResource(other.m_VectorResource), m_RightToLeft(other.m_RightToLeft)
+    {
+        copyLeftToRight(other);
+    }
+
+    /**
+     @brief Move constructor.
+     */
+    OneToMany(OneToMany &&other) noexcept = default;
+
+    /**
+     @brief Copy assignment. The set keeps allocating from its own pool or memory resource.
+     */
+    OneToMany &operator=(const OneToMany &other) noexcept
+    {
+        if (this != &other)
+        {
+            m_LeftToRight.clear();
+            m_RightToLeft = other.m_RightToLeft;
+            copyLeftToRight(other);
+        }
+        return *this;
+    }
+
+    /**
+     @brief Move assignment.
+     */
+    OneToMany &operator=(OneToMany &&other) noexcept = default;
+
+    /**
+     @brief Insert a pair into the set.
+     The rule for one-to-many is that if the right value is part of an existing pair in the set, that relation will be erased.
+     @param pair The pair to insert.
+     */
+    void insert(const Pair &pair) noexcept
+    {
+        insert(pair.left, pair.right);
+    }
+
+    /**
+     @brief Insert a pair into the set.
+     The rule for one-to-many is that if the right value is part of an existing pair in the set, that relation will be erased.
+     @param left The left side of the pair to add.
+     @param right The right side of the pair to add.
+     */
+    void insert(const LeftType &left, const RightType &right) noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        if (r2l_it != m_RightToLeft.end())
+        {
+            if (r2l_it->second == left)
+                return; // We already have this pair - do nothing
+
+            erase(r2l_it->second, right); // Erase old relation
+        }
+
+        // Will insert if it isn't already there.
+        auto l2r_vec = &m_LeftToRight.try_emplace(left, vectorAllocator()).first->second;
+        insertIntoSortedVector(l2r_vec, right);
+
+        m_RightToLeft[right] = left;
+    }
+
+    /**
+     @brief Insert multiple  pairs into the set.
+     This is faster than inserting the pairs one by one.
+     The rule for one-to-many is that if the right value is part of an existing pair in the set, that pair will be erased.
+     If the same right value appears more than once in pairs, the last pair wins.
+     @param pairs The pairs to add.
+     */
+    void insert(const std::vector<Pair> &pairs) noexcept
+    {
+        insert(std::vector<Pair>(pairs));
+    }
+
+    /**
+     @brief Insert multiple  pairs into the set.
+     Same as above, but the pairs are sorted in place, so no copy is made.
+     @param pairs The pairs to add. They will be reordered.
+     */
+    void insert(std::vector<Pair> &&pairs) noexcept
+    {
+        if (0 == pairs.size())
+            return;
+
+        bool moved_right = claimRightValues(pairs);
+
+        sortLeftThenRight(&pairs);
+
+        insertSortedPairs(pairs, moved_right);
+    }
+
+    /**
+     @brief Insert multiple  pairs into the set, that are already sorted.
+     Same as above, but the pairs are not sorted, and not copied.
+     @param pairs The pairs to add. They must be sorted by left value, then by right value.
+     */
+    void insert(AssumeSortedTag, const std::vector<Pair> &pairs) noexcept
+    {
+        if (0 == pairs.size())
+            return;
+
+        bool moved_right = claimRightValues(pairs);
+        insertSortedPairs(pairs, moved_right);
+    }
+
+    /**
+     @brief Erase a pair from the set.
+     If there is no matching pair in the set, nothing happens.
+     @param pair The pair to erase.
+     */
+    void erase(const Pair &pair) noexcept
+    {
+        erase(pair.left, pair.right);
+    }
+
+    /**
+     @brief Erase a pair from the set.
+     If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair to erase.
+     @param right The right side of the pair to erase.
+     */
+    void erase(const LeftType &left, const RightType &right) noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        if (r2l_it == m_RightToLeft.end())
+            return; // (*,right) not in the set - do nothing
+
+        if (r2l_it->second != left)
+            return; // (left,right) is not in the set - do nothing
+
+        auto l2r_it = m_LeftToRight.find(left);
+        auto l2r_vec = &l2r_it->second;
+        auto l2r_vec_it = findInSortedVector(l2r_vec, right);
+        if (l2r_vec_it != l2r_vec->cend())
+        {
+            l2r_vec->erase(l2r_vec_it);
+            if (l2r_vec->size() == 0)
+            {
+                m_LeftToRight.erase(l2r_it); // Vector is empty now
+            }
+            m_RightToLeft.erase(r2l_it);
+        }
+    }
+
+    /**
+     @brief Erase all pairs with the given left value.
+     If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pairs to erase.
+     */
+    void eraseLeft(const LeftType &left) noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it == m_LeftToRight.end())
+            return;
+
+        for (auto right : l2r_it->second)
+        {
+            auto r2l_it = m_RightToLeft.find(right);
+            m_RightToLeft.erase(r2l_it);
+        }
+
+        m_LeftToRight.erase(l2r_it);
+    }
+
+    /**
+     @brief Erase the pair with the given right value.
+     If there is no matching pair in the set, nothing happens.
+     @param right The right side of the pairs to erase.
+     */
+    void eraseRight(const RightType &right) noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        if (r2l_it == m_RightToLeft.end())
+            return;
+        erase(r2l_it->second, right);
+    }
+
+    /**
+     @brief Erase multiple  pairs from the set.
+     This is faster than erasing the pairs one by one.
+     @param pairs The pairs to erase.
+     */
+    void erase(const std::vector<Pair> &pairs) noexcept
+    {
+        if(0 == pairs.size())
+            return;
+
+        std::vector<Pair> pairs_to_erase;
+        pairs_to_erase.reserve(pairs.size());
+        for (auto &pair : pairs)
+        {
+            auto r2l_it = m_RightToLeft.find(pair.right);
+            if (r2l_it != m_RightToLeft.end() && r2l_it->second == pair.left)
+            {
+                m_RightToLeft.erase(r2l_it);
+                pairs_to_erase.push_back(pair);
+            }
+        }
+
+        sortLeftThenRight(&pairs_to_erase);
+        eraseFromLeftToRight(pairs_to_erase);
+    }
+
+    /**
+     @brief Erase all pairs with any of the given left values.
+     Each right value maps to a single left value, so there are no vectors to compact on the other side.
+     @param lefts The left values. They do not have to be sorted, and may include values that are not in the set.
+     */
+    void eraseLeft(std::span<const LeftType> lefts) noexcept
+    {
+        for (auto &left : lefts)
+        {
+            eraseLeft(left);
+        }
+    }
+
+    /**
+     @brief Erase the pairs with any of the given right values.
+     This is faster than erasing them one by one: each affected vector of right values is compacted once.
+     @param rights The right values. They do not have to be sorted, and may include values that are not in the set.
+     */
+    void eraseRight(std::span<const RightType> rights) noexcept
+    {
+        std::vector<Pair> pairs_to_erase;
+        pairs_to_erase.reserve(rights.size());
+        for (auto &right : rights)
+        {
+            auto r2l_it = m_RightToLeft.find(right);
+            if (r2l_it != m_RightToLeft.end())
+            {
+                pairs_to_erase.push_back(Pair(r2l_it->second, right));
+                m_RightToLeft.erase(r2l_it);
+            }
+        }
+
+        sortLeftThenRight(&pairs_to_erase);
+        eraseFromLeftToRight(pairs_to_erase);
+    }
+
+    /**
+     @brief Insert all pairs of another set. Same as unionWith().
+     @param other The set to insert.
+     */
+    void insert(const OneToMany &other) noexcept
+    {
+        unionWith(other);
+    }
+
+    /**
+     @brief Erase all pairs that are in another set. Same as differenceWith().
+     @param other The set to erase.
+     */
+    void erase(const OneToMany &other) noexcept
+    {
+        differenceWith(other);
+    }
+
+    /**
+     @brief Add all pairs of another set to this one.
+     If a right value has a different left value in the other set, the pair from the other set wins, as with insert.
+     The vectors of right values are merged whole, so this takes time in proportion to the size of the other set.
+     @param other The set to add.
+     */
+    void unionWith(const OneToMany &other) noexcept
+    {
+        if (this == &other)
+            return;
+
+        // Point each right value at its new left value, and take it away from the left value it had
+        reserveForKeys(&m_RightToLeft, other.m_RightToLeft, [](const auto &r2l) { return r2l.first; });
+        std::vector<Pair> pairs_to_erase;
+        for (auto &r2l : other.m_RightToLeft)
+        {
+            auto r2l_result = m_RightToLeft.try_emplace(r2l.first, r2l.second);
+            if (!r2l_result.second && r2l_result.first->second != r2l.second)
+            {
+                pairs_to_erase.push_back(Pair(r2l_result.first->second, r2l.first));
+                r2l_result.first->second = r2l.second;
+            }
+        }
+        sortLeftThenRight(&pairs_to_erase);
+        eraseFromLeftToRight(pairs_to_erase);
+
+        for (auto &l2r : other.m_LeftToRight)
+        {
+            auto l2r_vec = &m_LeftToRight.try_emplace(l2r.first, vectorAllocator()).first->second;
+            mergeIntoSortedVector(l2r_vec, &l2r.second);
+        }
+    }
+
+    /**
+     @brief Keep only the pairs that are also in another set.
+     This takes time in proportion to the size of this set.
+     @param other The set to intersect with.
+     */
+    void intersectWith(const OneToMany &other) noexcept
+    {
+        if (this == &other)
+            return;
+
+        std::vector<LeftType> left_to_erase;
+        std::vector<RightType> right_to_erase;
+        for (auto &l2r : m_LeftToRight)
+        {
+            auto other_it = other.m_LeftToRight.find(l2r.first);
+            if (other_it == other.m_LeftToRight.end())
+                right_to_erase.insert(right_to_erase.end(), l2r.second.begin(), l2r.second.end());
+            else
+                filterSortedVector<true>(&l2r.second, &other_it->second, &right_to_erase);
+
+            if (other_it == other.m_LeftToRight.end() || 0 == l2r.second.size())
+                left_to_erase.push_back(l2r.first);
+        }
+
+        for (auto &right : right_to_erase)
+        {
+            m_RightToLeft.erase(right);
+        }
+        for (auto &left : left_to_erase)
+        {
+            m_LeftToRight.erase(left);
+        }
+    }
+
+    /**
+     @brief Erase all pairs that are in another set.
+     This takes time in proportion to the size of the other set.
+     @param other The set to subtract.
+     */
+    void differenceWith(const OneToMany &other) noexcept
+    {
+        if (this == &other)
+        {
+            clear();
+            return;
+        }
+
+        std::vector<RightType> right_to_erase;
+        for (auto &l2r : other.m_LeftToRight)
+        {
+            auto l2r_it = m_LeftToRight.find(l2r.first);
+            if (l2r_it == m_LeftToRight.end())
+                continue;
+
+            right_to_erase.clear();
+            auto l2r_vec = &l2r_it->second;
+            filterSortedVector<false>(l2r_vec, &l2r.second, &right_to_erase);
+            for (auto &right : right_to_erase)
+            {
+                m_RightToLeft.erase(right);
+            }
+
+            if (0 == l2r_vec->size())
+            {
+                m_LeftToRight.erase(l2r_it);
+            }
+        }
+    }
+
+    /**
+     @brief Erase all pairs from the set.
+     */
+    void clear() noexcept
+    {
+        m_RightToLeft.clear();
+        m_LeftToRight.clear();
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param pair The pair to look for.
+     */
+    bool contains(const Pair &pair) const noexcept
+    {
+        return contains(pair.left, pair.right);
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType, typename RightKey = RightType>
+    bool contains(const LeftKey &left, const RightKey &right) const noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        return r2l_it != m_RightToLeft.cend() && r2l_it->second == left;
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType> bool containsLeft(const LeftKey &left) const noexcept
+    {
+        return m_LeftToRight.contains(left);
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    template <typename RightKey = RightType> bool containsRight(const RightKey &right) const noexcept
+    {
+        return m_RightToLeft.contains(right);
+    }
+
+    /**
+     @brief Find all right values that are paired with this left value.
+     If nothing is found, you will get an empty span.
+     This works well with range-based-for. The right values are sorted.
+     The span is invalidated by the next change to the set.
+     @param left The left side of the pair to look for.
+     @return The span of right values.
+     */
+    template <typename LeftKey = LeftType> std::span<const RightType> findRight(const LeftKey &left) const noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it == m_LeftToRight.end())
+            return std::span<const RightType>();
+
+        return std::span<const RightType>(l2r_it->second.data(), l2r_it->second.size());
+    }
+
+    /**
+     @brief Find the single left value that is paired with this right value.
+     If nothing is found, you will get the notFoundValue.
+     @param right The right side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The singular left value.
+     */
+    template <typename RightKey = RightType>
+    LeftType findLeft(const RightKey &right, const LeftType &notFoundValue) const noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        if (r2l_it == m_RightToLeft.end())
+            return notFoundValue;
+
+        return r2l_it->second;
+    }
+
+    /**
+     @brief Test for each of a list of left values whether any pair in the set has it.
+     The lookups overlap their cache misses, which is faster than testing the values one by one.
+     @param lefts The left values to look for.
+     @param found Receives the result for each left value. Must be at least as long as lefts.
+     */
+    void containsLeft(std::span<const LeftType> lefts, std::span<bool> found) const noexcept
+    {
+        findEach(m_LeftToRight, lefts,
+                 [&](size_t index, auto l2r_it) { found[index] = l2r_it != m_LeftToRight.end(); });
+    }
+
+    /**
+     @brief Test for each of a list of right values whether any pair in the set has it.
+     The lookups overlap their cache misses, which is faster than testing the values one by one.
+     @param rights The right values to look for.
+     @param found Receives the result for each right value. Must be at least as long as rights.
+     */
+    void containsRight(std::span<const RightType> rights, std::span<bool> found) const noexcept
+    {
+        findEach(m_RightToLeft, rights,
+                 [&](size_t index, auto r2l_it) { found[index] = r2l_it != m_RightToLeft.end(); });
+    }
+
+    /**
+     @brief Find the right values of each of a list of left values.
+     The lookups overlap their cache misses, which is faster than finding the values one by one.
+     The spans are invalidated by the next change to the set.
+     @param lefts The left values to look for.
+     @param rights Receives the span of right values for each left value, or an empty span if it is not found. Must be
+     at least as long as lefts.
+     */
+    void findRight(std::span<const LeftType> lefts, std::span<std::span<const RightType>> rights) const noexcept
+    {
+        findEach(m_LeftToRight, lefts, [&](size_t index, auto l2r_it) {
+            if (l2r_it == m_LeftToRight.end())
+                rights[index] = std::span<const RightType>();
+            else
+                rights[index] = std::span<const RightType>(l2r_it->second.data(), l2r_it->second.size());
+        });
+    }
+
+    /**
+     @brief Find the single left value of each of a list of right values.
+     The lookups overlap their cache misses, which is faster than finding the values one by one.
+     @param rights The right values to look for.
+     @param lefts Receives the left value for each right value, or notFoundValue. Must be at least as long as rights.
+     @param notFoundValue The value to write if no matching pair is found.
+     */
+    void findLeft(std::span<const RightType> rights, std::span<LeftType> lefts,
+                  const LeftType &notFoundValue) const noexcept
+    {
+        findEach(m_RightToLeft, rights, [&](size_t index, auto r2l_it) {
+            lefts[index] = r2l_it == m_RightToLeft.end() ? notFoundValue : r2l_it->second;
+        });
+    }
+
+    /**
+     @brief Find the right values paired with this left value that are in the range [low, high).
+     The right values are sorted, so this is a binary search, and no values are copied.
+     @param left The left side of the pairs to look for.
+     @param low The lowest right value to include.
+     @param high The lowest right value to leave out, above low.
+     @return The span of right values in the range. It is invalidated by the next change to the set.
+     */
+    template <typename LeftKey = LeftType>
+    std::span<const RightType> findRightInRange(const LeftKey &left, const RightType &low,
+                                                const RightType &high) const noexcept
+    {
+        auto rights = findRight(left);
+        auto begin_it = std::lower_bound(rights.begin(), rights.end(), low);
+        auto end_it = std::lower_bound(begin_it, rights.end(), high);
+        return std::span<const RightType>(begin_it, end_it);
+    }
+
+    /**
+     @brief Find the right values paired with this left value, starting at the first one that is not less than value.
+     @param left The left side of the pairs to look for.
+     @param value The lowest right value to include.
+     @return The span of right values from value on. It is invalidated by the next change to the set.
+     */
+    template <typename LeftKey = LeftType>
+    std::span<const RightType> lowerBoundRight(const LeftKey &left, const RightType &value) const noexcept
+    {
+        auto rights = findRight(left);
+        return std::span<const RightType>(std::lower_bound(rights.begin(), rights.end(), value), rights.end());
+    }
+
+    /**
+     @brief Count the right values paired with this left value that are in the range [low, high).
+     @param left The left side of the pairs to look for.
+     @param low The lowest right value to count.
+     @param high The lowest right value to leave out, above low.
+     @return The number of right values in the range.
+     */
+    template <typename LeftKey = LeftType>
+    int countRightInRange(const LeftKey &left, const RightType &low, const RightType &high) const noexcept
+    {
+        return (int)findRightInRange(left, low, high).size();
+    }
+
+    /**
+     @brief Count the number of left values in the set.
+     @return The number of left values in the set.
+     */
+    int countLeft() const noexcept
+    {
+        return (int)m_LeftToRight.size();
+    }
+
+    /**
+     @brief Count the number of right values in the set.
+     @return The number of right values in the set.
+     */
+    int countRight() const noexcept
+    {
+        return (int)m_RightToLeft.size();
+    }
+
+    /**
+     @brief Count the number of pairs in the set.
+     @return The number of pairs in the set.
+     */
+    int count() const noexcept
+    {
+        return (int)m_RightToLeft.size();
+    }
+
+    /**
+     @brief List all left elements.
+     @return A helper object to iterate over left elements using range-based-for.
+     */
+    UnorderedMapHelper<LeftToRightMap> allLeft() const noexcept
+    {
+        return UnorderedMapHelper<LeftToRightMap>(&m_LeftToRight);
+    }
+
+    /**
+     @brief List all right elements.
+     @return A helper object to iterate over right elements using range-based-for.
+     */
+    UnorderedMapHelper<RightToLeftMap> allRight() const noexcept
+    {
+        return UnorderedMapHelper<RightToLeftMap>(&m_RightToLeft);
+    }
+
+    /**
+     @brief Make an immutable, compact copy of the set for read-heavy phases.
+     The copy stores all pairs in a few sorted arrays. It has the same query functions, and does not change when this
+     set changes.
+     @return The frozen copy.
+     */
+    FrozenOneToMany<LeftType, RightType> freeze() const noexcept
+    {
+        return FrozenOneToMany<LeftType, RightType>(*this);
+    }
+
+    /**
+     @brief A range-based-for compatible iterator.
+     */
+    class Iterator
+    {
+        /// @cond
+      public:
+        typename LeftToRightMap::const_iterator l2r_it;
+        typename LeftToRightMap::const_iterator l2r_it_end;
+        typename RightVector::const_iterator l2r_vec_it;
+
+        inline Pair operator*() const noexcept
+        {
+            auto left = l2r_it->first;
+            auto right = *l2r_vec_it;
+            return Pair(left, right);
+        }
+
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return l2r_it == other.l2r_it;
+        }
+
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return l2r_it != other.l2r_it;
+        }
+
+        inline Iterator operator++() noexcept
+        {
+            l2r_vec_it++;
+            if (l2r_vec_it == l2r_it->second.cend())
+            {
+                l2r_it++;
+                if (l2r_it != l2r_it_end)
+                {
+                    l2r_vec_it = l2r_it->second.cbegin();
+                }
+            }
+            return *this;
+        }
+        /// @endcond
+    };
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to the first pair in the set.
+     */
+    Iterator begin() const noexcept
+    {
+        Iterator it;
+        it.l2r_it = m_LeftToRight.cbegin();
+        it.l2r_it_end = m_LeftToRight.cend();
+        if (it.l2r_it != it.l2r_it_end)
+        {
+            it.l2r_vec_it = it.l2r_it->second.cbegin();
+        }
+        return it;
+    }
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to one after the last pair in the set.
+     */
+    Iterator end() const noexcept
+    {
+        Iterator it;
+        it.l2r_it = m_LeftToRight.cend();
+        return it;
+    }
+
+    /**
+     @brief Call a function for every pair in the set, on several threads.
+     The pairs are divided among the threads in chunks of about the same number of pairs, so a left value with many
+     right values does not hold up the others. The function is called from several threads at once, and must not
+     change the set.
+     @param function The function to call, as function(left, right).
+     @param threadCount The number of threads to use, including the calling thread. Zero means one per hardware thread.
+     */
+    template <typename Function> void forEachParallel(Function function, int threadCount = 0) const noexcept
+    {
+        auto rights_of = [](const auto &rights) { return std::span<const RightType>(rights.data(), rights.size()); };
+        forEachPairParallel<RightType>(m_LeftToRight, rights_of, threadCount, function);
+    }
+
+private:
+    typename RightVector::allocator_type vectorAllocator() noexcept
+    {
+        return typename RightVector::allocator_type(m_VectorResource.get());
+    }
+
+    // First pass of bulk insert, in the order given: point each right value at its new left value, and take it away
+    // from the left value it had. Returns true if any right value changed left value. Only then can there be pairs
+    // that lose their right value to a later pair in the batch.
+    bool claimRightValues(const std::vector<Pair> &pairs) noexcept
+    {
+        reserveForKeys(&m_RightToLeft, pairs, [](const Pair &pair) { return pair.right; });
+
+        std::vector<Pair> pairs_to_erase;
+        for (auto &pair : pairs)
+        {
+            auto r2l_result = m_RightToLeft.try_emplace(pair.right, pair.left);
+            if (!r2l_result.second && r2l_result.first->second != pair.left)
+            {
+                pairs_to_erase.push_back(Pair(r2l_result.first->second, pair.right));
+                r2l_result.first->second = pair.left;
+            }
+        }
+
+        if (0 == pairs_to_erase.size())
+            return false;
+
+        sortLeftThenRight(&pairs_to_erase);
+
+        // Some of these pairs were only claimed earlier in this batch, and are not in m_LeftToRight. That is harmless.
+        std::vector<RightType> right_to_erase;
+        auto end_it = pairs_to_erase.cend();
+        for (auto it = pairs_to_erase.cbegin(); it != end_it; )
+        {
+            // Collect all right values that have the same left value
+            right_to_erase.clear();
+            auto left = it->left;
+            while(it != end_it && it->left == left)
+            {
+                right_to_erase.push_back(it->right);
+                it++;
+            }
+
+            // Erase them in one go
+            auto l2r_it = m_LeftToRight.find(left);
+            if (l2r_it != m_LeftToRight.end())
+            {
+                auto l2r_vec = &l2r_it->second;
+                removeFromSortedVector(l2r_vec, &right_to_erase);
+
+                if(0 == l2r_vec->size())
+                {
+                    m_LeftToRight.erase(l2r_it);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Second pass of bulk insert: merge the pairs that won their right value into m_LeftToRight, one left value at a time
+    void insertSortedPairs(const std::vector<Pair> &pairs, bool checkWinners) noexcept
+    {
+        std::vector<RightType> right_to_insert;
+        auto it_end = pairs.cend();
+        for (auto it = pairs.cbegin(); it != it_end; )
+        {
+            // Collect all right values that have the same left value
+            right_to_insert.clear();
+            auto left = it->left;
+            while(it != it_end && it->left == left)
+            {
+                if (!checkWinners || m_RightToLeft.find(it->right)->second == left)
+                    right_to_insert.push_back(it->right);
+                it++;
+            }
+
+            // Insert them in one go
+            if (0 != right_to_insert.size())
+            {
+                auto l2r_vec = &m_LeftToRight.try_emplace(left, vectorAllocator()).first->second;
+                mergeIntoSortedVector(l2r_vec, &right_to_insert);
+            }
+        }
+    }
+
+    // Build both maps of an empty set from scratch
+    void load(std::vector<Pair> pairs) noexcept
+    {
+        // The last pair of each right value wins, as with insert
+        reserveForKeys(&m_RightToLeft, pairs, [](const Pair &pair) { return pair.right; });
+        for (auto &pair : pairs)
+        {
+            auto r2l_result = m_RightToLeft.try_emplace(pair.right, pair.left);
+            if (!r2l_result.second)
+                r2l_result.first->second = pair.left;
+        }
+
+        // Sort once, then drop the pairs that lost their right value, and duplicates. Count the left values, and the
+        // bytes of the right values that do not fit inline.
+        sortLeftThenRight(&pairs);
+        auto kept_it = pairs.begin();
+        size_t left_count = 0;
+        size_t block_size = 0;
+        size_t right_count = 0;
+        for (auto it = pairs.begin(); it != pairs.end(); it++)
+        {
+            if (m_RightToLeft.find(it->right)->second != it->left)
+                continue;
+            if (kept_it != pairs.begin())
+            {
+                auto &last = *std::prev(kept_it);
+                if (last.left == it->left && last.right == it->right)
+                    continue;
+                if (last.left != it->left)
+                {
+                    if (right_count > StoragePolicy::kInlineRightCount)
+                        block_size += BlockResource::roundUp(right_count * sizeof(RightType));
+                    right_count = 0;
+                }
+            }
+            if (right_count == 0)
+                left_count++;
+            right_count++;
+            if (kept_it != it)
+                *kept_it = std::move(*it);
+            kept_it++;
+        }
+        if (right_count > StoragePolicy::kInlineRightCount)
+            block_size += BlockResource::roundUp(right_count * sizeof(RightType));
+        pairs.erase(kept_it, pairs.end());
+
+        m_VectorResource.reserveBlock(block_size);
+        reserveForKeys(&m_LeftToRight, pairs, [](const Pair &pair) { return pair.left; }, left_count);
+
+        // Build each sorted array straight from its run of pairs
+        auto it_end = pairs.end();
+        for (auto it = pairs.begin(); it != it_end; )
+        {
+            auto run_it = it;
+            while (it != it_end && it->left == run_it->left)
+                it++;
+            auto rights = std::ranges::subrange(run_it, it) |
+                          std::views::transform([](Pair &pair) -> RightType && { return std::move(pair.right); });
+            m_LeftToRight.try_emplace(run_it->left, rights.begin(), rights.end(), vectorAllocator());
+        }
+    }
+
+    // Remove pairs sorted by left value, then by right value, from m_LeftToRight, one left value at a time
+    void eraseFromLeftToRight(const std::vector<Pair> &pairs) noexcept
+    {
+        std::vector<RightType> right_to_erase;
+        auto end_it = pairs.cend();
+        for (auto it = pairs.cbegin(); it != end_it; )
+        {
+            // Collect all right values that have the same left value
+            right_to_erase.clear();
+            auto left = it->left;
+            while(it != end_it && it->left == left)
+            {
+                right_to_erase.push_back(it->right);
+                it++;
+            }
+
+            // Erase them in one go
+            auto l2r_it = m_LeftToRight.find(left);
+            if (l2r_it != m_LeftToRight.end())
+            {
+                auto l2r_vec = &l2r_it->second;
+                removeFromSortedVector(l2r_vec, &right_to_erase);
+
+                if(0 == l2r_vec->size())
+                {
+                    m_LeftToRight.erase(l2r_it);
+                }
+            }
+        }
+    }
+
+    void copyLeftToRight(const OneToMany &other) noexcept
+    {
+        m_LeftToRight.reserve(other.m_LeftToRight.size());
+        for (auto &l2r : other.m_LeftToRight)
+        {
+            m_LeftToRight.try_emplace(l2r.first, l2r.second, vectorAllocator());
+        }
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A many-to-many set of (left, right) pairs.
+ @image html binary-relations-many-to-many.png "many-to-many"
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy = StdStoragePolicy> class ManyToMany
+{
+    // The vectors are stored in the map slots, and their elements are allocated from m_VectorResource
+    using RightVector = std::vector<RightType, std::pmr::polymorphic_allocator<RightType>>;
+    using LeftVector = std::vector<LeftType, std::pmr::polymorphic_allocator<LeftType>>;
+    using LeftToRightMap = typename StoragePolicy::template Map<LeftType, RightVector>;
+    using RightToLeftMap = typename StoragePolicy::template Map<RightType, LeftVector>;
+
+    VectorResource m_VectorResource; // Must outlive the vectors in the maps
+    LeftToRightMap m_LeftToRight;
+    RightToLeftMap m_RightToLeft;
+    int m_Count;
+
+    template <typename, typename, typename> friend class ManyToMany; // For transpose()
+
+public:
+    /**
+    @brief A pair of (left, right) values.
+     */
+    struct Pair
+    {
+        LeftType left;
+        RightType right;
+        Pair(LeftType left, RightType right) : left(left), right(right)
+        {
+        }
+        Pair()
+        {
+        }
+    };
+
+    /**
+     @brief Default constructor.
+     The vectors of left and right values are allocated from a pool that belongs to the set.
+     */
+    ManyToMany() noexcept
+    : m_Count(0)
+    {}
+
+    /**
+     @brief Construct a set that allocates the vectors of left and right values from the given memory resource.
+     @param resource The memory resource. It must outlive the set.
+     */
+    explicit ManyToMany(std::pmr::memory_resource *resource) noexcept
+    : m_VectorResource(resource), m_Count(0)
+    {}
+
+    /**
+     @brief Construct a set from a range of pairs, in one pass. The pairs do not have to be sorted, and can have
+     duplicates. Both maps are sized exactly, and all vectors of left and right values are allocated from a single block.
+     @param first Iterator to the first pair.
+     @param last Iterator past the last pair.
+     @param resource The memory resource, or nullptr for a pool that belongs to the set. It must outlive the set.
+     */
+    template <std::input_iterator InputIterator>
+    ManyToMany(InputIterator first, InputIterator last, std::pmr::memory_resource *resource = nullptr) noexcept
+    : m_VectorResource(resource), m_Count(0)
+    {
+        load(std::vector<Pair>(first, last));
+    }
+
+    /**
+     @brief Construct a set from a span of pairs, in one pass. See the iterator range constructor.
+     @param pairs The pairs.
+     @param resource The memory resource, or nullptr for a pool that belongs to the set. It must outlive the set.
+     */
+    explicit ManyToMany(std::span<const Pair> pairs, std::pmr::memory_resource *resource = nullptr) noexcept
+    : ManyToMany(pairs.begin(), pairs.end(), resource)
+    {}
+
+    /**
+     @brief Copy constructor.
+     The copy allocates from its own pool, or from the same memory resource as the original if one was given.
+     */
+    ManyToMany(const ManyToMany &other) noexcept
+    : m_VectorResource(other.m_VectorResource), m_Count(other.m_Count)
+    {
+        copyMaps(other);
+    }
+
+    /**
+     @brief Move constructor.
+     */
+    ManyToMany(ManyToMany &&other) noexcept = default;
+
+    /**
+     @brief Copy assignment. The set keeps allocating from its own pool or memory resource.
+     */
+    ManyToMany &operator=(const ManyToMany &other) noexcept
+    {
+        if (this != &other)
+        {
+            m_LeftToRight.clear();
+            m_RightToLeft.clear();
+            copyMaps(other);
+            m_Count = other.m_Count;
+        }
+        return *this;
+    }
+
+    /**
+     @brief Move assignment.
+     */
+    ManyToMany &operator=(ManyToMany &&other) noexcept = default;
+
+    /**
+     @brief Insert a pair into the set.
+     @param pair The pair to insert.
+     */
+    void insert(const Pair &pair) noexcept
+    {
+        insert(pair.left, pair.right);
+    }
+
+    /**
+     @brief Insert a pair into the set.
+     @param left The left side of the pair to add.
+     @param right The right side of the pair to add.
+     */
+    void insert(const LeftType &left, const RightType &right) noexcept
+    {
+        // Will insert if it isn't already there.
+        auto l2r_vec = &m_LeftToRight.try_emplace(left, rightAllocator()).first->second;
+        if (0 == insertIntoSortedVector(l2r_vec, right))
+            return; // We already have this pair;
+
+        auto r2l_vec = &m_RightToLeft.try_emplace(right, leftAllocator()).first->second;
+        insertIntoSortedVector(r2l_vec, left);
+        m_Count += 1;
+    }
+
+    /**
+     @brief Insert multiple  pairs into the set.
+     This is faster than inserting the pairs one by one.
+     @param pairs The pairs to add.
+     */
+    void insert(const std::vector<Pair> &pairs) noexcept
+    {
+        insert(std::vector<Pair>(pairs));
+    }
+
+    /**
+     @brief Insert multiple  pairs into the set.
+     Same as above, but the pairs are sorted in place, so no copy is made.
+     @param pairs The pairs to add. They will be reordered.
+     */
+    void insert(std::vector<Pair> &&pairs) noexcept
+    {
+        if(0 == pairs.size())
+            return;
+
+        sortLeftThenRight(&pairs);
+        insertIntoLeftToRight(pairs);
+
+        sortRightThenLeft(&pairs);
+        insertIntoRightToLeft(pairs);
+    }
+
+    /**
+     @brief Insert multiple  pairs into the set, that are already sorted.
+     Same as above, but the left to right side is built without sorting. The right to left side still needs one sort
+     of a copy of the pairs.
+     @param pairs The pairs to add. They must be sorted by left value, then by right value.
+     */
+    void insert(AssumeSortedTag, const std::vector<Pair> &pairs) noexcept
+    {
+        if(0 == pairs.size())
+            return;
+
+        insertIntoLeftToRight(pairs);
+
+        std::vector<Pair> pairs_by_right = pairs;
+        sortRightThenLeft(&pairs_by_right);
+        insertIntoRightToLeft(pairs_by_right);
+    }
+
+    /**
+     @brief Insert multiple  pairs into the set, using several threads.
+     The left to right and right to left sides are sorted and merged at the same time, and the work on each side is
+     divided by key among the threads. The result is the same as the other bulk inserts. Use this for very large
+     batches; for small ones, starting the threads costs more than it saves.
+     @param pairs The pairs to add. Pass them with std::move to avoid a copy.
+     @param threadCount The number of threads to use, including the calling thread. Zero means one per hardware thread.
+     */
+    void insertParallel(std::vector<Pair> pairs, int threadCount = 0) noexcept
+    {
+        if(0 == pairs.size())
+            return;
+
+        threadCount = resolveThreadCount(threadCount);
+        int side_thread_count = std::max(1, threadCount / 2);
+        int task_count = threadCount * 4;
+
+        ParallelMerge<LeftType, RightType, RightVector> left_to_right;
+        ParallelMerge<RightType, LeftType, LeftVector> right_to_left;
+        std::vector<Pair> pairs_by_right = pairs;
+        runParallel(2, 2, [&](size_t side)
+        {
+            if (0 == side)
+            {
+                parallelSortPairs(&pairs, side_thread_count, LessLeftThenRight());
+                left_to_right.group(pairs, [](const Pair &pair) { return pair.left; },
+                                    [](const Pair &pair) { return pair.right; }, task_count);
+            }
+            else
+            {
+                parallelSortPairs(&pairs_by_right, side_thread_count, LessRightThenLeft());
+                right_to_left.group(pairs_by_right, [](const Pair &pair) { return pair.right; },
+                                    [](const Pair &pair) { return pair.left; }, task_count);
+            }
+        });
+
+        size_t left_task_count = left_to_right.taskCount();
+        size_t total_task_count = left_task_count + right_to_left.taskCount();
+        runParallel(total_task_count, threadCount, [&](size_t task)
+        {
+            if (task < left_task_count)
+                left_to_right.count(m_LeftToRight, task);
+            else
+                right_to_left.count(m_RightToLeft, task - left_task_count);
+        });
+
+        // Both sides allocate from the same memory resource, so this part runs on one thread
+        m_Count += left_to_right.grow(&m_LeftToRight, rightAllocator());
+        right_to_left.grow(&m_RightToLeft, leftAllocator());
+
+        runParallel(total_task_count, threadCount, [&](size_t task)
+        {
+            if (task < left_task_count)
+                left_to_right.merge(task);
+            else
+                right_to_left.merge(task - left_task_count);
+        });
+    }
+
+    /**
+     @brief Erase a pair from the set.
+     If there is no matching pair in the set, nothing happens.
+     @param pair The pair to erase.
+     */
+    void erase(const Pair &pair) noexcept
+    {
+        erase(pair.left, pair.right);
+    }
+
+    /**
+     @brief Erase a pair from the set.
+     If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair to erase.
+     @param right The right side of the pair to erase.
+     */
+    void erase(const LeftType &left, const RightType &right) noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it != m_LeftToRight.end())
+        {
+            auto r2l_it = m_RightToLeft.find(right);
+            if (r2l_it != m_RightToLeft.end())
+            {
+                auto l2r_vec = &l2r_it->second;
+                auto r2l_vec = &r2l_it->second;
+
+                if (0 == eraseFromSortedVector(l2r_vec, right))
+                    return; // (left,right) is not in the set - do nothing
+                eraseFromSortedVector(r2l_vec, left);
+
+                if(l2r_vec->size() == 0)
+                {
+                    m_LeftToRight.erase(l2r_it);
+                }
+
+                if(r2l_vec->size() == 0)
+                {
+                    m_RightToLeft.erase(r2l_it);
+                }
+                
+                m_Count -= 1;
+            }
+        }
+    }
+
+    /**
+     @brief Erase all pairs with the given left value.
+     If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pairs to erase.
+     */
+    void eraseLeft(const LeftType &left) noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it != m_LeftToRight.end())
+        {
+            for (auto right : l2r_it->second)
+            {
+                auto r2l_it = m_RightToLeft.find(right);
+                auto r2l_vec = &r2l_it->second;
+                eraseFromSortedVector(r2l_vec, left);
+                m_Count -= 1;
+                if (r2l_vec->size() == 0)
+                {
+                    m_RightToLeft.erase(r2l_it);
+                }
+            }
+            m_LeftToRight.erase(l2r_it);
+        }
+    }
+
+    /**
+     @brief Erase the pair with the given right value.
+     If there is no matching pair in the set, nothing happens.
+     @param right The right side of the pairs to erase.
+     */
+    void eraseRight(const RightType &right) noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        if (r2l_it != m_RightToLeft.end())
+        {
+            for (auto left : r2l_it->second)
+            {
+                auto l2r_it = m_LeftToRight.find(left);
+                auto l2r_vec = &l2r_it->second;
+                eraseFromSortedVector(l2r_vec, right);
+                m_Count -= 1;
+                if (l2r_vec->size() == 0)
+                {
+                    m_LeftToRight.erase(l2r_it);
+                }
+            }
+            m_RightToLeft.erase(r2l_it);
+        }
+    }
+
+    /**
+     @brief Erase multiple  pairs from the set.
+     This is faster than erasing the pairs one by one.
+     @param pairs The pairs to erase.
+     */
+    void erase(const std::vector<Pair> &pairs) noexcept
+    {
+        if(0 == pairs.size())
+            return;
+
+        std::vector<Pair> pairs_to_erase = pairs;  // Deep copy...
+        sortLeftThenRight(&pairs_to_erase); // ...so I can sort
+        m_Count -= eraseFromLeftToRight(pairs_to_erase);
+
+        sortRightThenLeft(&pairs_to_erase);
+        eraseFromRightToLeft(pairs_to_erase);
+    }
+
+    /**
+     @brief Erase all pairs with any of the given left values.
+     This is faster than erasing them one by one: each affected vector of left values is compacted once.
+     @param lefts The left values. They do not have to be sorted, and may include values that are not in the set.
+     */
+    void eraseLeft(std::span<const LeftType> lefts) noexcept
+    {
+        std::vector<Pair> pairs_to_erase;
+        for (auto &left : lefts)
+        {
+            auto l2r_it = m_LeftToRight.find(left);
+            if (l2r_it == m_LeftToRight.end())
+                continue;
+            for (auto &right : l2r_it->second)
+            {
+                pairs_to_erase.push_back(Pair(left, right));
+            }
+            m_Count -= (int)l2r_it->second.size();
+            m_LeftToRight.erase(l2r_it);
+        }
+
+        sortRightThenLeft(&pairs_to_erase);
+        eraseFromRightToLeft(pairs_to_erase);
+    }
+
+    /**
+     @brief Erase all pairs with any of the given right values.
+     This is faster than erasing them one by one: each affected vector of right values is compacted once.
+     @param rights The right values. They do not have to be sorted, and may include values that are not in the set.
+     */
+    void eraseRight(std::span<const RightType> rights) noexcept
+    {
+        std::vector<Pair> pairs_to_erase;
+        for (auto &right : rights)
+        {
+            auto r2l_it = m_RightToLeft.find(right);
+            if (r2l_it == m_RightToLeft.end())
+                continue;
+            for (auto &left : r2l_it->second)
+            {
+                pairs_to_erase.push_back(Pair(left, right));
+            }
+            m_RightToLeft.erase(r2l_it);
+        }
+
+        sortLeftThenRight(&pairs_to_erase);
+        m_Count -= eraseFromLeftToRight(pairs_to_erase);
+    }
+
+    /**
+     @brief Insert all pairs of another set. Same as unionWith().
+     @param other The set to insert.
+     */
+    void insert(const ManyToMany &other) noexcept
+    {
+        unionWith(other);
+    }
+
+    /**
+     @brief Erase all pairs that are in another set. Same as differenceWith().
+     @param other The set to erase.
+     */
+    void erase(const ManyToMany &other) noexcept
+    {
+        differenceWith(other);
+    }
+
+    /**
+     @brief Add all pairs of another set to this one.
+     The vectors of both sides are merged whole, so this takes time in proportion to the size of the other set.
+     @param other The set to add.
+     */
+    void unionWith(const ManyToMany &other) noexcept
+    {
+        if (this == &other)
+            return;
+
+        for (auto &l2r : other.m_LeftToRight)
+        {
+            auto l2r_vec = &m_LeftToRight.try_emplace(l2r.first, rightAllocator()).first->second;
+            m_Count += mergeIntoSortedVector(l2r_vec, &l2r.second);
+        }
+        for (auto &r2l : other.m_RightToLeft)
+        {
+            auto r2l_vec = &m_RightToLeft.try_emplace(r2l.first, leftAllocator()).first->second;
+            mergeIntoSortedVector(r2l_vec, &r2l.second);
+        }
+    }
+
+    /**
+     @brief Keep only the pairs that are also in another set.
+     Each side is filtered on its own, so this takes time in proportion to the size of this set.
+     @param other The set to intersect with.
+     */
+    void intersectWith(const ManyToMany &other) noexcept
+    {
+        if (this == &other)
+            return;
+
+        std::vector<LeftType> left_to_erase;
+        for (auto &l2r : m_LeftToRight)
+        {
+            auto other_it = other.m_LeftToRight.find(l2r.first);
+            if (other_it == other.m_LeftToRight.end())
+                m_Count -= (int)l2r.second.size();
+            else
+                m_Count -= filterSortedVector<true>(&l2r.second, &other_it->second, (RightVector *)nullptr);
+
+            if (other_it == other.m_LeftToRight.end() || 0 == l2r.second.size())
+                left_to_erase.push_back(l2r.first);
+        }
+        for (auto &left : left_to_erase)
+        {
+            m_LeftToRight.erase(left);
+        }
+
+        std::vector<RightType> right_to_erase;
+        for (auto &r2l : m_RightToLeft)
+        {
+            auto other_it = other.m_RightToLeft.find(r2l.first);
+            if (other_it != other.m_RightToLeft.end())
+                filterSortedVector<true>(&r2l.second, &other_it->second, (LeftVector *)nullptr);
+
+            if (other_it == other.m_RightToLeft.end() || 0 == r2l.second.size())
+                right_to_erase.push_back(r2l.first);
+        }
+        for (auto &right : right_to_erase)
+        {
+            m_RightToLeft.erase(right);
+        }
+    }
+
+    /**
+     @brief Erase all pairs that are in another set.
+     Each side is filtered on its own, so this takes time in proportion to the size of the other set.
+     @param other The set to subtract.
+     */
+    void differenceWith(const ManyToMany &other) noexcept
+    {
+        if (this == &other)
+        {
+            clear();
+            return;
+        }
+
+        for (auto &l2r : other.m_LeftToRight)
+        {
+            auto l2r_it = m_LeftToRight.find(l2r.first);
+            if (l2r_it == m_LeftToRight.end())
+                continue;
+
+            auto l2r_vec = &l2r_it->second;
+            m_Count -= filterSortedVector<false>(l2r_vec, &l2r.second, (RightVector *)nullptr);
+            if (0 == l2r_vec->size())
+            {
+                m_LeftToRight.erase(l2r_it);
+            }
+        }
+        for (auto &r2l : other.m_RightToLeft)
+        {
+            auto r2l_it = m_RightToLeft.find(r2l.first);
+            if (r2l_it == m_RightToLeft.end())
+                continue;
+
+            auto r2l_vec = &r2l_it->second;
+            filterSortedVector<false>(r2l_vec, &r2l.second, (LeftVector *)nullptr);
+            if (0 == r2l_vec->size())
+            {
+                m_RightToLeft.erase(r2l_it);
+            }
+        }
+    }
+
+    /**
+     @brief Erase all pairs from the set.
+     */
+    void clear() noexcept
+    {
+        m_RightToLeft.clear();
+        m_LeftToRight.clear();
+        m_Count = 0;
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param pair The pair to look for.
+     */
+    bool contains(const Pair &pair) const noexcept
+    {
+        return contains(pair.left, pair.right);
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType, typename RightKey = RightType>
+    bool contains(const LeftKey &left, const RightKey &right) const noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it != m_LeftToRight.end())
+        {
+            auto r2l_it = m_RightToLeft.find(right);
+            if (r2l_it != m_RightToLeft.end())
+            {
+                auto l2r_vec = &l2r_it->second;
+                auto r2l_vec = &r2l_it->second;
+                if (l2r_vec->size() < r2l_vec->size())
+                {
+                    return containsInSortedVector(l2r_vec, right);
+                }
+                else
+                {
+                    return containsInSortedVector(r2l_vec, left);
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType> bool containsLeft(const LeftKey &left) const noexcept
+    {
+        return m_LeftToRight.contains(left);
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    template <typename RightKey = RightType> bool containsRight(const RightKey &right) const noexcept
+    {
+        return m_RightToLeft.contains(right);
+    }
+
+    /**
+     @brief Find all right values that are paired with this left value.
+     If nothing is found, you will get an empty span.
+     This works well with range-based-for. The right values are sorted.
+     The span is invalidated by the next change to the set.
+     @param left The left side of the pair to look for.
+     @return The span of right values.
+     */
+    template <typename LeftKey = LeftType> std::span<const RightType> findRight(const LeftKey &left) const noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it == m_LeftToRight.end())
+            return std::span<const RightType>();
+
+        return std::span<const RightType>(l2r_it->second.data(), l2r_it->second.size());
+    }
+
+    /**
+     @brief Find all left values that are paired with this right value.
+     If nothing is found, you will get an empty span.
+     This works well with range-based-for. The left values are sorted.
+     The span is invalidated by the next change to the set.
+     @param right The right side of the pair to look for.
+     @return The span of left values.
+     */
+    template <typename RightKey = RightType> std::span<const LeftType> findLeft(const RightKey &right) const noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        if (r2l_it == m_RightToLeft.end())
+            return std::span<const LeftType>();
+
+        return std::span<const LeftType>(r2l_it->second.data(), r2l_it->second.size());
+    }
+
+    /**
+     @brief Test for each of a list of left values whether any pair in the set has it.
+     The lookups overlap their cache misses, which is faster than testing the values one by one.
+     @param lefts The left values to look for.
+     @param found Receives the result for each left value. Must be at least as long as lefts.
+     */
+    void containsLeft(std::span<const LeftType> lefts, std::span<bool> found) const noexcept
+    {
+        findEach(m_LeftToRight, lefts,
+                 [&](size_t index, auto l2r_it) { found[index] = l2r_it != m_LeftToRight.end(); });
+    }
+
+    /**
+     @brief Test for each of a list of right values whether any pair in the set has it.
+     The lookups overlap their cache misses, which is faster than testing the values one by one.
+     @param rights The right values to look for.
+     @param found Receives the result for each right value. Must be at least as long as rights.
+     */
+    void containsRight(std::span<const RightType> rights, std::span<bool> found) const noexcept
+    {
+        findEach(m_RightToLeft, rights,
+                 [&](size_t index, auto r2l_it) { found[index] = r2l_it != m_RightToLeft.end(); });
+    }
+
+    /**
+     @brief Find the right values of each of a list of left values.
+     The lookups overlap their cache misses, which is faster than finding the values one by one.
+     The spans are invalidated by the next change to the set.
+     @param lefts The left values to look for.
+     @param rights Receives the span of right values for each left value, or an empty span if it is not found. Must be
+     at least as long as lefts.
+     */
+    void findRight(std::span<const LeftType> lefts, std::span<std::span<const RightType>> rights) const noexcept
+    {
+        findEach(m_LeftToRight, lefts, [&](size_t index, auto l2r_it) {
+            if (l2r_it == m_LeftToRight.end())
+                rights[index] = std::span<const RightType>();
+            else
+                rights[index] = std::span<const RightType>(l2r_it->second.data(), l2r_it->second.size());
+        });
+    }
+
+    /**
+     @brief Find the left values of each of a list of right values.
+     The lookups overlap their cache misses, which is faster than finding the values one by one.
+     The spans are invalidated by the next change to the set.
+     @param rights The right values to look for.
+     @param lefts Receives the span of left values for each right value, or an empty span if it is not found. Must be
+     at least as long as rights.
+     */
+    void findLeft(std::span<const RightType> rights, std::span<std::span<const LeftType>> lefts) const noexcept
+    {
+        findEach(m_RightToLeft, rights, [&](size_t index, auto r2l_it) {
+            if (r2l_it == m_RightToLeft.end())
+                lefts[index] = std::span<const LeftType>();
+            else
+                lefts[index] = std::span<const LeftType>(r2l_it->second.data(), r2l_it->second.size());
+        });
+    }
+
+    /**
+     @brief Find the right values paired with this left value that are in the range [low, high).
+     The right values are sorted, so this is a binary search, and no values are copied.
+     @param left The left side of the pairs to look for.
+     @param low The lowest right value to include.
+     @param high The lowest right value to leave out, above low.
+     @return The span of right values in the range. It is invalidated by the next change to the set.
+     */
+    template <typename LeftKey = LeftType>
+    std::span<const RightType> findRightInRange(const LeftKey &left, const RightType &low,
+                                                const RightType &high) const noexcept
+    {
+        auto rights = findRight(left);
+        auto begin_it = std::lower_bound(rights.begin(), rights.end(), low);
+        auto end_it = std::lower_bound(begin_it, rights.end(), high);
+        return std::span<const RightType>(begin_it, end_it);
+    }
+
+    /**
+     @brief Find the right values paired with this left value, starting at the first one that is not less than value.
+     @param left The left side of the pairs to look for.
+     @param value The lowest right value to include.
+     @return The span of right values from value on. It is invalidated by the next change to the set.
+     */
+    template <typename LeftKey = LeftType>
+    std::span<const RightType> lowerBoundRight(const LeftKey &left, const RightType &value) const noexcept
+    {
+        auto rights = findRight(left);
+        return std::span<const RightType>(std::lower_bound(rights.begin(), rights.end(), value), rights.end());
+    }
+
+    /**
+     @brief Count the right values paired with this left value that are in the range [low, high).
+     @param left The left side of the pairs to look for.
+     @param low The lowest right value to count.
+     @param high The lowest right value to leave out, above low.
+     @return The number of right values in the range.
+     */
+    template <typename LeftKey = LeftType>
+    int countRightInRange(const LeftKey &left, const RightType &low, const RightType &high) const noexcept
+    {
+        return (int)findRightInRange(left, low, high).size();
+    }
+
+    /**
+     @brief Find the left values paired with this right value that are in the range [low, high).
+     The left values are sorted, so this is a binary search, and no values are copied.
+     @param right The right side of the pairs to look for.
+     @param low The lowest left value to include.
+     @param high The lowest left value to leave out, above low.
+     @return The span of left values in the range. It is invalidated by the next change to the set.
+     */
+    template <typename RightKey = RightType>
+    std::span<const LeftType> findLeftInRange(const RightKey &right, const LeftType &low,
+                                                const LeftType &high) const noexcept
+    {
+        auto lefts = findLeft(right);
+        auto begin_it = std::lower_bound(lefts.begin(), lefts.end(), low);
+        auto end_it = std::lower_bound(begin_it, lefts.end(), high);
+        return std::span<const LeftType>(begin_it, end_it);
+    }
+
+    /**
+     @brief Find the left values paired with this right value, starting at the first one that is not less than value.
+     @param right The right side of the pairs to look for.
+     @param value The lowest left value to include.
+     @return The span of left values from value on. It is invalidated by the next change to the set.
+     */
+    template <typename RightKey = RightType>
+    std::span<const LeftType> lowerBoundLeft(const RightKey &right, const LeftType &value) const noexcept
+    {
+        auto lefts = findLeft(right);
+        return std::span<const LeftType>(std::lower_bound(lefts.begin(), lefts.end(), value), lefts.end());
+    }
+
+    /**
+     @brief Count the left values paired with this right value that are in the range [low, high).
+     @param right The right side of the pairs to look for.
+     @param low The lowest left value to count.
+     @param high The lowest left value to leave out, above low.
+     @return The number of left values in the range.
+     */
+    template <typename RightKey = RightType>
+    int countLeftInRange(const RightKey &right, const LeftType &low, const LeftType &high) const noexcept
+    {
+        return (int)findLeftInRange(right, low, high).size();
+    }
+
+    /**
+     @brief Count the number of left values in the set.
+     @return The number of left values in the set.
+     */
+    int countLeft() const noexcept
+    {
+        return (int)m_LeftToRight.size();
+    }
+
+    /**
+     @brief Count the number of right values in the set.
+     @return The number of right values in the set.
+     */
+    int countRight() const noexcept
+    {
+        return (int)m_RightToLeft.size();
+    }
+
+    /**
+     @brief Count the number of pairs in the set.
+     @return The number of pairs in the set.
+     */
+    int count() const noexcept
+    {
+        return m_Count;
+    }
+
+    /**
+     @brief List all left elements.
+     @return A helper object to iterate over left elements using range-based-for.
+     */
+    UnorderedMapHelper<LeftToRightMap> allLeft() const noexcept
+    {
+        return UnorderedMapHelper<LeftToRightMap>(&m_LeftToRight);
+    }
+
+    /**
+     @brief List all right elements.
+     @return A helper object to iterate over right elements using range-based-for.
+     */
+    UnorderedMapHelper<RightToLeftMap> allRight() const noexcept
+    {
+        return UnorderedMapHelper<RightToLeftMap>(&m_RightToLeft);
+    }
+
+    /**
+     @brief Make an immutable, compact copy of the set for read-heavy phases.
+     The copy stores all pairs in a few sorted arrays. It has the same query functions, and does not change when this
+     set changes.
+     @return The frozen copy.
+     */
+    FrozenManyToMany<LeftType, RightType> freeze() const noexcept
+    {
+        return FrozenManyToMany<LeftType, RightType>(*this);
+    }
+
+    /**
+     @brief A view of the set with left and right swapped. Nothing is copied.
+     The view has the query functions of a `ManyToMany<RightType, LeftType>`, and sees all later changes to this set.
+     @return The view. It must not outlive the set.
+     */
+    TransposedManyToMany<RightType, LeftType, StoragePolicy> transposed() const noexcept
+    {
+        return TransposedManyToMany<RightType, LeftType, StoragePolicy>(this);
+    }
+
+    /**
+     @brief Turn the set into one with left and right swapped, by moving its two maps into each other's place.
+     This takes constant time. The set is left empty. Use it as `auto reversed = std::move(set).transpose();`.
+     @return The transposed set.
+     */
+    ManyToMany<RightType, LeftType, StoragePolicy> transpose() && noexcept
+    {
+        ManyToMany<RightType, LeftType, StoragePolicy> result;
+        result.m_VectorResource = std::move(m_VectorResource);
+        result.m_LeftToRight = std::move(m_RightToLeft);
+        result.m_RightToLeft = std::move(m_LeftToRight);
+        result.m_Count = m_Count;
+
+        m_LeftToRight.clear();
+        m_RightToLeft.clear();
+        m_Count = 0;
+        return result;
+    }
+
+    /**
+     @brief A range-based-for compatible iterator.
+     */
+    class Iterator
+    {
+        /// @cond
+      public:
+        typename LeftToRightMap::const_iterator l2r_it;
+        typename LeftToRightMap::const_iterator l2r_it_end;
+        typename RightVector::const_iterator l2r_vec_it;
+
+        inline Pair operator*() const noexcept
+        {
+            auto left = l2r_it->first;
+            auto right = *l2r_vec_it;
+            return Pair(left, right);
+        }
+
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return l2r_it == other.l2r_it;
+        }
+
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return l2r_it != other.l2r_it;
+        }
+
+        inline Iterator operator++() noexcept
+        {
+            l2r_vec_it++;
+            if (l2r_vec_it == l2r_it->second.cend())
+            {
+                l2r_it++;
+                if (l2r_it != l2r_it_end)
+                {
+                    l2r_vec_it = l2r_it->second.cbegin();
+                }
+            }
+            return *this;
+        }
+        /// @endcond
+    };
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to the first pair in the set.
+     */
+    Iterator begin() const noexcept
+    {
+        Iterator it;
+        it.l2r_it = m_LeftToRight.cbegin();
+        it.l2r_it_end = m_LeftToRight.cend();
+        if (it.l2r_it != it.l2r_it_end)
+        {
+            it.l2r_vec_it = it.l2r_it->second.cbegin();
+        }
+        return it;
+    }
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to one after the last pair in the set.
+     */
+    Iterator end() const noexcept
+    {
+        Iterator it;
+        it.l2r_it = m_LeftToRight.cend();
+        return it;
+    }
+
+    /**
+     @brief Call a function for every pair in the set, on several threads.
+     The pairs are divided among the threads in chunks of about the same number of pairs, so a left value with many
+     right values does not hold up the others. The function is called from several threads at once, and must not
+     change the set.
+     @param function The function to call, as function(left, right).
+     @param threadCount The number of threads to use, including the calling thread. Zero means one per hardware thread.
+     */
+    template <typename Function> void forEachParallel(Function function, int threadCount = 0) const noexcept
+    {
+        auto rights_of = [](const auto &rights) { return std::span<const RightType>(rights.data(), rights.size()); };
+        forEachPairParallel<RightType>(m_LeftToRight, rights_of, threadCount, function);
+    }
+
+private:
+    typename RightVector::allocator_type rightAllocator() noexcept
+    {
+        return typename RightVector::allocator_type(m_VectorResource.get());
+    }
+
+    typename LeftVector::allocator_type leftAllocator() noexcept
+    {
+        return typename LeftVector::allocator_type(m_VectorResource.get());
+    }
+
+    // Merge pairs sorted by left value, then by right value, into m_LeftToRight, one left value at a time
+    void insertIntoLeftToRight(const std::vector<Pair> &pairs) noexcept
+    {
+        std::vector<RightType> right_to_insert;
+        auto it_end = pairs.cend();
+        for (auto it = pairs.cbegin(); it != it_end; )
+        {
+            // Collect all right values that have the same left value
+            right_to_insert.clear();
+            auto left = it->left;
+            while(it != it_end && it->left == left)
+            {
+                right_to_insert.push_back(it->right);
+                it++;
+            }
+
+            // Insert them in one go
+            auto l2r_vec = &m_LeftToRight.try_emplace(left, rightAllocator()).first->second;
+            m_Count += mergeIntoSortedVector(l2r_vec, &right_to_insert);
+        }
+    }
+
+    // Merge pairs sorted by right value, then by left value, into m_RightToLeft, one right value at a time
+    void insertIntoRightToLeft(const std::vector<Pair> &pairs) noexcept
+    {
+        std::vector<LeftType> left_to_insert;
+        auto it_end = pairs.cend();
+        for (auto it = pairs.cbegin(); it != it_end; )
+        {
+            // Collect all left values that have the same right value
+            left_to_insert.clear();
+            auto right = it->right;
+            while(it != it_end && it->right == right)
+            {
+                left_to_insert.push_back(it->left);
+                it++;
+            }
+
+            // Insert them in one go
+            auto r2l_vec = &m_RightToLeft.try_emplace(right, leftAllocator()).first->second;
+            mergeIntoSortedVector(r2l_vec, &left_to_insert);
+        }
+    }
+
+    // Build both maps of an empty set from scratch
+    void load(std::vector<Pair> pairs) noexcept
+    {
+        sortLeftThenRight(&pairs);
+        pairs.erase(std::unique(pairs.begin(), pairs.end(),
+                                [](const Pair &a, const Pair &b) { return a.left == b.left && a.right == b.right; }),
+                    pairs.end());
+        m_Count = static_cast<int>(pairs.size());
+
+        std::vector<Pair> pairs_by_right = pairs;
+        sortRightThenLeft(&pairs_by_right);
+
+        // Count the keys on both sides, and the bytes of their vectors
+        size_t left_count = 0;
+        size_t right_count = 0;
+        size_t block_size = 0;
+        for (auto it = pairs.cbegin(); it != pairs.cend(); left_count++)
+        {
+            auto run_it = it;
+            while(it != pairs.cend() && it->left == run_it->left)
+                it++;
+            block_size += BlockResource::roundUp((it - run_it) * sizeof(RightType));
+        }
+        for (auto it = pairs_by_right.cbegin(); it != pairs_by_right.cend(); right_count++)
+        {
+            auto run_it = it;
+            while(it != pairs_by_right.cend() && it->right == run_it->right)
+                it++;
+            block_size += BlockResource::roundUp((it - run_it) * sizeof(LeftType));
+        }
+        m_VectorResource.reserveBlock(block_size);
+        reserveForKeys(&m_LeftToRight, pairs, [](const Pair &pair) { return pair.left; }, left_count);
+        reserveForKeys(&m_RightToLeft, pairs_by_right, [](const Pair &pair) { return pair.right; }, right_count);
+
+        std::vector<RightType> right_to_insert;
+        for (auto it = pairs.cbegin(); it != pairs.cend(); )
+        {
+            right_to_insert.clear();
+            auto left = it->left;
+            while(it != pairs.cend() && it->left == left)
+            {
+                right_to_insert.push_back(it->right);
+                it++;
+            }
+            m_LeftToRight.try_emplace(left, right_to_insert.cbegin(), right_to_insert.cend(), rightAllocator());
+        }
+
+        std::vector<LeftType> left_to_insert;
+        for (auto it = pairs_by_right.cbegin(); it != pairs_by_right.cend(); )
+        {
+            left_to_insert.clear();
+            auto right = it->right;
+            while(it != pairs_by_right.cend() && it->right == right)
+            {
+                left_to_insert.push_back(it->left);
+                it++;
+            }
+            m_RightToLeft.try_emplace(right, left_to_insert.cbegin(), left_to_insert.cend(), leftAllocator());
+        }
+    }
+
+    // Remove pairs sorted by left value, then by right value, from m_LeftToRight, one left value at a time. Returns
+    // the number of pairs removed.
+    int eraseFromLeftToRight(const std::vector<Pair> &pairs) noexcept
+    {
+        int erase_count = 0;
+        std::vector<RightType> right_to_erase;
+        auto it_end = pairs.cend();
+        for (auto it = pairs.cbegin(); it != it_end; )
+        {
+            // Collect all right values that have the same left value
+            right_to_erase.clear();
+            auto left = it->left;
+            while(it != it_end && it->left == left)
+            {
+                right_to_erase.push_back(it->right);
+                it++;
+            }
+
+            // Erase them in one go
+            auto l2r_it = m_LeftToRight.find(left);
+            if (l2r_it != m_LeftToRight.end())
+            {
+                auto l2r_vec = &l2r_it->second;
+                erase_count += removeFromSortedVector(l2r_vec, &right_to_erase);
+                if (0 == l2r_vec->size())
+                {
+                    m_LeftToRight.erase(l2r_it);
+                }
+            }
+        }
+        return erase_count;
+    }
+
+    // Remove pairs sorted by right value, then by left value, from m_RightToLeft, one right value at a time
+    void eraseFromRightToLeft(const std::vector<Pair> &pairs) noexcept
+    {
+        std::vector<LeftType> left_to_erase;
+        auto it_end = pairs.cend();
+        for (auto it = pairs.cbegin(); it != it_end; )
+        {
+            // Collect all left values that have the same right value
+            left_to_erase.clear();
+            auto right = it->right;
+            while(it != it_end && it->right == right)
+            {
+                left_to_erase.push_back(it->left);
+                it++;
+            }
+
+            // Erase them in one go
+            auto r2l_it = m_RightToLeft.find(right);
+            if (r2l_it != m_RightToLeft.end())
+            {
+                auto r2l_vec = &r2l_it->second;
+                removeFromSortedVector(r2l_vec, &left_to_erase);
+                if (0 == r2l_vec->size())
+                {
+                    m_RightToLeft.erase(r2l_it);
+                }
+            }
+        }
+    }
+
+    void copyMaps(const ManyToMany &other) noexcept
+    {
+        m_LeftToRight.reserve(other.m_LeftToRight.size());
+        for (auto &l2r : other.m_LeftToRight)
+        {
+            m_LeftToRight.try_emplace(l2r.first, l2r.second, rightAllocator());
+        }
+
+        m_RightToLeft.reserve(other.m_RightToLeft.size());
+        for (auto &r2l : other.m_RightToLeft)
+        {
+            m_RightToLeft.try_emplace(r2l.first, r2l.second, leftAllocator());
+        }
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A view of a `ManyToMany<RightType, LeftType>` with left and right swapped. Get one with `ManyToMany::transposed()`.
+ It copies nothing: each query is answered by the other index of the underlying set.
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy> class TransposedManyToMany
+{
+    using Relation = ManyToMany<RightType, LeftType, StoragePolicy>;
+
+    const Relation *m_Relation;
+
+public:
+    /**
+    @brief A pair of (left, right) values.
+     */
+    struct Pair
+    {
+        LeftType left;
+        RightType right;
+        Pair(LeftType left, RightType right) : left(left), right(right)
+        {
+        }
+        Pair()
+        {
+        }
+    };
+
+    /**
+     @brief Construct a view of a set.
+     @param relation The set. It must outlive the view.
+     */
+    explicit TransposedManyToMany(const Relation *relation) noexcept
+    : m_Relation(relation)
+    {}
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param pair The pair to look for.
+     */
+    bool contains(const Pair &pair) const noexcept
+    {
+        return m_Relation->contains(pair.right, pair.left);
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType, typename RightKey = RightType>
+    bool contains(const LeftKey &left, const RightKey &right) const noexcept
+    {
+        return m_Relation->contains(right, left);
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType> bool containsLeft(const LeftKey &left) const noexcept
+    {
+        return m_Relation->containsRight(left);
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    template <typename RightKey = RightType> bool containsRight(const RightKey &right) const noexcept
+    {
+        return m_Relation->containsLeft(right);
+    }
+
+    /**
+     @brief Find all right values that are paired with this left value. The right values are sorted.
+     @param left The left side of the pair to look for.
+     @return The span of right values. It is invalidated by the next change to the set.
+     */
+    template <typename LeftKey = LeftType> std::span<const RightType> findRight(const LeftKey &left) const noexcept
+    {
+        return m_Relation->findLeft(left);
+    }
+
+    /**
+     @brief Find all left values that are paired with this right value. The left values are sorted.
+     @param right The right side of the pair to look for.
+     @return The span of left values. It is invalidated by the next change to the set.
+     */
+    template <typename RightKey = RightType> std::span<const LeftType> findLeft(const RightKey &right) const noexcept
+    {
+        return m_Relation->findRight(right);
+    }
+
+    /**
+     @brief Count the number of left values in the set.
+     */
+    int countLeft() const noexcept
+    {
+        return m_Relation->countRight();
+    }
+
+    /**
+     @brief Count the number of right values in the set.
+     */
+    int countRight() const noexcept
+    {
+        return m_Relation->countLeft();
+    }
+
+    /**
+     @brief Count the number of pairs in the set.
+     */
+    int count() const noexcept
+    {
+        return m_Relation->count();
+    }
+
+    /**
+     @brief List all left elements.
+     @return A helper object to iterate over left elements using range-based-for.
+     */
+    auto allLeft() const noexcept
+    {
+        return m_Relation->allRight();
+    }
+
+    /**
+     @brief List all right elements.
+     @return A helper object to iterate over right elements using range-based-for.
+     */
+    auto allRight() const noexcept
+    {
+        return m_Relation->allLeft();
+    }
+
+    /**
+     @brief A range-based-for compatible iterator.
+     */
+    class Iterator
+    {
+        /// @cond
+      public:
+        typename Relation::Iterator it;
+
+        inline Pair operator*() const noexcept
+        {
+            auto pair = *it;
+            return Pair(pair.right, pair.left);
+        }
+
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return it == other.it;
+        }
+
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return it != other.it;
+        }
+
+        inline Iterator operator++() noexcept
+        {
+            ++it;
+            return *this;
+        }
+        /// @endcond
+    };
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to the first pair in the set.
+     */
+    Iterator begin() const noexcept
+    {
+        Iterator it;
+        it.it = m_Relation->begin();
+        return it;
+    }
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to one after the last pair in the set.
+     */
+    Iterator end() const noexcept
+    {
+        Iterator it;
+        it.it = m_Relation->end();
+        return it;
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A one-to-one set of (left, right) pairs. Any left or right value can only be paired with one counterpart.
+ @image html binary-relations-one-to-one.png "one-to-one"
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy = StdStoragePolicy> class OneToOne
+{
+    using LeftToRightMap = typename StoragePolicy::template Map<LeftType, RightType>;
+    using RightToLeftMap = typename StoragePolicy::template Map<RightType, LeftType>;
+
+    LeftToRightMap m_LeftToRight;
+    RightToLeftMap m_RightToLeft;
+
+public:
+    /**
+    @brief A pair of (left, right) values.
+     */
+    struct Pair
+    {
+        LeftType left;
+        RightType right;
+        Pair(LeftType left, RightType right)
+        : left(left), right(right)
+        {}
+        Pair()
+        {}
+    };
+
+    /**
+     @brief Default constructor.
+     */
+    OneToOne() noexcept
+    {}
+
+    /**
+     @brief Insert a pair into the set.
+     The rule for one-to-one is that if the rleft value or the ight value are part of an existing pairs in the set, those relations will be erased.
+     @param pair The pair to insert.
+     */
+    void insert(const Pair &pair) noexcept
+    {
+        insert(pair.left, pair.right);
+    }
+
+    /**
+     @brief Insert a pair into the set.
+     The rule for one-to-one is that if the left value or the right value are part of existing pairs in the set, those relations will be erased.
+     @param left The left side of the pair to add.
+     @param right The right side of the pair to add.
+     */
+    void insert(const LeftType &left, const RightType &right) noexcept
+    {
+        insertPair(left, right);
+    }
+
+    /**
+     @brief Insert multiple  pairs into the set.
+     The rule for one-to-one is that if the left value or the right value are part of existing pairs in the set, those relations will be erased.
+     The result is the same as inserting the pairs one by one, so if the pairs conflict with each other, the last one
+     wins. The conflicts are resolved first, so a pair that a later pair would replace is never inserted.
+     @param pairs The pairs to add.
+     */
+    void insert(const std::vector<Pair> &pairs) noexcept
+    {
+        if (pairs.empty())
+            return;
+
+        // A pair is in the result if no later pair in the batch has its left or right value
+        std::vector<bool> is_winner(pairs.size());
+        bool has_conflicts = false;
+        {
+            typename StoragePolicy::template Map<LeftType, bool> later_left;
+            typename StoragePolicy::template Map<RightType, bool> later_right;
+            reserveForKeys(&later_left, pairs, [](const Pair &pair) { return pair.left; });
+            reserveForKeys(&later_right, pairs, [](const Pair &pair) { return pair.right; });
+            for (size_t index = pairs.size(); index-- > 0;)
+            {
+                bool is_last_left = later_left.try_emplace(pairs[index].left, true).second;
+                bool is_last_right = later_right.try_emplace(pairs[index].right, true).second;
+                is_winner[index] = is_last_left && is_last_right;
+                has_conflicts |= !is_winner[index];
+            }
+        }
+
+        // A pair that loses still takes its values away from the pairs in the set, as it would one by one
+        if (has_conflicts)
+        {
+            for (size_t index = 0; index < pairs.size(); ++index)
+            {
+                if (!is_winner[index])
+                {
+                    eraseLeft(pairs[index].left);
+                    eraseRight(pairs[index].right);
+                }
+            }
+        }
+
+        reserveForKeys(&m_LeftToRight, pairs, [](const Pair &pair) { return pair.left; });
+        reserveForKeys(&m_RightToLeft, pairs, [](const Pair &pair) { return pair.right; });
+        for (size_t index = 0; index < pairs.size(); ++index)
+        {
+            if (is_winner[index])
+                insertPair(pairs[index].left, pairs[index].right);
+        }
+    }
+
+    /**
+     @brief Erase a pair from the set.
+     If there is no matching pair in the set, nothing happens.
+     @param pair The pair to erase.
+     */
+    void erase(const Pair &pair) noexcept
+    {
+        erase(pair.left, pair.right);
+    }
+
+    /**
+     @brief Erase a pair from the set.
+     If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair to erase.
+     @param right The right side of the pair to erase.
+     */
+    void erase(const LeftType &left, const RightType &right) noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it != m_LeftToRight.end() && l2r_it->second == right)
+        {
+            m_LeftToRight.erase(l2r_it);
+            m_RightToLeft.erase(right);
+        }
+    }
+
+    /**
+     @brief Erase all pairs with the given left value.
+     If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pairs to erase.
+     */
+    void eraseLeft(const LeftType &left) noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it != m_LeftToRight.end())
+        {
+            auto right = l2r_it->second;
+            auto r2l_it = m_RightToLeft.find(right);
+            m_RightToLeft.erase(r2l_it);
+            m_LeftToRight.erase(l2r_it);
+        }
+    }
+
+    /**
+     @brief Erase the pair with the given right value.
+     If there is no matching pair in the set, nothing happens.
+     @param right The right side of the pairs to erase.
+     */
+    void eraseRight(const RightType &right) noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        if (r2l_it != m_RightToLeft.end())
+        {
+            auto left = r2l_it->second;
+            auto l2r_it = m_LeftToRight.find(left);
+            m_LeftToRight.erase(l2r_it);
+            m_RightToLeft.erase(r2l_it);
+        }
+    }
+
+    /**
+     @brief Erase multiple  pairs from the set.
+     Each pair costs one lookup per side. The order of the pairs does not matter.
+     @param pairs The pairs to erase.
+     */
+    void erase(const std::vector<Pair> &pairs) noexcept
+    {
+        for (auto &pair : pairs)
+        {
+            auto l2r_it = m_LeftToRight.find(pair.left);
+            if (l2r_it == m_LeftToRight.end() || !(l2r_it->second == pair.right))
+                continue;
+            m_LeftToRight.erase(l2r_it);
+            m_RightToLeft.erase(m_RightToLeft.find(pair.right));
+        }
+    }
+
+    /**
+     @brief Insert all pairs of another set. Same as unionWith().
+     @param other The set to insert.
+     */
+    void insert(const OneToOne &other) noexcept
+    {
+        unionWith(other);
+    }
+
+    /**
+     @brief Erase all pairs that are in another set. Same as differenceWith().
+     @param other The set to erase.
+     */
+    void erase(const OneToOne &other) noexcept
+    {
+        differenceWith(other);
+    }
+
+    /**
+     @brief Add all pairs of another set to this one.
+     If a value is paired differently in the other set, the pair from the other set wins, as with insert.
+     This takes time in proportion to the size of the other set.
+     @param other The set to add.
+     */
+    void unionWith(const OneToOne &other) noexcept
+    {
+        if (this == &other)
+            return;
+
+        reserveForKeys(&m_LeftToRight, other.m_LeftToRight, [](const auto &l2r) { return l2r.first; });
+        reserveForKeys(&m_RightToLeft, other.m_RightToLeft, [](const auto &r2l) { return r2l.first; });
+        for (auto &l2r : other.m_LeftToRight)
+        {
+            insertPair(l2r.first, l2r.second);
+        }
+    }
+
+    /**
+     @brief Keep only the pairs that are also in another set.
+     This takes time in proportion to the size of this set.
+     @param other The set to intersect with.
+     */
+    void intersectWith(const OneToOne &other) noexcept
+    {
+        if (this == &other)
+            return;
+
+        std::vector<LeftType> left_to_erase;
+        for (auto &l2r : m_LeftToRight)
+        {
+            if (!other.contains(l2r.first, l2r.second))
+                left_to_erase.push_back(l2r.first);
+        }
+        for (auto &left : left_to_erase)
+        {
+            eraseLeft(left);
+        }
+    }
+
+    /**
+     @brief Erase all pairs that are in another set.
+     This takes time in proportion to the size of the other set.
+     @param other The set to subtract.
+     */
+    void differenceWith(const OneToOne &other) noexcept
+    {
+        if (this == &other)
+        {
+            clear();
+            return;
+        }
+
+        for (auto &l2r : other.m_LeftToRight)
+        {
+            erase(l2r.first, l2r.second);
+        }
+    }
+
+    /**
+     @brief Erase all pairs from the set.
+     */
+    void clear() noexcept
+    {
+        m_RightToLeft.clear();
+        m_LeftToRight.clear();
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param pair The pair to look for.
+     */
+    bool contains(const Pair &pair) const noexcept
+    {
+        return contains(pair.left, pair.right);
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType, typename RightKey = RightType>
+    bool contains(const LeftKey &left, const RightKey &right) const noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        return l2r_it != m_LeftToRight.end() && l2r_it->second == right;
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType> bool containsLeft(const LeftKey &left) const noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        return l2r_it != m_LeftToRight.end();
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    template <typename RightKey = RightType> bool containsRight(const RightKey &right) const noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        return r2l_it != m_RightToLeft.end();
+    }
+
+    /**
+     @brief Find the single right value that is paired with this left value.
+     If nothing is found, you will get the notFoundValue.
+     @param left The left side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The singular right value.
+     */
+    template <typename LeftKey = LeftType>
+    RightType findRight(const LeftKey &left, const RightType &notFoundValue) const noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        return l2r_it != m_LeftToRight.end() ? l2r_it->second : notFoundValue;
+    }
+
+    /**
+     @brief Find the single left value that is paired with this right value.
+     If nothing is found, you will get the notFoundValue.
+     @param right The right side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The singular left value.
+     */
+    template <typename RightKey = RightType>
+    LeftType findLeft(const RightKey &right, const LeftType &notFoundValue) const noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        return r2l_it != m_RightToLeft.end() ? r2l_it->second : notFoundValue;
+    }
+
+    /**
+     @brief Test for each of a list of left values whether any pair in the set has it.
+     The lookups overlap their cache misses, which is faster than testing the values one by one.
+     @param lefts The left values to look for.
+     @param found Receives the result for each left value. Must be at least as long as lefts.
+     */
+    void containsLeft(std::span<const LeftType> lefts, std::span<bool> found) const noexcept
+    {
+        findEach(m_LeftToRight, lefts,
+                 [&](size_t index, auto l2r_it) { found[index] = l2r_it != m_LeftToRight.end(); });
+    }
+
+    /**
+     @brief Test for each of a list of right values whether any pair in the set has it.
+     The lookups overlap their cache misses, which is faster than testing the values one by one.
+     @param rights The right values to look for.
+     @param found Receives the result for each right value. Must be at least as long as rights.
+     */
+    void containsRight(std::span<const RightType> rights, std::span<bool> found) const noexcept
+    {
+        findEach(m_RightToLeft, rights,
+                 [&](size_t index, auto r2l_it) { found[index] = r2l_it != m_RightToLeft.end(); });
+    }
+
+    /**
+     @brief Find the single right value of each of a list of left values.
+     The lookups overlap their cache misses, which is faster than finding the values one by one.
+     @param lefts The left values to look for.
+     @param rights Receives the right value for each left value, or notFoundValue. Must be at least as long as lefts.
+     @param notFoundValue The value to write if no matching pair is found.
+     */
+    void findRight(std::span<const LeftType> lefts, std::span<RightType> rights,
+                  const RightType &notFoundValue) const noexcept
+    {
+        findEach(m_LeftToRight, lefts, [&](size_t index, auto l2r_it) {
+            rights[index] = l2r_it == m_LeftToRight.end() ? notFoundValue : l2r_it->second;
+        });
+    }
+
+    /**
+     @brief Find the single left value of each of a list of right values.
+     The lookups overlap their cache misses, which is faster than finding the values one by one.
+     @param rights The right values to look for.
+     @param lefts Receives the left value for each right value, or notFoundValue. Must be at least as long as rights.
+     @param notFoundValue The value to write if no matching pair is found.
+     */
+    void findLeft(std::span<const RightType> rights, std::span<LeftType> lefts,
+                  const LeftType &notFoundValue) const noexcept
+    {
+        findEach(m_RightToLeft, rights, [&](size_t index, auto r2l_it) {
+            lefts[index] = r2l_it == m_RightToLeft.end() ? notFoundValue : r2l_it->second;
+        });
+    }
+
+    /**
+     @brief Count the number of left values in the set.
+     @return The number of left values in the set.
+     */
+    int countLeft() const noexcept
+    {
+        return (int)m_LeftToRight.size();
+    }
+
+    /**
+     @brief Count the number of right values in the set.
+     @return The number of right values in the set.
+     */
+    int countRight() const noexcept
+    {
+        return (int)m_RightToLeft.size();
+    }
+
+    /**
+     @brief Count the number of pairs in the set.
+     @return The number of pairs in the set.
+     */
+    int count() const noexcept
+    {
+        return (int)m_LeftToRight.size();
+    }
+
+    /**
+     @brief List all left elements.
+     @return A helper object to iterate over left elements using range-based-for.
+     */
+    UnorderedMapHelper<LeftToRightMap> allLeft() const noexcept
+    {
+        return UnorderedMapHelper<LeftToRightMap>(&m_LeftToRight);
+    }
+
+    /**
+     @brief List all right elements.
+     @return A helper object to iterate over right elements using range-based-for.
+     */
+    UnorderedMapHelper<RightToLeftMap> allRight() const noexcept
+    {
+        return UnorderedMapHelper<RightToLeftMap>(&m_RightToLeft);
+    }
+
+    /**
+     @brief A range-based-for compatible iterator.
+     */
+    class Iterator
+    {
+        /// @cond
+      public:
+        typename LeftToRightMap::const_iterator l2r_it;
+
+        inline Pair operator*() const noexcept
+        {
+            return Pair(l2r_it->first, l2r_it->second);
+        }
+
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return l2r_it == other.l2r_it;
+        }
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return l2r_it != other.l2r_it;
+        }
+        inline Iterator operator++() noexcept
+        {
+            l2r_it++;
+            return *this;
+        }
+        /// @endcond
+    };
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to the first pair in the set.
+     */
+    Iterator begin() const noexcept
+    {
+        Iterator it;
+        it.l2r_it = m_LeftToRight.cbegin();
+        return it;
+    }
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to one after the last pair in the set.
+     */
+    Iterator end() const noexcept
+    {
+        Iterator it;
+        it.l2r_it = m_LeftToRight.cend();
+        return it;
+    }
+
+    /**
+     @brief Call a function for every pair in the set, on several threads.
+     The pairs are divided among the threads in chunks of the same size. The function is called from several threads at
+     once, and must not change the set.
+     @param function The function to call, as function(left, right).
+     @param threadCount The number of threads to use, including the calling thread. Zero means one per hardware thread.
+     */
+    template <typename Function> void forEachParallel(Function function, int threadCount = 0) const noexcept
+    {
+        auto rights_of = [](const RightType &right) { return std::span<const RightType>(&right, 1); };
+        forEachPairParallel<RightType>(m_LeftToRight, rights_of, threadCount, function);
+    }
+
+private:
+    // One probe per side. Only when the pair replaces existing pairs is there one more probe per replaced pair.
+    void insertPair(const LeftType &left, const RightType &right) noexcept
+    {
+        auto l2r_result = m_LeftToRight.try_emplace(left, right);
+        if (!l2r_result.second)
+        {
+            RightType old_right = l2r_result.first->second;
+            if (old_right == right)
+                return; // Already there
+            l2r_result.first->second = right;
+            m_RightToLeft.erase(old_right);
+        }
+
+        auto r2l_result = m_RightToLeft.try_emplace(right, left);
+        if (!r2l_result.second)
+        {
+            LeftType old_left = r2l_result.first->second;
+            r2l_result.first->second = left;
+            m_LeftToRight.erase(old_left);
+        }
+    }
+};
+// ----------------------------------------------------------------------------
+
+/// @cond
+template <typename RelationType>
+concept SetAlgebra = requires(RelationType &a, const RelationType &b) {
+    a.unionWith(b);
+    a.intersectWith(b);
+    a.differenceWith(b);
+};
+/// @endcond
+
+/**
+ @brief The union of two sets, as a new set. Pairs of b win conflicts with pairs of a, as with `unionWith()`.
+ @param a The first set.
+ @param b The second set.
+ @return A set with the pairs of both.
+ */
+template <SetAlgebra RelationType> RelationType unionOf(const RelationType &a, const RelationType &b) noexcept
+{
+    RelationType result = a;
+    result.unionWith(b);
+    return result;
+}
+
+/**
+ @brief The intersection of two sets, as a new set. Takes time in proportion to the size of the smaller set.
+ @param a The first set.
+ @param b The second set.
+ @return A set with the pairs that are in both.
+ */
+template <SetAlgebra RelationType> RelationType intersectionOf(const RelationType &a, const RelationType &b) noexcept
+{
+    bool a_is_smaller = a.count() <= b.count();
+    RelationType result = a_is_smaller ? a : b;
+    result.intersectWith(a_is_smaller ? b : a);
+    return result;
+}
+
+/**
+ @brief The difference of two sets, as a new set.
+ @param a The set to subtract from.
+ @param b The set to subtract.
+ @return A set with the pairs of a that are not in b.
+ */
+template <SetAlgebra RelationType> RelationType differenceOf(const RelationType &a, const RelationType &b) noexcept
+{
+    RelationType result = a;
+    result.differenceWith(b);
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+
+/// @cond
+// The kind of a relation: 1 for OneToOne, 2 for OneToMany, 3 for ManyToMany, and 0 for anything else
+template <typename RelationType> struct RelationTraits
+{
+    static constexpr int kKind = 0;
+};
+
+template <typename Left, typename Right, typename Policy> struct RelationTraits<OneToOne<Left, Right, Policy>>
+{
+    static constexpr int kKind = 1;
+    using LeftType = Left;
+    using RightType = Right;
+    using StoragePolicy = Policy;
+};
+
+template <typename Left, typename Right, typename Policy> struct RelationTraits<OneToMany<Left, Right, Policy>>
+{
+    static constexpr int kKind = 2;
+    using LeftType = Left;
+    using RightType = Right;
+    using StoragePolicy = Policy;
+};
+
+template <typename Left, typename Right, typename Policy> struct RelationTraits<ManyToMany<Left, Right, Policy>>
+{
+    static constexpr int kKind = 3;
+    using LeftType = Left;
+    using RightType = Right;
+    using StoragePolicy = Policy;
+};
+
+template <int kKind, typename LeftType, typename RightType, typename StoragePolicy>
+using RelationOfKind = std::conditional_t<kKind == 1, OneToOne<LeftType, RightType, StoragePolicy>,
+                                          std::conditional_t<kKind == 2, OneToMany<LeftType, RightType, StoragePolicy>,
+                                                             ManyToMany<LeftType, RightType, StoragePolicy>>>;
+
+// Call function with each right value of a left value, whether the relation has one or many of them
+template <typename RelationType, typename KeyType, typename Function>
+void forEachRightOf(const RelationType &relation, const KeyType &left, Function function) noexcept
+{
+    if constexpr (RelationTraits<RelationType>::kKind == 1)
+    {
+        if (relation.containsLeft(left))
+            function(relation.findRight(left, typename RelationTraits<RelationType>::RightType()));
+    }
+    else
+    {
+        for (auto &right : relation.findRight(left))
+            function(right);
+    }
+}
+
+// Call function with each left value of a right value, whether the relation has one or many of them
+template <typename RelationType, typename KeyType, typename Function>
+void forEachLeftOf(const RelationType &relation, const KeyType &right, Function function) noexcept
+{
+    if constexpr (RelationTraits<RelationType>::kKind == 3)
+    {
+        for (auto &left : relation.findLeft(right))
+            function(left);
+    }
+    else
+    {
+        if (relation.containsRight(right))
+            function(relation.findLeft(right, typename RelationTraits<RelationType>::LeftType()));
+    }
+}
+/// @endcond
+
+/**
+ @brief The composition of two relations: a set with the pair (a, c) for each a that is paired with some b in the first
+ relation, where that b is paired with c in the second.
+ The result is a OneToOne if both relations are, a OneToMany if neither is a ManyToMany, and a ManyToMany otherwise. It
+ uses the storage policy of the first relation. The relation with fewer pairs is iterated, and each of its middle values
+ is looked up in the other, so this takes time in proportion to the size of the smaller relation, plus the result.
+ @param first The relation from left to middle values.
+ @param second The relation from middle to right values.
+ @return The composed relation.
+ */
+template <typename FirstRelation, typename SecondRelation>
+    requires(RelationTraits<FirstRelation>::kKind != 0 && RelationTraits<SecondRelation>::kKind != 0)
+auto compose(const FirstRelation &first, const SecondRelation &second) noexcept
+{
+    using FirstTraits = RelationTraits<FirstRelation>;
+    using SecondTraits = RelationTraits<SecondRelation>;
+    static_assert(std::is_same_v<typename FirstTraits::RightType, typename SecondTraits::LeftType>,
+                  "The right type of the first relation must be the left type of the second");
+
+    constexpr int kKind = std::max(FirstTraits::kKind, SecondTraits::kKind);
+    using ResultType = RelationOfKind<kKind, typename FirstTraits::LeftType, typename SecondTraits::RightType,
+                                      typename FirstTraits::StoragePolicy>;
+    using Pair = typename ResultType::Pair;
+
+    std::vector<Pair> pairs;
+    if (first.count() <= second.count())
+    {
+        for (auto pair : first)
+            forEachRightOf(second, pair.right, [&](const auto &right) { pairs.push_back(Pair(pair.left, right)); });
+    }
+    else
+    {
+        for (auto pair : second)
+            forEachLeftOf(first, pair.left, [&](const auto &left) { pairs.push_back(Pair(left, pair.right)); });
+    }
+
+    if constexpr (kKind == 1)
+    {
+        ResultType result;
+        result.insert(pairs);
+        return result;
+    }
+    else
+    {
+        return ResultType(pairs.begin(), pairs.end());
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+/// @cond
+// How InternedRelation stores a key type, and how it hands it out: std::string as a StringId and a view of the pool,
+// other types as they are
+template <typename KeyType> struct InternedKeyTraits
+{
+    static constexpr bool kIsString = std::is_same_v<KeyType, std::string>;
+    using StoredType = std::conditional_t<kIsString, StringId, KeyType>;
+    using PublicType = std::conditional_t<kIsString, std::string_view, KeyType>;
+    using ArgumentType = std::conditional_t<kIsString, std::string_view, const KeyType &>;
+};
+/// @endcond
+
+/**
+ The string values of a key, as found in an `InternedRelation`. It works like a `std::span<const std::string_view>`, but
+ translates the IDs that the relation stores as you read them.
+ */
+class StringIdSpan
+{
+    std::span<const StringId> m_Ids;
+    const StringPool *m_Pool = nullptr;
+
+public:
+    /// @cond
+    StringIdSpan() noexcept
+    {}
+
+    StringIdSpan(std::span<const StringId> ids, const StringPool *pool) noexcept
+    : m_Ids(ids), m_Pool(pool)
+    {}
+
+    class Iterator
+    {
+    public:
+        const StringId *it;
+        const StringPool *pool;
+
+        inline std::string_view operator*() const noexcept
+        {
+            return pool->str(*it);
+        }
+
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return it == other.it;
+        }
+
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return it != other.it;
+        }
+
+        inline Iterator operator++() noexcept
+        {
+            it++;
+            return *this;
+        }
+    };
+    /// @endcond
+
+    /// Required member to get range-based-for.
+    Iterator begin() const noexcept
+    {
+        return Iterator{m_Ids.data(), m_Pool};
+    }
+
+    /// Required member to get range-based-for.
+    Iterator end() const noexcept
+    {
+        return Iterator{m_Ids.data() + m_Ids.size(), m_Pool};
+    }
+
+    /// The string at a position.
+    std::string_view operator[](size_t index) const noexcept
+    {
+        return m_Pool->str(m_Ids[index]);
+    }
+
+    /// The number of strings.
+    size_t size() const noexcept
+    {
+        return m_Ids.size();
+    }
+
+    /// Test whether there are no strings.
+    bool empty() const noexcept
+    {
+        return m_Ids.empty();
+    }
+
+    /// The IDs, as the relation stores them.
+    std::span<const StringId> ids() const noexcept
+    {
+        return m_Ids;
+    }
+};
+
+/**
+ A `OneToOne`, `OneToMany` or `ManyToMany` with `std::string` keys, that stores each string once in a `StringPool` and
+ uses its 32-bit `StringId` everywhere inside the relation. Hashing, sorting and the sorted arrays of values then work on
+ integers. Strings are translated to IDs on the way in, and back on the way out, as `std::string_view`s into the pool.
+ For example, `InternedRelation<ManyToMany<int, std::string>>` has the API of a `ManyToMany<int, std::string>`.
+ Sides that are not `std::string` are stored as they are.
+ The values that `findRight()` and `findLeft()` return are sorted by ID, which is the order in which the strings were
+ first interned, not alphabetical order.
+ */
+template <typename RelationType> class InternedRelation
+{
+    using Traits = RelationTraits<RelationType>;
+    static_assert(Traits::kKind != 0, "InternedRelation needs a OneToOne, OneToMany or ManyToMany");
+    static constexpr int kKind = Traits::kKind;
+
+    using LeftTraits = InternedKeyTraits<typename Traits::LeftType>;
+    using RightTraits = InternedKeyTraits<typename Traits::RightType>;
+    using StoredLeft = typename LeftTraits::StoredType;
+    using StoredRight = typename RightTraits::StoredType;
+    using LeftArgument = typename LeftTraits::ArgumentType;
+    using RightArgument = typename RightTraits::ArgumentType;
+
+public:
+    /// The type of the left values that queries return: `std::string_view` for strings.
+    using LeftType = typename LeftTraits::PublicType;
+    /// The type of the right values that queries return: `std::string_view` for strings.
+    using RightType = typename RightTraits::PublicType;
+    /// The relation of IDs that does the work.
+    using StoredRelation = RelationOfKind<kKind, StoredLeft, StoredRight, typename Traits::StoragePolicy>;
+
+    /**
+     @brief A pair of (left, right) values.
+     */
+    struct Pair
+    {
+        LeftType left;
+        RightType right;
+        Pair(LeftType left, RightType right)
+        : left(left), right(right)
+        {}
+        Pair()
+        {}
+    };
+
+private:
+    std::unique_ptr<StringPool> m_OwnPool;
+    StringPool *m_Pool;
+    StoredRelation m_Relation;
+
+    using LeftSpan = std::conditional_t<LeftTraits::kIsString, StringIdSpan, std::span<const StoredLeft>>;
+    using RightSpan = std::conditional_t<RightTraits::kIsString, StringIdSpan, std::span<const StoredRight>>;
+
+public:
+    /**
+     @brief Construct an empty set.
+     @param pool The pool to intern the strings in, so that several relations can share it, or nullptr for a pool that
+     belongs to the set. It must outlive the set.
+     */
+    explicit InternedRelation(StringPool *pool = nullptr) noexcept
+    : m_OwnPool(pool ? nullptr : new StringPool()), m_Pool(pool ? pool : m_OwnPool.get())
+    {}
+
+    /**
+     @brief The pool that the strings are interned in.
+     */
+    StringPool &pool() noexcept
+    {
+        return *m_Pool;
+    }
+
+    /**
+     @brief The pool that the strings are interned in, for looking up only.
+     */
+    const StringPool &pool() const noexcept
+    {
+        return *m_Pool;
+    }
+
+    /**
+     @brief The relation of IDs that does the work, for example to combine it with other relations of IDs. The IDs put
+     into it must come from `pool()`.
+     */
+    StoredRelation &relation() noexcept
+    {
+        return m_Relation;
+    }
+
+    /**
+     @brief The relation of IDs that does the work, for example to combine it with other relations of IDs.
+     */
+    const StoredRelation &relation() const noexcept
+    {
+        return m_Relation;
+    }
+
+    /**
+     @brief Insert a pair into the set, with the same rules as the relation that this set stands in for.
+     @param left The left side of the pair to add.
+     @param right The right side of the pair to add.
+     */
+    void insert(LeftArgument left, RightArgument right) noexcept
+    {
+        m_Relation.insert(intern<LeftTraits>(left), intern<RightTraits>(right));
+    }
+
+    /**
+     @brief Erase a pair from the set. If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair to erase.
+     @param right The right side of the pair to erase.
+     */
+    void erase(LeftArgument left, RightArgument right) noexcept
+    {
+        StoredLeft stored_left = find<LeftTraits>(left);
+        StoredRight stored_right = find<RightTraits>(right);
+        if (isKnown<LeftTraits>(stored_left) && isKnown<RightTraits>(stored_right))
+            m_Relation.erase(stored_left, stored_right);
+    }
+
+    /**
+     @brief Erase all pairs with the given left value.
+     @param left The left side of the pairs to erase.
+     */
+    void eraseLeft(LeftArgument left) noexcept
+    {
+        StoredLeft stored_left = find<LeftTraits>(left);
+        if (isKnown<LeftTraits>(stored_left))
+            m_Relation.eraseLeft(stored_left);
+    }
+
+    /**
+     @brief Erase all pairs with the given right value.
+     @param right The right side of the pairs to erase.
+     */
+    void eraseRight(RightArgument right) noexcept
+    {
+        StoredRight stored_right = find<RightTraits>(right);
+        if (isKnown<RightTraits>(stored_right))
+            m_Relation.eraseRight(stored_right);
+    }
+
+    /**
+     @brief Erase all pairs from the set. The strings stay in the pool.
+     */
+    void clear() noexcept
+    {
+        m_Relation.clear();
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    bool contains(LeftArgument left, RightArgument right) const noexcept
+    {
+        return m_Relation.contains(find<LeftTraits>(left), find<RightTraits>(right));
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    bool containsLeft(LeftArgument left) const noexcept
+    {
+        return m_Relation.containsLeft(find<LeftTraits>(left));
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    bool containsRight(RightArgument right) const noexcept
+    {
+        return m_Relation.containsRight(find<RightTraits>(right));
+    }
+
+    /**
+     @brief Find all right values that are paired with this left value. Not for a OneToOne.
+     @param left The left side of the pairs to look for.
+     @return The right values, sorted by ID. They are invalidated by the next change to the set.
+     */
+    RightSpan findRight(LeftArgument left) const noexcept
+        requires(kKind != 1)
+    {
+        return toPublicSpan<RightTraits>(m_Relation.findRight(find<LeftTraits>(left)));
+    }
+
+    /**
+     @brief Find the single right value that is paired with this left value. Only for a OneToOne.
+     @param left The left side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The right value.
+     */
+    RightType findRight(LeftArgument left, RightArgument notFoundValue) const noexcept
+        requires(kKind == 1)
+    {
+        StoredLeft stored_left = find<LeftTraits>(left);
+        if (!m_Relation.containsLeft(stored_left))
+            return RightType(notFoundValue);
+        return toPublic<RightTraits>(m_Relation.findRight(stored_left, StoredRight()));
+    }
+
+    /**
+     @brief Find all left values that are paired with this right value. Only for a ManyToMany.
+     @param right The right side of the pairs to look for.
+     @return The left values, sorted by ID. They are invalidated by the next change to the set.
+     */
+    LeftSpan findLeft(RightArgument right) const noexcept
+        requires(kKind == 3)
+    {
+        return toPublicSpan<LeftTraits>(m_Relation.findLeft(find<RightTraits>(right)));
+    }
+
+    /**
+     @brief Find the single left value that is paired with this right value. Not for a ManyToMany.
+     @param right The right side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The left value.
+     */
+    LeftType findLeft(RightArgument right, LeftArgument notFoundValue) const noexcept
+        requires(kKind != 3)
+    {
+        StoredRight stored_right = find<RightTraits>(right);
+        if (!m_Relation.containsRight(stored_right))
+            return LeftType(notFoundValue);
+        return toPublic<LeftTraits>(m_Relation.findLeft(stored_right, StoredLeft()));
+    }
+
+    /**
+     @brief Count the number of left values in the set.
+     */
+    int countLeft() const noexcept
+    {
+        return m_Relation.countLeft();
+    }
+
+    /**
+     @brief Count the number of right values in the set.
+     */
+    int countRight() const noexcept
+    {
+        return m_Relation.countRight();
+    }
+
+    /**
+     @brief Count the number of pairs in the set.
+     */
+    int count() const noexcept
+    {
+        return m_Relation.count();
+    }
+
+    /**
+     @brief A range-based-for compatible iterator.
+     */
+    class Iterator
+    {
+        /// @cond
+      public:
+        typename StoredRelation::Iterator it;
+        const StringPool *pool;
+
+        inline Pair operator*() const noexcept
+        {
+            auto pair = *it;
+            return Pair(toPublic<LeftTraits>(pool, pair.left), toPublic<RightTraits>(pool, pair.right));
+        }
+
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return it == other.it;
+        }
+
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return it != other.it;
+        }
+
+        inline Iterator operator++() noexcept
+        {
+            ++it;
+            return *this;
+        }
+        /// @endcond
+    };
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to the first pair in the set.
+     */
+    Iterator begin() const noexcept
+    {
+        return Iterator{m_Relation.begin(), m_Pool};
+    }
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to one after the last pair in the set.
+     */
+    Iterator end() const noexcept
+    {
+        return Iterator{m_Relation.end(), m_Pool};
+    }
+
+private:
+    template <typename KeyTraits>
+    typename KeyTraits::StoredType intern(typename KeyTraits::ArgumentType key) const noexcept
+    {
+        if constexpr (KeyTraits::kIsString)
+            return m_Pool->intern(key);
+        else
+            return key;
+    }
+
+    // A string that is not in the pool becomes an invalid ID, which is in no relation
+    template <typename KeyTraits>
+    typename KeyTraits::StoredType find(typename KeyTraits::ArgumentType key) const noexcept
+    {
+        if constexpr (KeyTraits::kIsString)
+            return m_Pool->find(key);
+        else
+            return key;
+    }
+
+    template <typename KeyTraits> static bool isKnown(const typename KeyTraits::StoredType &key) noexcept
+    {
+        if constexpr (KeyTraits::kIsString)
+            return key.isValid();
+        else
+            return true;
+    }
+
+    template <typename KeyTraits>
+    static typename KeyTraits::PublicType toPublic(const StringPool *pool,
+                                                   const typename KeyTraits::StoredType &key) noexcept
+    {
+        if constexpr (KeyTraits::kIsString)
+            return pool->str(key);
+        else
+            return key;
+    }
+
+    template <typename KeyTraits>
+    typename KeyTraits::PublicType toPublic(const typename KeyTraits::StoredType &key) const noexcept
+    {
+        return toPublic<KeyTraits>(m_Pool, key);
+    }
+
+    template <typename KeyTraits>
+    auto toPublicSpan(std::span<const typename KeyTraits::StoredType> keys) const noexcept
+    {
+        if constexpr (KeyTraits::kIsString)
+            return StringIdSpan(keys, m_Pool);
+        else
+            return keys;
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A parent-child hierarchy: a `OneToMany` from parent to children, with an index of pre-order intervals on top.
+ Each node gets the interval of positions that its subtree takes in a pre-order walk of the hierarchy. Whether one node
+ is an ancestor of another is then two integer comparisons, and all descendants of a node are one contiguous span.
+ The index is rebuilt on the first query after a change, in time in proportion to the number of nodes. Because that
+ happens inside const functions, a hierarchy that was changed must not be queried from several threads at once.
+ Nodes in a cycle that no root leads to are left out of the index.
+ */
+template <typename NodeType, typename StoragePolicy = StdStoragePolicy> class Hierarchy
+{
+    // A subtree is at [begin, end) in m_Order. The node itself is at begin.
+    struct Interval
+    {
+        uint32_t begin;
+        uint32_t end;
+    };
+    using IntervalMap = typename StoragePolicy::template Map<NodeType, Interval>;
+
+    OneToMany<NodeType, NodeType, StoragePolicy> m_ParentToChildren;
+    mutable IntervalMap m_Intervals;
+    mutable std::vector<NodeType> m_Order;
+    mutable bool m_IsIndexed = true;
+
+public:
+    /**
+     @brief Add a child to a parent. If the child already had a parent, it moves, with its subtree.
+     @param parent The parent.
+     @param child The child.
+     */
+    void insert(const NodeType &parent, const NodeType &child) noexcept
+    {
+        m_ParentToChildren.insert(parent, child);
+        m_IsIndexed = false;
+    }
+
+    /**
+     @brief Remove a child from a parent. The child becomes a root. If the child does not have this parent, nothing
+     happens.
+     @param parent The parent.
+     @param child The child.
+     */
+    void erase(const NodeType &parent, const NodeType &child) noexcept
+    {
+        m_ParentToChildren.erase(parent, child);
+        m_IsIndexed = false;
+    }
+
+    /**
+     @brief Remove a node from its parent. The node becomes a root.
+     @param child The node.
+     */
+    void eraseParent(const NodeType &child) noexcept
+    {
+        m_ParentToChildren.eraseRight(child);
+        m_IsIndexed = false;
+    }
+
+    /**
+     @brief Remove all children of a node. The children become roots.
+     @param parent The node.
+     */
+    void eraseChildren(const NodeType &parent) noexcept
+    {
+        m_ParentToChildren.eraseLeft(parent);
+        m_IsIndexed = false;
+    }
+
+    /**
+     @brief Remove all nodes.
+     */
+    void clear() noexcept
+    {
+        m_ParentToChildren.clear();
+        m_IsIndexed = false;
+    }
+
+    /**
+     @brief The underlying relation from parents to children.
+     */
+    const OneToMany<NodeType, NodeType, StoragePolicy> &parentToChildren() const noexcept
+    {
+        return m_ParentToChildren;
+    }
+
+    /**
+     @brief Find the parent of a node.
+     @param child The node.
+     @param notFoundValue The value to return if the node has no parent.
+     @return The parent.
+     */
+    NodeType findParent(const NodeType &child, const NodeType &notFoundValue) const noexcept
+    {
+        return m_ParentToChildren.findLeft(child, notFoundValue);
+    }
+
+    /**
+     @brief Find the children of a node. They are sorted.
+     @param parent The node.
+     @return The span of children. It is invalidated by the next change to the hierarchy.
+     */
+    std::span<const NodeType> findChildren(const NodeType &parent) const noexcept
+    {
+        return m_ParentToChildren.findRight(parent);
+    }
+
+    /**
+     @brief Test whether a node is an ancestor of another. A node is not its own ancestor.
+     @param ancestor The node that may be the ancestor.
+     @param descendant The node that may be the descendant.
+     */
+    bool isAncestor(const NodeType &ancestor, const NodeType &descendant) const noexcept
+    {
+        updateIndex();
+        auto ancestor_it = m_Intervals.find(ancestor);
+        auto descendant_it = m_Intervals.find(descendant);
+        if (ancestor_it == m_Intervals.end() || descendant_it == m_Intervals.end())
+            return false;
+
+        auto begin = descendant_it->second.begin;
+        return ancestor_it->second.begin < begin && begin < ancestor_it->second.end;
+    }
+
+    /**
+     @brief Find all descendants of a node, in pre-order: each node comes before its children, which are in sorted
+     order.
+     @param node The node.
+     @return The span of descendants, or an empty span. It is invalidated by the next change to the hierarchy.
+     */
+    std::span<const NodeType> findDescendants(const NodeType &node) const noexcept
+    {
+        auto subtree = findSubtree(node);
+        return subtree.empty() ? subtree : subtree.subspan(1);
+    }
+
+    /**
+     @brief Find a node and all its descendants, in pre-order.
+     @param node The node.
+     @return The span of nodes, or an empty span if the node is not in the hierarchy. It is invalidated by the next
+     change to the hierarchy.
+     */
+    std::span<const NodeType> findSubtree(const NodeType &node) const noexcept
+    {
+        updateIndex();
+        auto interval_it = m_Intervals.find(node);
+        if (interval_it == m_Intervals.end())
+            return std::span<const NodeType>();
+
+        auto &interval = interval_it->second;
+        return std::span<const NodeType>(m_Order.data() + interval.begin, interval.end - interval.begin);
+    }
+
+    /**
+     @brief Count the nodes that have a parent or a child.
+     */
+    int count() const noexcept
+    {
+        updateIndex();
+        return (int)m_Order.size();
+    }
+
+private:
+    // Walk the hierarchy from each root in pre-order, without recursion
+    void updateIndex() const noexcept
+    {
+        if (m_IsIndexed)
+            return;
+        m_IsIndexed = true;
+
+        m_Intervals.clear();
+        m_Order.clear();
+        m_Intervals.reserve(m_ParentToChildren.countLeft() + m_ParentToChildren.countRight());
+        m_Order.reserve(m_ParentToChildren.countLeft() + m_ParentToChildren.countRight());
+
+        std::vector<NodeType> roots;
+        for (auto parent : m_ParentToChildren.allLeft())
+        {
+            if (!m_ParentToChildren.containsRight(parent))
+                roots.push_back(parent);
+        }
+        std::sort(roots.begin(), roots.end());
+
+        // Each entry is a node, and the number of its children that have been visited
+        std::vector<std::pair<NodeType, size_t>> stack;
+        for (auto &root : roots)
+        {
+            m_Intervals.try_emplace(root, Interval{(uint32_t)m_Order.size(), 0});
+            m_Order.push_back(root);
+            stack.push_back(std::pair<NodeType, size_t>(root, 0));
+            while (!stack.empty())
+            {
+                auto children = m_ParentToChildren.findRight(stack.back().first);
+                size_t child_index = stack.back().second++;
+                if (child_index < children.size())
+                {
+                    auto &child = children[child_index];
+                    m_Intervals.try_emplace(child, Interval{(uint32_t)m_Order.size(), 0});
+                    m_Order.push_back(child);
+                    stack.push_back(std::pair<NodeType, size_t>(child, 0));
+                }
+                else
+                {
+                    m_Intervals.find(stack.back().first)->second.end = (uint32_t)m_Order.size();
+                    stack.pop_back();
+                }
+            }
+        }
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/// @cond
+// 32-bit integers are intersected four by four with SSE2 compares
+template <typename ValueType>
+inline constexpr bool kIsSimdIntersectable =
+#ifdef BINARY_RELATIONS_SSE2
+    std::is_integral_v<ValueType> && sizeof(ValueType) == 4;
+#else
+    false;
+#endif
+
+// The position of the first value in set[from...] that is not less than value. Probes 1, 2, 4, 8... ahead first, so
+// skipping far ahead in a large set takes logarithmic time, and a short step takes constant time.
+template <typename ValueType>
+size_t gallopInSortedSet(std::span<const ValueType> set, size_t from, const ValueType &value) noexcept
+{
+    size_t probe = from;
+    size_t step = 1;
+    while (probe < set.size() && set[probe] < value)
+    {
+        from = probe + 1;
+        probe += step;
+        step *= 2;
+    }
+    auto end_it = set.begin() + std::min(probe, set.size());
+    return std::lower_bound(set.begin() + from, end_it, value) - set.begin();
+}
+
+// Call emit with each value that is in both sets, in order
+template <typename ValueType, typename Function>
+void intersectTwoSortedSets(std::span<const ValueType> a, std::span<const ValueType> b, Function emit) noexcept
+{
+    if (a.size() > b.size())
+        std::swap(a, b);
+
+    size_t a_index = 0;
+    size_t b_index = 0;
+    if (a.size() * 32 < b.size())
+    {
+        // Skewed sizes: look up each value of the small set in the large one
+        for (auto &value : a)
+        {
+            b_index = gallopInSortedSet(b, b_index, value);
+            if (b_index == b.size())
+                return;
+            if (b[b_index] == value)
+                emit(value);
+        }
+        return;
+    }
+
+#ifdef BINARY_RELATIONS_SSE2
+    if constexpr (kIsSimdIntersectable<ValueType>)
+    {
+        // Compare a block of four from each set, all against all, by rotating one of them. Then move past the block
+        // with the smaller last value, or both.
+        while (a_index + 4 <= a.size() && b_index + 4 <= b.size())
+        {
+            __m128i a_block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a.data() + a_index));
+            __m128i b_block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b.data() + b_index));
+            __m128i match = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi32(a_block, b_block),
+                             _mm_cmpeq_epi32(a_block, _mm_shuffle_epi32(b_block, _MM_SHUFFLE(0, 3, 2, 1)))),
+                _mm_or_si128(_mm_cmpeq_epi32(a_block, _mm_shuffle_epi32(b_block, _MM_SHUFFLE(1, 0, 3, 2))),
+                             _mm_cmpeq_epi32(a_block, _mm_shuffle_epi32(b_block, _MM_SHUFFLE(2, 1, 0, 3)))));
+            for (int bits = _mm_movemask_ps(_mm_castsi128_ps(match)); bits != 0; bits &= bits - 1)
+                emit(a[a_index + std::countr_zero((unsigned)bits)]);
+
+            auto a_last = a[a_index + 3];
+            auto b_last = b[b_index + 3];
+            if (!(b_last < a_last))
+                a_index += 4;
+            if (!(a_last < b_last))
+                b_index += 4;
+        }
+    }
+#endif
+
+    while (a_index < a.size() && b_index < b.size())
+    {
+        if (a[a_index] < b[b_index])
+        {
+            a_index++;
+        }
+        else if (b[b_index] < a[a_index])
+        {
+            b_index++;
+        }
+        else
+        {
+            emit(a[a_index]);
+            a_index++;
+            b_index++;
+        }
+    }
+}
+
+template <typename ValueType, typename Function>
+void intersectSortedSets(std::span<const std::span<const ValueType>> sets, Function emit) noexcept
+{
+    if (sets.empty())
+        return;
+    if (sets.size() == 1)
+    {
+        for (auto &value : sets[0])
+            emit(value);
+        return;
+    }
+
+    // The two smallest sets are intersected first. Each value they share is then looked up in the others, in order.
+    std::vector<std::span<const ValueType>> sorted_sets(sets.begin(), sets.end());
+    std::sort(sorted_sets.begin(), sorted_sets.end(), [](auto &a, auto &b) { return a.size() < b.size(); });
+    std::vector<size_t> positions(sorted_sets.size(), 0);
+    intersectTwoSortedSets(sorted_sets[0], sorted_sets[1], [&](const ValueType &value) {
+        for (size_t set_index = 2; set_index < sorted_sets.size(); ++set_index)
+        {
+            auto &set = sorted_sets[set_index];
+            positions[set_index] = gallopInSortedSet(set, positions[set_index], value);
+            if (positions[set_index] == set.size() || !(set[positions[set_index]] == value))
+                return;
+        }
+        emit(value);
+    });
+}
+
+template <typename ValueType, typename Function>
+void unionSortedSets(std::span<const std::span<const ValueType>> sets, Function emit) noexcept
+{
+    std::vector<size_t> positions(sets.size(), 0);
+    while (true)
+    {
+        // The smallest value at the front of any set
+        const ValueType *smallest = nullptr;
+        for (size_t set_index = 0; set_index < sets.size(); ++set_index)
+        {
+            if (positions[set_index] < sets[set_index].size() &&
+                (smallest == nullptr || sets[set_index][positions[set_index]] < *smallest))
+                smallest = &sets[set_index][positions[set_index]];
+        }
+        if (smallest == nullptr)
+            return;
+
+        ValueType value = *smallest;
+        emit(value);
+        for (size_t set_index = 0; set_index < sets.size(); ++set_index)
+        {
+            if (positions[set_index] < sets[set_index].size() && sets[set_index][positions[set_index]] == value)
+                positions[set_index]++;
+        }
+    }
+}
+
+template <typename ValueType, typename Function>
+void differenceSortedSets(std::span<const std::span<const ValueType>> sets, Function emit) noexcept
+{
+    if (sets.empty())
+        return;
+
+    std::vector<size_t> positions(sets.size(), 0);
+    for (auto &value : sets[0])
+    {
+        bool found = false;
+        for (size_t set_index = 1; set_index < sets.size() && !found; ++set_index)
+        {
+            auto &set = sets[set_index];
+            positions[set_index] = gallopInSortedSet(set, positions[set_index], value);
+            found = positions[set_index] != set.size() && set[positions[set_index]] == value;
+        }
+        if (!found)
+            emit(value);
+    }
+}
+
+// Run one of the above, and either count the values or collect them
+template <typename ValueType, typename Operation>
+int runSortedSetOperation(std::span<const std::span<const ValueType>> sets, std::vector<ValueType> *result,
+                          Operation operation) noexcept
+{
+    int count = 0;
+    if (result == nullptr)
+    {
+        operation(sets, [&count](const ValueType &) { count++; });
+        return count;
+    }
+
+    result->clear();
+    operation(sets, [result](const ValueType &value) { result->push_back(value); });
+    return (int)result->size();
+}
+/// @endcond
+
+/**
+ @brief Intersect sorted sets, such as the spans that findRight() and findLeft() return.
+ Sets of very different sizes are intersected by galloping through the larger one. 32-bit integers are compared four at
+ a time with SIMD instructions where available.
+ @param sets The sets. Each must be sorted, without duplicates.
+ @param result Receives the values that are in all sets, sorted. Pass nullptr to only count them.
+ @return The number of values that are in all sets.
+ */
+template <typename ValueType>
+int intersectSorted(std::initializer_list<std::span<const ValueType>> sets,
+                    std::vector<ValueType> *result = nullptr) noexcept
+{
+    return runSortedSetOperation(std::span<const std::span<const ValueType>>(sets.begin(), sets.size()), result,
+                                 [](auto sets, auto emit) { intersectSortedSets(sets, emit); });
+}
+
+/**
+ @brief Intersect sorted sets. See the initializer list version.
+ */
+template <typename ValueType>
+int intersectSorted(const std::vector<std::span<const ValueType>> &sets,
+                    std::vector<ValueType> *result = nullptr) noexcept
+{
+    return runSortedSetOperation(std::span<const std::span<const ValueType>>(sets), result,
+                                 [](auto sets, auto emit) { intersectSortedSets(sets, emit); });
+}
+
+/**
+ @brief Unite sorted sets, such as the spans that findRight() and findLeft() return.
+ @param sets The sets. Each must be sorted, without duplicates.
+ @param result Receives the values that are in any set, sorted, without duplicates. Pass nullptr to only count them.
+ @return The number of values that are in any set.
+ */
+template <typename ValueType>
+int unionSorted(std::initializer_list<std::span<const ValueType>> sets,
+                std::vector<ValueType> *result = nullptr) noexcept
+{
+    return runSortedSetOperation(std::span<const std::span<const ValueType>>(sets.begin(), sets.size()), result,
+                                 [](auto sets, auto emit) { unionSortedSets(sets, emit); });
+}
+
+/**
+ @brief Unite sorted sets. See the initializer list version.
+ */
+template <typename ValueType>
+int unionSorted(const std::vector<std::span<const ValueType>> &sets, std::vector<ValueType> *result = nullptr) noexcept
+{
+    return runSortedSetOperation(std::span<const std::span<const ValueType>>(sets), result,
+                                 [](auto sets, auto emit) { unionSortedSets(sets, emit); });
+}
+
+/**
+ @brief Subtract sorted sets from the first one, such as the spans that findRight() and findLeft() return.
+ Each value of the first set is looked up in the others by galloping, so large sets to subtract cost little.
+ @param sets The sets. Each must be sorted, without duplicates.
+ @param result Receives the values of the first set that are in none of the others, sorted. Pass nullptr to only
+ count them.
+ @return The number of values of the first set that are in none of the others.
+ */
+template <typename ValueType>
+int differenceSorted(std::initializer_list<std::span<const ValueType>> sets,
+                     std::vector<ValueType> *result = nullptr) noexcept
+{
+    return runSortedSetOperation(std::span<const std::span<const ValueType>>(sets.begin(), sets.size()), result,
+                                 [](auto sets, auto emit) { differenceSortedSets(sets, emit); });
+}
+
+/**
+ @brief Subtract sorted sets from the first one. See the initializer list version.
+ */
+template <typename ValueType>
+int differenceSorted(const std::vector<std::span<const ValueType>> &sets,
+                     std::vector<ValueType> *result = nullptr) noexcept
+{
+    return runSortedSetOperation(std::span<const std::span<const ValueType>>(sets), result,
+                                 [](auto sets, auto emit) { differenceSortedSets(sets, emit); });
+}
+
+// ----------------------------------------------------------------------------
+
+/// @cond
+// Compressed sparse row layout: sorted unique keys, and the values of key i at [m_Offsets[i], m_Offsets[i + 1]) in
+// one shared array of values.
+template <typename KeyType, typename ValueType> class CompressedIndex
+{
+public:
+    std::vector<KeyType> m_Keys;
+    std::vector<uint32_t> m_Offsets = std::vector<uint32_t>(1, 0);
+    std::vector<ValueType> m_Values;
+
+    // Index of the key, or m_Keys.size() if it is not there
+    template <typename Key> size_t indexOf(const Key &key) const noexcept
+    {
+        auto it = std::lower_bound(m_Keys.cbegin(), m_Keys.cend(), key);
+        if (it != m_Keys.cend() && *it == key)
+            return it - m_Keys.cbegin();
+        return m_Keys.size();
+    }
+
+    std::span<const ValueType> valuesAt(size_t index) const noexcept
+    {
+        return std::span<const ValueType>(m_Values.data() + m_Offsets[index], m_Offsets[index + 1] - m_Offsets[index]);
+    }
+
+    template <typename Key> std::span<const ValueType> find(const Key &key) const noexcept
+    {
+        size_t index = indexOf(key);
+        if (index == m_Keys.size())
+            return std::span<const ValueType>();
+        return valuesAt(index);
+    }
+
+    // Build from the keys and the sorted value spans of a relation
+    template <typename KeyRange, typename FindFunction>
+    void build(const KeyRange &keyRange, int valueCount, FindFunction find) noexcept
+    {
+        for (auto key : keyRange)
+            m_Keys.push_back(key);
+        std::sort(m_Keys.begin(), m_Keys.end());
+
+        m_Offsets.reserve(m_Keys.size() + 1);
+        m_Values.reserve(valueCount);
+        for (auto &key : m_Keys)
+        {
+            auto values = find(key);
+            m_Values.insert(m_Values.end(), values.begin(), values.end());
+            m_Offsets.push_back((uint32_t)m_Values.size());
+        }
+    }
+};
+/// @endcond
+
+// ----------------------------------------------------------------------------
+
+/**
+ An immutable one-to-many set of (left, right) pairs, made by `OneToMany::freeze()`.
+ All pairs are stored in a few flat arrays: the sorted left values, the right values of all left values back to back,
+ and the sorted right values. Lookup is a binary search. It uses much less memory than a `OneToMany`, and iteration is
+ a linear walk through memory.
+ */
+template <typename LeftType, typename RightType> class FrozenOneToMany
+{
+    CompressedIndex<LeftType, RightType> m_LeftToRight;
+    std::vector<RightType> m_Right;             // All right values, sorted
+    std::vector<uint32_t> m_RightToLeftIndex;   // For each of m_Right, the index of its left value
+
+public:
+    /**
+    @brief A pair of (left, right) values.
+     */
+    struct Pair
+    {
+        LeftType left;
+        RightType right;
+        Pair(LeftType left, RightType right)
+        : left(left), right(right)
+        {}
+        Pair()
+        {}
+    };
+
+    /**
+     @brief Default constructor. Makes an empty set.
+     */
+    FrozenOneToMany() noexcept
+    {}
+
+    /**
+     @brief Make a frozen copy of a one-to-many relation.
+     @param relation The relation to copy. Usually a `OneToMany`.
+     */
+    template <typename Relation> explicit FrozenOneToMany(const Relation &relation) noexcept
+    {
+        m_LeftToRight.build(relation.allLeft(), relation.count(),
+                            [&relation](const LeftType &left) { return relation.findRight(left); });
+
+        std::vector<std::pair<RightType, uint32_t>> right_to_left;
+        right_to_left.reserve(m_LeftToRight.m_Values.size());
+        for (size_t left_index = 0; left_index < m_LeftToRight.m_Keys.size(); ++left_index)
+        {
+            for (auto &right : m_LeftToRight.valuesAt(left_index))
+                right_to_left.push_back(std::pair<RightType, uint32_t>(right, (uint32_t)left_index));
+        }
+        std::sort(right_to_left.begin(), right_to_left.end(),
+                  [](const auto &a, const auto &b) { return a.first < b.first; });
+
+        m_Right.reserve(right_to_left.size());
+        m_RightToLeftIndex.reserve(right_to_left.size());
+        for (auto &r2l : right_to_left)
+        {
+            m_Right.push_back(r2l.first);
+            m_RightToLeftIndex.push_back(r2l.second);
+        }
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param pair The pair to look for.
+     */
+    bool contains(const Pair &pair) const noexcept
+    {
+        return contains(pair.left, pair.right);
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType, typename RightKey = RightType>
+    bool contains(const LeftKey &left, const RightKey &right) const noexcept
+    {
+        size_t index = indexOfRight(right);
+        return index != m_Right.size() && m_LeftToRight.m_Keys[m_RightToLeftIndex[index]] == left;
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType> bool containsLeft(const LeftKey &left) const noexcept
+    {
+        return m_LeftToRight.indexOf(left) != m_LeftToRight.m_Keys.size();
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    template <typename RightKey = RightType> bool containsRight(const RightKey &right) const noexcept
+    {
+        return indexOfRight(right) != m_Right.size();
+    }
+
+    /**
+     @brief Find all right values that are paired with this left value.
+     If nothing is found, you will get an empty span.
+     This works well with range-based-for. The right values are sorted.
+     @param left The left side of the pair to look for.
+     @return The span of right values.
+     */
+    template <typename LeftKey = LeftType> std::span<const RightType> findRight(const LeftKey &left) const noexcept
+    {
+        return m_LeftToRight.find(left);
+    }
+
+    /**
+     @brief Find the single left value that is paired with this right value.
+     If nothing is found, you will get the notFoundValue.
+     @param right The right side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The singular left value.
+     */
+    template <typename RightKey = RightType>
+    LeftType findLeft(const RightKey &right, const LeftType &notFoundValue) const noexcept
+    {
+        size_t index = indexOfRight(right);
+        if (index == m_Right.size())
+            return notFoundValue;
+
+        return m_LeftToRight.m_Keys[m_RightToLeftIndex[index]];
+    }
+
+    /**
+     @brief Count the number of left values in the set.
+     @return The number of left values in the set.
+     */
+    int countLeft() const noexcept
+    {
+        return (int)m_LeftToRight.m_Keys.size();
+    }
+
+    /**
+     @brief Count the number of right values in the set.
+     @return The number of right values in the set.
+     */
+    int countRight() const noexcept
+    {
+        return (int)m_Right.size();
+    }
+
+    /**
+     @brief Count the number of pairs in the set.
+     @return The number of pairs in the set.
+     */
+    int count() const noexcept
+    {
+        return (int)m_Right.size();
+    }
+
+    /**
+     @brief List all left elements, sorted.
+     @return A span of left elements.
+     */
+    std::span<const LeftType> allLeft() const noexcept
+    {
+        return std::span<const LeftType>(m_LeftToRight.m_Keys);
+    }
+
+    /**
+     @brief List all right elements, sorted.
+     @return A span of right elements.
+     */
+    std::span<const RightType> allRight() const noexcept
+    {
+        return std::span<const RightType>(m_Right);
+    }
+
+    /**
+     @brief A range-based-for compatible iterator.
+     */
+    class Iterator
+    {
+        /// @cond
+      public:
+        const CompressedIndex<LeftType, RightType> *index;
+        size_t left_index;
+        size_t right_index;
+
+        inline Pair operator*() const noexcept
+        {
+            return Pair(index->m_Keys[left_index], index->m_Values[right_index]);
+        }
+
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return right_index == other.right_index;
+        }
+
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return right_index != other.right_index;
+        }
+
+        inline Iterator operator++() noexcept
+        {
+            right_index++;
+            if (right_index == index->m_Offsets[left_index + 1])
+                left_index++;
+            return *this;
+        }
+        /// @endcond
+    };
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to the first pair in the set.
+     */
+    Iterator begin() const noexcept
+    {
+        Iterator it;
+        it.index = &m_LeftToRight;
+        it.left_index = 0;
+        it.right_index = 0;
+        return it;
+    }
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to one after the last pair in the set.
+     */
+    Iterator end() const noexcept
+    {
+        Iterator it;
+        it.index = &m_LeftToRight;
+        it.left_index = m_LeftToRight.m_Keys.size();
+        it.right_index = m_LeftToRight.m_Values.size();
+        return it;
+    }
+
+private:
+    template <typename RightKey> size_t indexOfRight(const RightKey &right) const noexcept
+    {
+        auto it = std::lower_bound(m_Right.cbegin(), m_Right.cend(), right);
+        if (it != m_Right.cend() && *it == right)
+            return it - m_Right.cbegin();
+        return m_Right.size();
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ An immutable many-to-many set of (left, right) pairs, made by `ManyToMany::freeze()`.
+ Both directions are stored in compressed sparse row form: sorted keys, and the sorted values of all keys back to back
+ in one array. Lookup is a binary search. It uses much less memory than a `ManyToMany`, and iteration is a linear walk
+ through memory.
+ */
+template <typename LeftType, typename RightType> class FrozenManyToMany
+{
+    CompressedIndex<LeftType, RightType> m_LeftToRight;
+    CompressedIndex<RightType, LeftType> m_RightToLeft;
+
+public:
+    /**
+    @brief A pair of (left, right) values.
+     */
+    struct Pair
+    {
+        LeftType left;
+        RightType right;
+        Pair(LeftType left, RightType right)
+        : left(left), right(right)
+        {}
+        Pair()
+        {}
+    };
+
+    /**
+     @brief Default constructor. Makes an empty set.
+     */
+    FrozenManyToMany() noexcept
+    {}
+
+    /**
+     @brief Make a frozen copy of a many-to-many relation.
+     @param relation The relation to copy. Usually a `ManyToMany`.
+     */
+    template <typename Relation> explicit FrozenManyToMany(const Relation &relation) noexcept
+    {
+        m_LeftToRight.build(relation.allLeft(), relation.count(),
+                            [&relation](const LeftType &left) { return relation.findRight(left); });
+        m_RightToLeft.build(relation.allRight(), relation.count(),
+                            [&relation](const RightType &right) { return relation.findLeft(right); });
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param pair The pair to look for.
+     */
+    bool contains(const Pair &pair) const noexcept
+    {
+        return contains(pair.left, pair.right);
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType, typename RightKey = RightType>
+    bool contains(const LeftKey &left, const RightKey &right) const noexcept
+    {
+        auto right_values = m_LeftToRight.find(left);
+        return std::binary_search(right_values.begin(), right_values.end(), right);
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    template <typename LeftKey = LeftType> bool containsLeft(const LeftKey &left) const noexcept
+    {
+        return m_LeftToRight.indexOf(left) != m_LeftToRight.m_Keys.size();
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    template <typename RightKey = RightType> bool containsRight(const RightKey &right) const noexcept
+    {
+        return m_RightToLeft.indexOf(right) != m_RightToLeft.m_Keys.size();
+    }
+
+    /**
+     @brief Find all right values that are paired with this left value.
+     If nothing is found, you will get an empty span.
+     This works well with range-based-for. The right values are sorted.
+     @param left The left side of the pair to look for.
+     @return The span of right values.
+     */
+    template <typename LeftKey = LeftType> std::span<const RightType> findRight(const LeftKey &left) const noexcept
+    {
+        return m_LeftToRight.find(left);
+    }
+
+    /**
+     @brief Find all left values that are paired with this right value.
+     If nothing is found, you will get an empty span.
+     This works well with range-based-for. The left values are sorted.
+     @param right The right side of the pair to look for.
+     @return The span of left values.
+     */
+    template <typename RightKey = RightType> std::span<const LeftType> findLeft(const RightKey &right) const noexcept
+    {
+        return m_RightToLeft.find(right);
+    }
+
+    /**
+     @brief Count the number of left values in the set.
+     @return The number of left values in the set.
+     */
+    int countLeft() const noexcept
+    {
+        return (int)m_LeftToRight.m_Keys.size();
+    }
+
+    /**
+     @brief Count the number of right values in the set.
+     @return The number of right values in the set.
+     */
+    int countRight() const noexcept
+    {
+        return (int)m_RightToLeft.m_Keys.size();
+    }
+
+    /**
+     @brief Count the number of pairs in the set.
+     @return The number of pairs in the set.
+     */
+    int count() const noexcept
+    {
+        return (int)m_LeftToRight.m_Values.size();
+    }
+
+    /**
+     @brief List all left elements, sorted.
+     @return A span of left elements.
+     */
+    std::span<const LeftType> allLeft() const noexcept
+    {
+        return std::span<const LeftType>(m_LeftToRight.m_Keys);
+    }
+
+    /**
+     @brief List all right elements, sorted.
+     @return A span of right elements.
+     */
+    std::span<const RightType> allRight() const noexcept
+    {
+        return std::span<const RightType>(m_RightToLeft.m_Keys);
+    }
+
+    /**
+     @brief A range-based-for compatible iterator.
+     */
+    class Iterator
+    {
+        /// @cond
+      public:
+        const CompressedIndex<LeftType, RightType> *index;
+        size_t left_index;
+        size_t right_index;
+
+        inline Pair operator*() const noexcept
+        {
+            return Pair(index->m_Keys[left_index], index->m_Values[right_index]);
+        }
+
+        inline bool operator==(const Iterator &other) const noexcept
+        {
+            return right_index == other.right_index;
+        }
+
+        inline bool operator!=(const Iterator &other) const noexcept
+        {
+            return right_index != other.right_index;
+        }
+
+        inline Iterator operator++() noexcept
+        {
+            right_index++;
+            if (right_index == index->m_Offsets[left_index + 1])
+                left_index++;
+            return *this;
+        }
+        /// @endcond
+    };
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to the first pair in the set.
+     */
+    Iterator begin() const noexcept
+    {
+        Iterator it;
+        it.index = &m_LeftToRight;
+        it.left_index = 0;
+        it.right_index = 0;
+        return it;
+    }
+
+    /**
+     @brief Required member to get range-based-for.
+     @return an Iterator set to one after the last pair in the set.
+     */
+    Iterator end() const noexcept
+    {
+        Iterator it;
+        it.index = &m_LeftToRight;
+        it.left_index = m_LeftToRight.m_Keys.size();
+        it.right_index = m_LeftToRight.m_Values.size();
+        return it;
+    }
+};
+
+// -------- Concurrent relations --------
+
+/// @cond
+// The default number of shards per side: several per hardware thread, so that two threads rarely want the same one
+inline size_t resolveShardCount(int shardCount) noexcept
+{
+    if (shardCount > 0)
+        return (size_t)shardCount;
+    return 4 * (size_t)resolveThreadCount(0);
+}
+
+// One partition of one side of a concurrent relation: a map and the reader/writer lock that guards it. Each shard has
+// cache lines of its own, so that threads working on neighbouring shards do not slow each other down.
+template <typename MapType> struct alignas(64) ConcurrentShard
+{
+    mutable std::shared_mutex m_Mutex;
+    MapType m_Map;
+};
+
+// The shards of one side of a concurrent relation. A key always goes to the same shard.
+template <typename KeyType, typename MapType> class ConcurrentShards
+{
+    std::unique_ptr<ConcurrentShard<MapType>[]> m_Shards;
+    size_t m_Count;
+
+public:
+    explicit ConcurrentShards(size_t count) noexcept
+    : m_Shards(new ConcurrentShard<MapType>[count]), m_Count(count)
+    {}
+
+    size_t size() const noexcept
+    {
+        return m_Count;
+    }
+
+    size_t indexOf(const KeyType &key) const noexcept
+    {
+        uint64_t hash;
+        if constexpr (DenseHandleTraits<KeyType>::kIsDense)
+            hash = DenseHandleTraits<KeyType>::index(key);
+        else
+            hash = TransparentHash<KeyType>()(key);
+        // Spread the bits, so that keys that only differ in their high bits do not all go to one shard
+        return (size_t)(((hash * 0x9e3779b97f4a7c15ULL) >> 32) % m_Count);
+    }
+
+    ConcurrentShard<MapType> &operator[](size_t index) noexcept
+    {
+        return m_Shards[index];
+    }
+
+    const ConcurrentShard<MapType> &operator[](size_t index) const noexcept
+    {
+        return m_Shards[index];
+    }
+};
+
+// Exclusive locks on several shards, taken in one global order: by rank, where every left shard ranks below every right
+// shard. Each operation that locks more than one shard does it this way, so no two operations can ever each hold a lock
+// that the other is waiting for.
+class ShardLockSet
+{
+    SmallVector<std::pair<size_t, std::shared_mutex *>, 4> m_Locks;
+    bool m_IsLocked = false;
+
+public:
+    ShardLockSet() noexcept
+    {}
+
+    ShardLockSet(const ShardLockSet &) = delete;
+    ShardLockSet &operator=(const ShardLockSet &) = delete;
+
+    ~ShardLockSet() noexcept
+    {
+        if (!m_IsLocked)
+            return;
+        for (size_t index = m_Locks.size(); index-- > 0; )
+            m_Locks[index].second->unlock();
+    }
+
+    void add(size_t rank, std::shared_mutex *mutex) noexcept
+    {
+        m_Locks.push_back(std::pair<size_t, std::shared_mutex *>(rank, mutex));
+    }
+
+    void lock() noexcept
+    {
+        std::sort(m_Locks.begin(), m_Locks.end(), [](auto &a, auto &b) { return a.first < b.first; });
+        m_Locks.erase(std::unique(m_Locks.begin(), m_Locks.end(), [](auto &a, auto &b) { return a.first == b.first; }),
+                      m_Locks.end());
+        for (auto &lock : m_Locks)
+            lock.second->lock();
+        m_IsLocked = true;
+    }
+};
+
+// Erase a value from the sorted vector of a key, and the key if that was its last value
+template <typename MapType, typename KeyType, typename ValueType>
+void eraseFromMappedVector(MapType *map, const KeyType &key, const ValueType &value) noexcept
+{
+    auto it = map->find(key);
+    if (it == map->end())
+        return;
+    eraseFromSortedVector(&it->second, value);
+    if (it->second.empty())
+        map->erase(it);
+}
+/// @endcond
+
+/**
+ A one-to-many set that many threads can read and change at once.
+ The left and the right values are each divided over a number of shards, that each have their own reader/writer lock.
+ Queries take a shared lock on one shard. Changes lock the few shards they touch, in a fixed order, so that they cannot
+ deadlock. Threads that work on different keys rarely wait for each other.
+ Queries return copies, since the set may change as soon as the lock is released.
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy = StdStoragePolicy> class ConcurrentOneToMany
+{
+    using RightVector = std::vector<RightType>;
+    using LeftToRightMap = typename StoragePolicy::template Map<LeftType, RightVector>;
+    using RightToLeftMap = typename StoragePolicy::template Map<RightType, LeftType>;
+
+    ConcurrentShards<LeftType, LeftToRightMap> m_LeftToRight;
+    ConcurrentShards<RightType, RightToLeftMap> m_RightToLeft;
+
+public:
+    /**
+     @brief Construct an empty set.
+     @param shardCount The number of shards for each side, or 0 for four per hardware thread.
+     */
+    explicit ConcurrentOneToMany(int shardCount = 0) noexcept
+    : m_LeftToRight(resolveShardCount(shardCount)), m_RightToLeft(resolveShardCount(shardCount))
+    {}
+
+    /**
+     @brief Add a pair to the set. If the right value already had a left value, that pair is erased first.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void insert(const LeftType &left, const RightType &right) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        size_t right_index = m_RightToLeft.indexOf(right);
+        auto &right_shard = m_RightToLeft[right_index];
+        while (true)
+        {
+            std::optional<LeftType> old_left = findLeft(right);
+            if (old_left && *old_left == left)
+                return;
+
+            ShardLockSet locks;
+            locks.add(left_index, &m_LeftToRight[left_index].m_Mutex);
+            locks.add(rightRank(right_index), &right_shard.m_Mutex);
+            size_t old_index = old_left ? m_LeftToRight.indexOf(*old_left) : 0;
+            if (old_left)
+                locks.add(old_index, &m_LeftToRight[old_index].m_Mutex);
+            locks.lock();
+
+            // Start over if another thread changed the pair before the locks were taken
+            auto r2l_it = right_shard.m_Map.find(right);
+            if (old_left ? r2l_it == right_shard.m_Map.end() || !(r2l_it->second == *old_left)
+                         : r2l_it != right_shard.m_Map.end())
+                continue;
+
+            if (old_left)
+            {
+                eraseFromMappedVector(&m_LeftToRight[old_index].m_Map, *old_left, right);
+                r2l_it->second = left;
+            }
+            else
+            {
+                right_shard.m_Map.try_emplace(right, left);
+            }
+            insertIntoSortedVector(&m_LeftToRight[left_index].m_Map.try_emplace(left).first->second, right);
+            return;
+        }
+    }
+
+    /**
+     @brief Erase a pair from the set. If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void erase(const LeftType &left, const RightType &right) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        size_t right_index = m_RightToLeft.indexOf(right);
+        ShardLockSet locks;
+        locks.add(left_index, &m_LeftToRight[left_index].m_Mutex);
+        locks.add(rightRank(right_index), &m_RightToLeft[right_index].m_Mutex);
+        locks.lock();
+
+        auto &r2l_map = m_RightToLeft[right_index].m_Map;
+        auto r2l_it = r2l_map.find(right);
+        if (r2l_it == r2l_map.end() || !(r2l_it->second == left))
+            return;
+        r2l_map.erase(r2l_it);
+        eraseFromMappedVector(&m_LeftToRight[left_index].m_Map, left, right);
+    }
+
+    /**
+     @brief Erase all pairs with the given left value.
+     @param left The left side of the pairs to erase.
+     */
+    void eraseLeft(const LeftType &left) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        auto &left_shard = m_LeftToRight[left_index];
+        while (true)
+        {
+            RightVector rights = findRight(left);
+            if (rights.empty())
+                return;
+
+            ShardLockSet locks;
+            locks.add(left_index, &left_shard.m_Mutex);
+            for (auto &right : rights)
+            {
+                size_t right_index = m_RightToLeft.indexOf(right);
+                locks.add(rightRank(right_index), &m_RightToLeft[right_index].m_Mutex);
+            }
+            locks.lock();
+
+            auto l2r_it = left_shard.m_Map.find(left);
+            if (l2r_it == left_shard.m_Map.end() || !(l2r_it->second == rights))
+                continue;
+
+            for (auto &right : rights)
+                m_RightToLeft[m_RightToLeft.indexOf(right)].m_Map.erase(right);
+            left_shard.m_Map.erase(l2r_it);
+            return;
+        }
+    }
+
+    /**
+     @brief Erase the pair with the given right value.
+     @param right The right side of the pair to erase.
+     */
+    void eraseRight(const RightType &right) noexcept
+    {
+        while (true)
+        {
+            std::optional<LeftType> left = findLeft(right);
+            if (!left)
+                return;
+
+            size_t left_index = m_LeftToRight.indexOf(*left);
+            size_t right_index = m_RightToLeft.indexOf(right);
+            ShardLockSet locks;
+            locks.add(left_index, &m_LeftToRight[left_index].m_Mutex);
+            locks.add(rightRank(right_index), &m_RightToLeft[right_index].m_Mutex);
+            locks.lock();
+
+            auto &r2l_map = m_RightToLeft[right_index].m_Map;
+            auto r2l_it = r2l_map.find(right);
+            if (r2l_it == r2l_map.end() || !(r2l_it->second == *left))
+                continue;
+            r2l_map.erase(r2l_it);
+            eraseFromMappedVector(&m_LeftToRight[left_index].m_Map, *left, right);
+            return;
+        }
+    }
+
+    /**
+     @brief Erase all pairs from the set.
+     */
+    void clear() noexcept
+    {
+        ShardLockSet locks;
+        for (size_t index = 0; index < m_LeftToRight.size(); ++index)
+            locks.add(index, &m_LeftToRight[index].m_Mutex);
+        for (size_t index = 0; index < m_RightToLeft.size(); ++index)
+            locks.add(rightRank(index), &m_RightToLeft[index].m_Mutex);
+        locks.lock();
+
+        for (size_t index = 0; index < m_LeftToRight.size(); ++index)
+            m_LeftToRight[index].m_Map.clear();
+        for (size_t index = 0; index < m_RightToLeft.size(); ++index)
+            m_RightToLeft[index].m_Map.clear();
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    bool contains(const LeftType &left, const RightType &right) const noexcept
+    {
+        std::optional<LeftType> found = findLeft(right);
+        return found && *found == left;
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    bool containsLeft(const LeftType &left) const noexcept
+    {
+        auto &shard = m_LeftToRight[m_LeftToRight.indexOf(left)];
+        std::shared_lock lock(shard.m_Mutex);
+        return shard.m_Map.contains(left);
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    bool containsRight(const RightType &right) const noexcept
+    {
+        auto &shard = m_RightToLeft[m_RightToLeft.indexOf(right)];
+        std::shared_lock lock(shard.m_Mutex);
+        return shard.m_Map.contains(right);
+    }
+
+    /**
+     @brief Find the single left value that is paired with this right value.
+     @param right The right side of the pair to look for.
+     @return The left value, or nothing.
+     */
+    std::optional<LeftType> findLeft(const RightType &right) const noexcept
+    {
+        auto &shard = m_RightToLeft[m_RightToLeft.indexOf(right)];
+        std::shared_lock lock(shard.m_Mutex);
+        auto r2l_it = shard.m_Map.find(right);
+        if (r2l_it == shard.m_Map.end())
+            return std::nullopt;
+        return r2l_it->second;
+    }
+
+    /**
+     @brief Find the single left value that is paired with this right value.
+     @param right The right side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The left value.
+     */
+    LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
+    {
+        return findLeft(right).value_or(notFoundValue);
+    }
+
+    /**
+     @brief Find all right values that are paired with this left value.
+     @param left The left side of the pairs to look for.
+     @return A copy of the right values, sorted.
+     */
+    std::vector<RightType> findRight(const LeftType &left) const noexcept
+    {
+        auto &shard = m_LeftToRight[m_LeftToRight.indexOf(left)];
+        std::shared_lock lock(shard.m_Mutex);
+        auto l2r_it = shard.m_Map.find(left);
+        if (l2r_it == shard.m_Map.end())
+            return std::vector<RightType>();
+        return l2r_it->second;
+    }
+
+    /**
+     @brief Count the number of left values in the set. Shards are counted one after the other, so while other threads
+     change the set, the count is approximate.
+     */
+    int countLeft() const noexcept
+    {
+        return countKeys(m_LeftToRight);
+    }
+
+    /**
+     @brief Count the number of right values in the set. See countLeft() about concurrent changes.
+     */
+    int countRight() const noexcept
+    {
+        return countKeys(m_RightToLeft);
+    }
+
+    /**
+     @brief Count the number of pairs in the set. See countLeft() about concurrent changes.
+     */
+    int count() const noexcept
+    {
+        return countKeys(m_RightToLeft);
+    }
+
+private:
+    size_t rightRank(size_t rightIndex) const noexcept
+    {
+        return m_LeftToRight.size() + rightIndex;
+    }
+
+    template <typename ShardsType> static int countKeys(const ShardsType &shards) noexcept
+    {
+        int count = 0;
+        for (size_t index = 0; index < shards.size(); ++index)
+        {
+            std::shared_lock lock(shards[index].m_Mutex);
+            count += (int)shards[index].m_Map.size();
+        }
+        return count;
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A many-to-many set that many threads can read and change at once. See `ConcurrentOneToMany` for how it is locked.
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy = StdStoragePolicy> class ConcurrentManyToMany
+{
+    using RightVector = std::vector<RightType>;
+    using LeftVector = std::vector<LeftType>;
+    using LeftToRightMap = typename StoragePolicy::template Map<LeftType, RightVector>;
+    using RightToLeftMap = typename StoragePolicy::template Map<RightType, LeftVector>;
+
+    ConcurrentShards<LeftType, LeftToRightMap> m_LeftToRight;
+    ConcurrentShards<RightType, RightToLeftMap> m_RightToLeft;
+    std::atomic<int> m_Count;
+
+public:
+    /**
+     @brief Construct an empty set.
+     @param shardCount The number of shards for each side, or 0 for four per hardware thread.
+     */
+    explicit ConcurrentManyToMany(int shardCount = 0) noexcept
+    : m_LeftToRight(resolveShardCount(shardCount)), m_RightToLeft(resolveShardCount(shardCount)), m_Count(0)
+    {}
+
+    /**
+     @brief Add a pair to the set. If the pair is already in the set, nothing happens.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void insert(const LeftType &left, const RightType &right) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        size_t right_index = m_RightToLeft.indexOf(right);
+        ShardLockSet locks;
+        locks.add(left_index, &m_LeftToRight[left_index].m_Mutex);
+        locks.add(rightRank(right_index), &m_RightToLeft[right_index].m_Mutex);
+        locks.lock();
+
+        if (insertIntoSortedVector(&m_LeftToRight[left_index].m_Map.try_emplace(left).first->second, right) != 0)
+        {
+            insertIntoSortedVector(&m_RightToLeft[right_index].m_Map.try_emplace(right).first->second, left);
+            m_Count += 1;
+        }
+    }
+
+    /**
+     @brief Erase a pair from the set. If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void erase(const LeftType &left, const RightType &right) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        size_t right_index = m_RightToLeft.indexOf(right);
+        ShardLockSet locks;
+        locks.add(left_index, &m_LeftToRight[left_index].m_Mutex);
+        locks.add(rightRank(right_index), &m_RightToLeft[right_index].m_Mutex);
+        locks.lock();
+
+        auto &l2r_map = m_LeftToRight[left_index].m_Map;
+        auto l2r_it = l2r_map.find(left);
+        if (l2r_it == l2r_map.end() || !containsInSortedVector(&l2r_it->second, right))
+            return;
+        eraseFromMappedVector(&l2r_map, left, right);
+        eraseFromMappedVector(&m_RightToLeft[right_index].m_Map, right, left);
+        m_Count -= 1;
+    }
+
+    /**
+     @brief Erase all pairs with the given left value.
+     @param left The left side of the pairs to erase.
+     */
+    void eraseLeft(const LeftType &left) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        auto &left_shard = m_LeftToRight[left_index];
+        while (true)
+        {
+            RightVector rights = findRight(left);
+            if (rights.empty())
+                return;
+
+            ShardLockSet locks;
+            locks.add(left_index, &left_shard.m_Mutex);
+            for (auto &right : rights)
+            {
+                size_t right_index = m_RightToLeft.indexOf(right);
+                locks.add(rightRank(right_index), &m_RightToLeft[right_index].m_Mutex);
+            }
+            locks.lock();
+
+            auto l2r_it = left_shard.m_Map.find(left);
+            if (l2r_it == left_shard.m_Map.end() || !(l2r_it->second == rights))
+                continue;
+
+            for (auto &right : rights)
+                eraseFromMappedVector(&m_RightToLeft[m_RightToLeft.indexOf(right)].m_Map, right, left);
+            left_shard.m_Map.erase(l2r_it);
+            m_Count -= (int)rights.size();
+            return;
+        }
+    }
+
+    /**
+     @brief Erase all pairs with the given right value.
+     @param right The right side of the pairs to erase.
+     */
+    void eraseRight(const RightType &right) noexcept
+    {
+        size_t right_index = m_RightToLeft.indexOf(right);
+        auto &right_shard = m_RightToLeft[right_index];
+        while (true)
+        {
+            LeftVector lefts = findLeft(right);
+            if (lefts.empty())
+                return;
+
+            ShardLockSet locks;
+            for (auto &left : lefts)
+            {
+                size_t left_index = m_LeftToRight.indexOf(left);
+                locks.add(left_index, &m_LeftToRight[left_index].m_Mutex);
+            }
+            locks.add(rightRank(right_index), &right_shard.m_Mutex);
+            locks.lock();
+
+            auto r2l_it = right_shard.m_Map.find(right);
+            if (r2l_it == right_shard.m_Map.end() || !(r2l_it->second == lefts))
+                continue;
+
+            for (auto &left : lefts)
+                eraseFromMappedVector(&m_LeftToRight[m_LeftToRight.indexOf(left)].m_Map, left, right);
+            right_shard.m_Map.erase(r2l_it);
+            m_Count -= (int)lefts.size();
+            return;
+        }
+    }
+
+    /**
+     @brief Erase all pairs from the set.
+     */
+    void clear() noexcept
+    {
+        ShardLockSet locks;
+        for (size_t index = 0; index < m_LeftToRight.size(); ++index)
+            locks.add(index, &m_LeftToRight[index].m_Mutex);
+        for (size_t index = 0; index < m_RightToLeft.size(); ++index)
+            locks.add(rightRank(index), &m_RightToLeft[index].m_Mutex);
+        locks.lock();
+
+        for (size_t index = 0; index < m_LeftToRight.size(); ++index)
+            m_LeftToRight[index].m_Map.clear();
+        for (size_t index = 0; index < m_RightToLeft.size(); ++index)
+            m_RightToLeft[index].m_Map.clear();
+        m_Count = 0;
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    bool contains(const LeftType &left, const RightType &right) const noexcept
+    {
+        auto &shard = m_LeftToRight[m_LeftToRight.indexOf(left)];
+        std::shared_lock lock(shard.m_Mutex);
+        auto l2r_it = shard.m_Map.find(left);
+        return l2r_it != shard.m_Map.end() && containsInSortedVector(&l2r_it->second, right);
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    bool containsLeft(const LeftType &left) const noexcept
+    {
+        auto &shard = m_LeftToRight[m_LeftToRight.indexOf(left)];
+        std::shared_lock lock(shard.m_Mutex);
+        return shard.m_Map.contains(left);
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    bool containsRight(const RightType &right) const noexcept
+    {
+        auto &shard = m_RightToLeft[m_RightToLeft.indexOf(right)];
+        std::shared_lock lock(shard.m_Mutex);
+        return shard.m_Map.contains(right);
+    }
+
+    /**
+     @brief Find all right values that are paired with this left value.
+     @param left The left side of the pairs to look for.
+     @return A copy of the right values, sorted.
+     */
+    std::vector<RightType> findRight(const LeftType &left) const noexcept
+    {
+        auto &shard = m_LeftToRight[m_LeftToRight.indexOf(left)];
+        std::shared_lock lock(shard.m_Mutex);
+        auto l2r_it = shard.m_Map.find(left);
+        if (l2r_it == shard.m_Map.end())
+            return std::vector<RightType>();
+        return l2r_it->second;
+    }
+
+    /**
+     @brief Find all left values that are paired with this right value.
+     @param right The right side of the pairs to look for.
+     @return A copy of the left values, sorted.
+     */
+    std::vector<LeftType> findLeft(const RightType &right) const noexcept
+    {
+        auto &shard = m_RightToLeft[m_RightToLeft.indexOf(right)];
+        std::shared_lock lock(shard.m_Mutex);
+        auto r2l_it = shard.m_Map.find(right);
+        if (r2l_it == shard.m_Map.end())
+            return std::vector<LeftType>();
+        return r2l_it->second;
+    }
+
+    /**
+     @brief Count the number of left values in the set. Shards are counted one after the other, so while other threads
+     change the set, the count is approximate.
+     */
+    int countLeft() const noexcept
+    {
+        return countKeys(m_LeftToRight);
+    }
+
+    /**
+     @brief Count the number of right values in the set. See countLeft() about concurrent changes.
+     */
+    int countRight() const noexcept
+    {
+        return countKeys(m_RightToLeft);
+    }
+
+    /**
+     @brief Count the number of pairs in the set.
+     */
+    int count() const noexcept
+    {
+        return m_Count;
+    }
+
+private:
+    size_t rightRank(size_t rightIndex) const noexcept
+    {
+        return m_LeftToRight.size() + rightIndex;
+    }
+
+    template <typename ShardsType> static int countKeys(const ShardsType &shards) noexcept
+    {
+        int count = 0;
+        for (size_t index = 0; index < shards.size(); ++index)
+        {
+            std::shared_lock lock(shards[index].m_Mutex);
+            count += (int)shards[index].m_Map.size();
+        }
+        return count;
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A one-to-one set that many threads can read and change at once. See `ConcurrentOneToMany` for how it is locked.
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy = StdStoragePolicy> class ConcurrentOneToOne
+{
+    using LeftToRightMap = typename StoragePolicy::template Map<LeftType, RightType>;
+    using RightToLeftMap = typename StoragePolicy::template Map<RightType, LeftType>;
+
+    ConcurrentShards<LeftType, LeftToRightMap> m_LeftToRight;
+    ConcurrentShards<RightType, RightToLeftMap> m_RightToLeft;
+
+public:
+    /**
+     @brief Construct an empty set.
+     @param shardCount The number of shards for each side, or 0 for four per hardware thread.
+     */
+    explicit ConcurrentOneToOne(int shardCount = 0) noexcept
+    : m_LeftToRight(resolveShardCount(shardCount)), m_RightToLeft(resolveShardCount(shardCount))
+    {}
+
+    /**
+     @brief Add a pair to the set. Pairs that have either value are erased first.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void insert(const LeftType &left, const RightType &right) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        size_t right_index = m_RightToLeft.indexOf(right);
+        auto &left_shard = m_LeftToRight[left_index];
+        auto &right_shard = m_RightToLeft[right_index];
+        while (true)
+        {
+            std::optional<RightType> old_right = findRight(left);
+            if (old_right && *old_right == right)
+                return;
+            std::optional<LeftType> old_left = findLeft(right);
+
+            ShardLockSet locks;
+            locks.add(left_index, &left_shard.m_Mutex);
+            locks.add(rightRank(right_index), &right_shard.m_Mutex);
+            size_t old_left_index = old_left ? m_LeftToRight.indexOf(*old_left) : 0;
+            size_t old_right_index = old_right ? m_RightToLeft.indexOf(*old_right) : 0;
+            if (old_left)
+                locks.add(old_left_index, &m_LeftToRight[old_left_index].m_Mutex);
+            if (old_right)
+                locks.add(rightRank(old_right_index), &m_RightToLeft[old_right_index].m_Mutex);
+            locks.lock();
+
+            // Start over if another thread changed either pair before the locks were taken
+            auto l2r_it = left_shard.m_Map.find(left);
+            auto r2l_it = right_shard.m_Map.find(right);
+            if (!isUnchanged(l2r_it, left_shard.m_Map.end(), old_right) ||
+                !isUnchanged(r2l_it, right_shard.m_Map.end(), old_left))
+                continue;
+
+            if (old_right)
+            {
+                m_RightToLeft[old_right_index].m_Map.erase(*old_right);
+                l2r_it->second = right;
+            }
+            else
+            {
+                left_shard.m_Map.try_emplace(left, right);
+            }
+
+            if (old_left)
+            {
+                m_LeftToRight[old_left_index].m_Map.erase(*old_left);
+                r2l_it->second = left;
+            }
+            else
+            {
+                right_shard.m_Map.try_emplace(right, left);
+            }
+            return;
+        }
+    }
+
+    /**
+     @brief Erase a pair from the set. If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void erase(const LeftType &left, const RightType &right) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        size_t right_index = m_RightToLeft.indexOf(right);
+        ShardLockSet locks;
+        locks.add(left_index, &m_LeftToRight[left_index].m_Mutex);
+        locks.add(rightRank(right_index), &m_RightToLeft[right_index].m_Mutex);
+        locks.lock();
+
+        auto &l2r_map = m_LeftToRight[left_index].m_Map;
+        auto l2r_it = l2r_map.find(left);
+        if (l2r_it == l2r_map.end() || !(l2r_it->second == right))
+            return;
+        l2r_map.erase(l2r_it);
+        m_RightToLeft[right_index].m_Map.erase(right);
+    }
+
+    /**
+     @brief Erase the pair with the given left value.
+     @param left The left side of the pair to erase.
+     */
+    void eraseLeft(const LeftType &left) noexcept
+    {
+        while (true)
+        {
+            std::optional<RightType> right = findRight(left);
+            if (!right)
+                return;
+            if (eraseIfUnchanged(left, *right))
+                return;
+        }
+    }
+
+    /**
+     @brief Erase the pair with the given right value.
+     @param right The right side of the pair to erase.
+     */
+    void eraseRight(const RightType &right) noexcept
+    {
+        while (true)
+        {
+            std::optional<LeftType> left = findLeft(right);
+            if (!left)
+                return;
+            if (eraseIfUnchanged(*left, right))
+                return;
+        }
+    }
+
+    /**
+     @brief Erase all pairs from the set.
+     */
+    void clear() noexcept
+    {
+        ShardLockSet locks;
+        for (size_t index = 0; index < m_LeftToRight.size(); ++index)
+            locks.add(index, &m_LeftToRight[index].m_Mutex);
+        for (size_t index = 0; index < m_RightToLeft.size(); ++index)
+            locks.add(rightRank(index), &m_RightToLeft[index].m_Mutex);
+        locks.lock();
+
+        for (size_t index = 0; index < m_LeftToRight.size(); ++index)
+            m_LeftToRight[index].m_Map.clear();
+        for (size_t index = 0; index < m_RightToLeft.size(); ++index)
+            m_RightToLeft[index].m_Map.clear();
+    }
+
+    /**
+     @brief Test whether a given pair is in the set.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    bool contains(const LeftType &left, const RightType &right) const noexcept
+    {
+        std::optional<RightType> found = findRight(left);
+        return found && *found == right;
+    }
+
+    /**
+     @brief Test whether any pair in the set has this left value.
+     @param left The left side of the pair to look for.
+     */
+    bool containsLeft(const LeftType &left) const noexcept
+    {
+        return findRight(left).has_value();
+    }
+
+    /**
+     @brief Test whether any pair in the set has this right value.
+     @param right The right side of the pair to look for.
+     */
+    bool containsRight(const RightType &right) const noexcept
+    {
+        return findLeft(right).has_value();
+    }
+
+    /**
+     @brief Find the right value that is paired with this left value.
+     @param left The left side of the pair to look for.
+     @return The right value, or nothing.
+     */
+    std::optional<RightType> findRight(const LeftType &left) const noexcept
+    {
+        auto &shard = m_LeftToRight[m_LeftToRight.indexOf(left)];
+        std::shared_lock lock(shard.m_Mutex);
+        auto l2r_it = shard.m_Map.find(left);
+        if (l2r_it == shard.m_Map.end())
+            return std::nullopt;
+        return l2r_it->second;
+    }
+
+    /**
+     @brief Find the right value that is paired with this left value.
+     @param left The left side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The right value.
+     */
+    RightType findRight(const LeftType &left, const RightType &notFoundValue) const noexcept
+    {
+        return findRight(left).value_or(notFoundValue);
+    }
+
+    /**
+     @brief Find the left value that is paired with this right value.
+     @param right The right side of the pair to look for.
+     @return The left value, or nothing.
+     */
+    std::optional<LeftType> findLeft(const RightType &right) const noexcept
+    {
+        auto &shard = m_RightToLeft[m_RightToLeft.indexOf(right)];
+        std::shared_lock lock(shard.m_Mutex);
+        auto r2l_it = shard.m_Map.find(right);
+        if (r2l_it == shard.m_Map.end())
+            return std::nullopt;
+        return r2l_it->second;
+    }
+
+    /**
+     @brief Find the left value that is paired with this right value.
+     @param right The right side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The left value.
+     */
+    LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
+    {
+        return findLeft(right).value_or(notFoundValue);
+    }
+
+    /**
+     @brief Count the number of pairs in the set. Shards are counted one after the other, so while other threads change
+     the set, the count is approximate.
+     */
+    int count() const noexcept
+    {
+        int count = 0;
+        for (size_t index = 0; index < m_LeftToRight.size(); ++index)
+        {
+            std::shared_lock lock(m_LeftToRight[index].m_Mutex);
+            count += (int)m_LeftToRight[index].m_Map.size();
+        }
+        return count;
+    }
+
+private:
+    size_t rightRank(size_t rightIndex) const noexcept
+    {
+        return m_LeftToRight.size() + rightIndex;
+    }
+
+    // Whether a key still has the value it had before the locks were taken, or still has none
+    template <typename IteratorType, typename ValueType>
+    static bool isUnchanged(IteratorType it, IteratorType end, const std::optional<ValueType> &value) noexcept
+    {
+        if (!value)
+            return it == end;
+        return it != end && it->second == *value;
+    }
+
+    // Erase a pair that was found without locks. Returns false if it changed in the meantime.
+    bool eraseIfUnchanged(const LeftType &left, const RightType &right) noexcept
+    {
+        size_t left_index = m_LeftToRight.indexOf(left);
+        size_t right_index = m_RightToLeft.indexOf(right);
+        ShardLockSet locks;
+        locks.add(left_index, &m_LeftToRight[left_index].m_Mutex);
+        locks.add(rightRank(right_index), &m_RightToLeft[right_index].m_Mutex);
+        locks.lock();
+
+        auto &l2r_map = m_LeftToRight[left_index].m_Map;
+        auto l2r_it = l2r_map.find(left);
+        if (l2r_it == l2r_map.end() || !(l2r_it->second == right))
+            return false;
+        l2r_map.erase(l2r_it);
+        m_RightToLeft[right_index].m_Map.erase(right);
+        return true;
+    }
+};
+
+// -------- Versioned relations --------
+
+/// @cond
+// One version of a VersionedOneToMany. Versions share the right vectors of the left values that did not change
+// between them.
+template <typename LeftType, typename RightType, typename StoragePolicy> struct VersionedOneToManyState
+{
+    using RightVector = std::vector<RightType>;
+    using LeftToRightMap = typename StoragePolicy::template Map<LeftType, std::shared_ptr<RightVector>>;
+    using RightToLeftMap = typename StoragePolicy::template Map<RightType, LeftType>;
+
+    LeftToRightMap m_LeftToRight;
+    RightToLeftMap m_RightToLeft;
+
+    std::span<const RightType> findRight(const LeftType &left) const noexcept
+    {
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it == m_LeftToRight.end())
+            return std::span<const RightType>();
+        return std::span<const RightType>(l2r_it->second->data(), l2r_it->second->size());
+    }
+
+    LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        if (r2l_it == m_RightToLeft.end())
+            return notFoundValue;
+        return r2l_it->second;
+    }
+
+    bool contains(const LeftType &left, const RightType &right) const noexcept
+    {
+        auto r2l_it = m_RightToLeft.find(right);
+        return r2l_it != m_RightToLeft.end() && r2l_it->second == left;
+    }
+};
+
+// Whether this is the only reference to an object, so that it can be changed in place. Other threads only ever drop
+// their references to it, so once the count is 1 it stays 1, and the fence makes their last reads happen before our
+// writes.
+template <typename T> bool isSoleOwner(const std::shared_ptr<T> &pointer) noexcept
+{
+    if (pointer.use_count() != 1)
+        return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+/// @endcond
+
+/**
+ A one-to-many set that one thread changes, while other threads read consistent snapshots of it without ever taking a
+ lock.
+ `snapshot()` takes constant time: it shares the current version of the set. The first change after that copies the
+ two hash tables, but not the right values: each left value keeps sharing its sorted array with the older versions
+ until it is changed itself. A version is freed as soon as the last snapshot of it is released.
+ Only the thread that changes the set may call its member functions. Snapshots can be copied and read from any thread.
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy = StdStoragePolicy> class VersionedOneToMany
+{
+    using State = VersionedOneToManyState<LeftType, RightType, StoragePolicy>;
+    using RightVector = typename State::RightVector;
+    using LeftToRightMap = typename State::LeftToRightMap;
+    using RightToLeftMap = typename State::RightToLeftMap;
+
+    std::shared_ptr<State> m_State;
+
+public:
+    /**
+     @brief A pair of (left, right) values.
      */
     struct Pair
     {
         LeftType left;
         RightType right;
-        Pair(LeftType left, RightType right) : left(left), right(right)
-        {
-        }
+        Pair(LeftType left, RightType right)
+        : left(left), right(right)
+        {}
         Pair()
-        {
-        }
+        {}
     };
 
     /**
-     @brief Default constructor.
-     */
-    ManyToMany() noexcept
-    : m_Count(0)
-    {}
-
-    /**
-     @brief Insert a pair into the set.
-     @param pair The pair to insert.
+     @brief An immutable version of the set. It does not change when the set changes, and it is cheap to copy.
      */
-    void insert(const Pair &pair) noexcept
+    class Snapshot
     {
-        insert(pair.left, pair.right);
-    }
+        std::shared_ptr<const State> m_State;
 
-    /**
-     @brief Insert a pair into the set.
-     @param left The left side of the pair to add.
-     @param right The right side of the pair to add.
-     */
-    void insert(const LeftType &left, const RightType &right) noexcept
-    {
-        auto l2r_it = m_LeftToRight.find(left);
-        if (l2r_it != m_LeftToRight.end())
+    public:
+        /**
+         @brief Construct an empty snapshot.
+         */
+        Snapshot() noexcept
+        : m_State(std::make_shared<const State>())
+        {}
+
+        /// @cond
+        explicit Snapshot(std::shared_ptr<const State> state) noexcept
+        : m_State(std::move(state))
+        {}
+        /// @endcond
+
+        /**
+         @brief Test whether a given pair is in the snapshot.
+         @param left The left side of the pair to look for.
+         @param right The right side of the pair to look for.
+         */
+        bool contains(const LeftType &left, const RightType &right) const noexcept
         {
-            auto l2r_vec = l2r_it->second;
-            if (containsInSortedVector(l2r_vec, right))
-                return; // We already have this pair;
+            return m_State->contains(left, right);
         }
 
-        auto l2r_vec = m_LeftToRight[left]; // Will insert if it isn't already there.
-        if (l2r_vec == nullptr)
+        /**
+         @brief Test whether any pair in the snapshot has this left value.
+         @param left The left side of the pair to look for.
+         */
+        bool containsLeft(const LeftType &left) const noexcept
         {
-            l2r_vec = new std::vector<RightType>();
-            m_LeftToRight[left] = l2r_vec;
+            return m_State->m_LeftToRight.contains(left);
         }
-        insertIntoSortedVector(l2r_vec, right);
 
-        auto r2l_vec = m_RightToLeft[right]; // Will insert if it isn't already there.
-        if (r2l_vec == nullptr)
+        /**
+         @brief Test whether any pair in the snapshot has this right value.
+         @param right The right side of the pair to look for.
+         */
+        bool containsRight(const RightType &right) const noexcept
         {
-            r2l_vec = new std::vector<LeftType>();
-            m_RightToLeft[right] = r2l_vec;
+            return m_State->m_RightToLeft.contains(right);
         }
-        insertIntoSortedVector(r2l_vec, left);
-        m_Count += 1;
-    }
 
-    /**
-     @brief Insert multiple  pairs into the set.
-     This is faster than inserting the pairs one by one.
-     @param pairs The pairs to add.
-     */
-    void insert(const std::vector<Pair> &pairs) noexcept
-    {
-        if(0 == pairs.size())
-            return;
+        /**
+         @brief Find all right values that are paired with this left value.
+         If nothing is found, you will get an empty span. The right values are sorted.
+         The span stays valid as long as the snapshot, or a copy of it, exists.
+         @param left The left side of the pair to look for.
+         @return The span of right values.
+         */
+        std::span<const RightType> findRight(const LeftType &left) const noexcept
+        {
+            return m_State->findRight(left);
+        }
 
-        auto compare_left_then_right = [](const Pair &a, const Pair &b)
+        /**
+         @brief Find the single left value that is paired with this right value.
+         @param right The right side of the pair to look for.
+         @param notFoundValue The value to return if no matching pair is found.
+         @return The singular left value.
+         */
+        LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
         {
-            if(a.left < b.left) return true;
-            if(b.left < a.left) return false;
-            return a.right < b.right;
-        };
+            return m_State->findLeft(right, notFoundValue);
+        }
 
-        auto compare_right_then_left = [](const Pair &a, const Pair &b)
+        /**
+         @brief Count the number of left values in the snapshot.
+         */
+        int countLeft() const noexcept
         {
-            if(a.right < b.right) return true;
-            if(b.right < a.right) return false;
-            return a.left < b.left;
-        };
+            return (int)m_State->m_LeftToRight.size();
+        }
 
-        std::vector<Pair> pairs_to_insert = pairs;  // Deep copy...
-        std::sort(pairs_to_insert.begin(), pairs_to_insert.end(), compare_left_then_right); // ...so I can sort
+        /**
+         @brief Count the number of right values in the snapshot.
+         */
+        int countRight() const noexcept
+        {
+            return (int)m_State->m_RightToLeft.size();
+        }
 
-        std::vector<RightType> right_to_insert;
-        auto it_end = pairs_to_insert.cend();
-        for (auto it = pairs_to_insert.cbegin(); it != it_end; )
+        /**
+         @brief Count the number of pairs in the snapshot.
+         */
+        int count() const noexcept
         {
-            // Collect all right values that have the same left value
-            right_to_insert.clear();
-            auto left = it->left;
-            while(it != it_end && it->left == left)
-            {
-                right_to_insert.push_back(it->right);
-                it++;
-            }
+            return (int)m_State->m_RightToLeft.size();
+        }
 
-            // Insert them in one go
-            auto l2r_it = m_LeftToRight.find(left);
-            if (l2r_it != m_LeftToRight.end())
-            {
-                auto l2r_vec = l2r_it->second;
-                auto temp = *l2r_vec;
-                m_Count -= l2r_vec->size();
-                insertIntoSortedVector(&temp, &right_to_insert, l2r_vec);
-                m_Count += l2r_vec->size();
-            }
-            else
-            {
-                // insert new value
-                auto l2r_vec = new std::vector<RightType>(right_to_insert);
-                m_LeftToRight[left] = l2r_vec;
-                m_Count += l2r_vec->size();
-            }
+        /**
+         @brief List all left elements.
+         @return A helper object to iterate over left elements using range-based-for.
+         */
+        UnorderedMapHelper<LeftToRightMap> allLeft() const noexcept
+        {
+            return UnorderedMapHelper<LeftToRightMap>(&m_State->m_LeftToRight);
         }
 
-        std::sort(pairs_to_insert.begin(), pairs_to_insert.end(), compare_right_then_left);
+        /**
+         @brief List all right elements.
+         @return A helper object to iterate over right elements using range-based-for.
+         */
+        UnorderedMapHelper<RightToLeftMap> allRight() const noexcept
+        {
+            return UnorderedMapHelper<RightToLeftMap>(&m_State->m_RightToLeft);
+        }
 
-        std::vector<LeftType> left_to_insert;
-        it_end = pairs_to_insert.cend();
-        for (auto it = pairs_to_insert.cbegin(); it != it_end; )
+        /**
+         @brief A range-based-for compatible iterator.
+         */
+        class Iterator
         {
-            // Collect all right values that have the same left value
-            left_to_insert.clear();
-            auto right = it->right;
-            while(it != it_end && it->right == right)
+            /// @cond
+          public:
+            typename LeftToRightMap::const_iterator l2r_it;
+            typename LeftToRightMap::const_iterator l2r_it_end;
+            typename RightVector::const_iterator l2r_vec_it;
+
+            inline Pair operator*() const noexcept
             {
-                left_to_insert.push_back(it->left);
-                it++;
+                return Pair(l2r_it->first, *l2r_vec_it);
             }
 
-            // Insert them in one go
-            auto r2l_it = m_RightToLeft.find(right);
-            if (r2l_it != m_RightToLeft.end())
+            inline bool operator==(const Iterator &other) const noexcept
             {
-                auto r2l_vec = r2l_it->second;
-                auto temp = *r2l_vec;
-                insertIntoSortedVector(&temp, &left_to_insert, r2l_vec);
+                return l2r_it == other.l2r_it;
             }
-            else
+
+            inline bool operator!=(const Iterator &other) const noexcept
             {
-                // insert new value
-                auto r2l_vec = new std::vector<LeftType>(left_to_insert);
-                m_RightToLeft[right] = r2l_vec;
+                return l2r_it != other.l2r_it;
             }
-        }
-    }
-
-    /**
-     @brief Erase a pair from the set.
-     If there is no matching pair in the set, nothing happens.
-     @param pair The pair to erase.
-     */
-    void erase(const Pair &pair) noexcept
-    {
-        erase(pair.left, pair.right);
-    }
 
-    /**
-     @brief Erase a pair from the set.
-     If there is no matching pair in the set, nothing happens.
-     @param left The left side of the pair to erase.
-     @param right The right side of the pair to erase.
-     */
-    void erase(const LeftType &left, const RightType &right) noexcept
-    {
-        auto l2r_it = m_LeftToRight.find(left);
-        if (l2r_it != m_LeftToRight.end())
-        {
-            auto r2l_it = m_RightToLeft.find(right);
-            if (r2l_it != m_RightToLeft.end())
+            inline Iterator operator++() noexcept
             {
-                auto l2r_vec = l2r_it->second;
-                auto r2l_vec = r2l_it->second;
-
-                eraseFromSortedVector(l2r_vec, right);
-                eraseFromSortedVector(r2l_vec, left);
-
-                if(l2r_vec->size() == 0)
-                {
-                    m_LeftToRight.erase(l2r_it);
-                    delete l2r_vec;
-                }
-
-                if(r2l_vec->size() == 0)
+                l2r_vec_it++;
+                if (l2r_vec_it == l2r_it->second->cend())
                 {
-                    m_RightToLeft.erase(r2l_it);
-                    delete r2l_vec;
+                    l2r_it++;
+                    if (l2r_it != l2r_it_end)
+                    {
+                        l2r_vec_it = l2r_it->second->cbegin();
+                    }
                 }
-                
-                m_Count -= 1;
+                return *this;
             }
-        }
-    }
+            /// @endcond
+        };
 
-    /**
-     @brief Erase all pairs with the given left value.
-     If there is no matching pair in the set, nothing happens.
-     @param left The left side of the pairs to erase.
-     */
-    void eraseLeft(const LeftType &left) noexcept
-    {
-        auto l2r_it = m_LeftToRight.constFind(left);
-        if (l2r_it != m_LeftToRight.end())
+        /**
+         @brief Required member to get range-based-for.
+         @return an Iterator set to the first pair in the snapshot.
+         */
+        Iterator begin() const noexcept
         {
-            auto l2r_vec = l2r_it->second;
-            for (auto right : l2r_vec)
+            Iterator it;
+            it.l2r_it = m_State->m_LeftToRight.cbegin();
+            it.l2r_it_end = m_State->m_LeftToRight.cend();
+            if (it.l2r_it != it.l2r_it_end)
             {
-                auto r2l_it = m_RightToLeft.constFind(right);
-                auto r2l_vec = r2l_it->second;
-                eraseFromSortedVector(*r2l_vec, left);
-                m_Count -= 1;
-                if (r2l_vec->size() == 0)
-                {
-                    m_RightToLeft.erase(r2l_it);
-                    delete r2l_vec;
-                }
+                it.l2r_vec_it = it.l2r_it->second->cbegin();
             }
-            m_LeftToRight.erase(l2r_it);
-            delete l2r_vec;
+            return it;
         }
-    }
+
+        /**
+         @brief Required member to get range-based-for.
+         @return an Iterator set to one after the last pair in the snapshot.
+         */
+        Iterator end() const noexcept
+        {
+            Iterator it;
+            it.l2r_it = m_State->m_LeftToRight.cend();
+            return it;
+        }
+    };
 
     /**
-     @brief Erase the pair with the given right value.
-     If there is no matching pair in the set, nothing happens.
-     @param right The right side of the pairs to erase.
+     @brief Default constructor.
      */
-    void eraseRight(const RightType &right) noexcept
+    VersionedOneToMany() noexcept
+    : m_State(std::make_shared<State>())
+    {}
+
+    /**
+     @brief Take a snapshot of the current version of the set, in constant time.
+     @return The snapshot. Later changes to the set do not show up in it.
+     */
+    Snapshot snapshot() const noexcept
     {
-        auto r2l_it = m_RightToLeft.constFind(right);
-        if (r2l_it != m_RightToLeft.end())
-        {
-            auto r2l_vec = r2l_it->second;
-            for (auto left : r2l_vec)
-            {
-                auto l2r_it = m_LeftToRight.constFind(left);
-                auto l2r_vec = l2r_it->second;
-                eraseFromSortedVector(*l2r_vec, right);
-                m_Count -= 1;
-                if (l2r_vec->size() == 0)
-                {
-                    m_LeftToRight.erase(l2r_it);
-                    delete l2r_vec;
-                }
-            }
-            m_RightToLeft.erase(r2l_it);
-            delete r2l_vec;
-        }
+        return Snapshot(m_State);
     }
 
     /**
-     @brief Erase multiple  pairs from the set.
-     This is faster than erasing the pairs one by one.
-     @param pairs The pairs to erase.
+     @brief Insert a pair into the set.
+     The rule for one-to-many is that if the right value is part of an existing pair in the set, that relation will be erased.
+     @param left The left side of the pair to add.
+     @param right The right side of the pair to add.
      */
-    void erase(const std::vector<Pair> &pairs) noexcept
+    void insert(const LeftType &left, const RightType &right) noexcept
     {
-        if(0 == pairs.size())
+        if (m_State->contains(left, right))
             return;
-
-        auto compare_left_then_right = [](const Pair &a, const Pair &b)
-        {
-            if(a.left < b.left) return true;
-            if(b.left < a.left) return false;
-            return a.right < b.right;
-        };
-
-        auto compare_right_then_left = [](const Pair &a, const Pair &b)
-        {
-            if(a.right < b.right) return true;
-            if(b.right < a.right) return false;
-            return a.left < b.left;
-        };
-
-        std::vector<Pair> pairs_to_insert = pairs;  // Deep copy...
-        std::sort(pairs_to_insert.begin(), pairs_to_insert.end(), compare_left_then_right); // ...so I can sort
-
-        std::vector<RightType> right_to_insert;
-        auto it_end = pairs_to_insert.cend();
-        for (auto it = pairs_to_insert.cbegin(); it != it_end; )
-        {
-            // Collect all right values that have the same left value
-            right_to_insert.clear();
-            auto left = it->left;
-            while(it != it_end && it->left == left)
-            {
-                right_to_insert.push_back(it->right);
-                it++;
-            }
-
-            // Erase them in one go
-            auto l2r_it = m_LeftToRight.find(left);
-            if (l2r_it != m_LeftToRight.end())
-            {
-                auto l2r_vec = l2r_it->second;
-                auto temp = *l2r_vec;
-                m_Count -= l2r_vec->size();
-                eraseFromSortedVector(&temp, &right_to_insert, l2r_vec);
-                m_Count += l2r_vec->size();
-            }
+        State *state = writableState();
+        auto r2l_it = state->m_RightToLeft.find(right);
+        if (r2l_it != state->m_RightToLeft.end())
+        {
+            eraseFromRights(state, r2l_it->second, right);
+            r2l_it->second = left;
         }
-
-        std::sort(pairs_to_insert.begin(), pairs_to_insert.end(), compare_right_then_left);
-
-        std::vector<LeftType> left_to_insert;
-        it_end = pairs_to_insert.cend();
-        for (auto it = pairs_to_insert.cbegin(); it != it_end; )
+        else
         {
-            // Collect all right values that have the same left value
-            left_to_insert.clear();
-            auto right = it->right;
-            while(it != it_end && it->right == right)
-            {
-                left_to_insert.push_back(it->left);
-                it++;
-            }
-
-            // Erase them in one go
-            auto r2l_it = m_RightToLeft.find(right);
-            if (r2l_it != m_RightToLeft.end())
-            {
-                auto r2l_vec = r2l_it->second;
-                auto temp = *r2l_vec;
-                eraseFromSortedVector(&temp, &left_to_insert, r2l_vec);
-            }
+            state->m_RightToLeft.try_emplace(right, left);
         }
+        insertIntoSortedVector(writableRights(state, left), right);
     }
 
     /**
-     @brief Erase all pairs from the set.
+     @brief Erase a pair from the set. If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair to erase.
+     @param right The right side of the pair to erase.
      */
-    void clear() noexcept
+    void erase(const LeftType &left, const RightType &right) noexcept
     {
-        m_RightToLeft.clear();
-        m_LeftToRight.clear();
+        if (!m_State->contains(left, right))
+            return;
+        State *state = writableState();
+        state->m_RightToLeft.erase(right);
+        eraseFromRights(state, left, right);
     }
 
     /**
-     @brief Test whether a given pair is in the set.
-     @param pair The pair to look for.
+     @brief Erase all pairs with the given left value.
+     @param left The left side of the pairs to erase.
      */
-    bool contains(const Pair &pair) const noexcept
+    void eraseLeft(const LeftType &left) noexcept
     {
-        return contains(pair.left, pair.right);
+        if (!m_State->m_LeftToRight.contains(left))
+            return;
+        State *state = writableState();
+        auto l2r_it = state->m_LeftToRight.find(left);
+        for (auto &right : *l2r_it->second)
+            state->m_RightToLeft.erase(right);
+        state->m_LeftToRight.erase(l2r_it);
+    }
+
+    /**
+     @brief Erase the pair with the given right value.
+     @param right The right side of the pair to erase.
+     */
+    void eraseRight(const RightType &right) noexcept
+    {
+        auto r2l_it = m_State->m_RightToLeft.find(right);
+        if (r2l_it != m_State->m_RightToLeft.end())
+            erase(LeftType(r2l_it->second), right);
+    }
+
+    /**
+     @brief Erase all pairs from the set. Snapshots keep their version.
+     */
+    void clear() noexcept
+    {
+        m_State = std::make_shared<State>();
     }
 
     /**
@@ -1072,25 +8113,7 @@ public:
      */
     bool contains(const LeftType &left, const RightType &right) const noexcept
     {
-        auto l2r_it = m_LeftToRight.find(left);
-        if (l2r_it != m_LeftToRight.end())
-        {
-            auto r2l_it = m_RightToLeft.find(right);
-            if (r2l_it != m_RightToLeft.end())
-            {
-                auto l2r_vec = l2r_it->second;
-                auto r2l_vec = r2l_it->second;
-                if (l2r_vec->size() < r2l_vec->size())
-                {
-                    return containsInSortedVector(l2r_vec, right);
-                }
-                else
-                {
-                    return containsInSortedVector(r2l_vec, left);
-                }
-            }
-        }
-        return false;
+        return m_State->contains(left, right);
     }
 
     /**
@@ -1099,486 +8122,910 @@ public:
      */
     bool containsLeft(const LeftType &left) const noexcept
     {
-        return m_LeftToRight.contains(left);
+        return m_State->m_LeftToRight.contains(left);
     }
 
     /**
      @brief Test whether any pair in the set has this right value.
      @param right The right side of the pair to look for.
      */
-    bool containsRight(const RightType &right) const
+    bool containsRight(const RightType &right) const noexcept
     {
-        return m_RightToLeft.contains(right);
+        return m_State->m_RightToLeft.contains(right);
     }
 
     /**
      @brief Find all right values that are paired with this left value.
-     If nothing is found, you will get an empty array.
-     This works well with range-based-for.
+     The span is invalidated by the next change to the set. Use a snapshot to keep it.
      @param left The left side of the pair to look for.
-     @return The vector of right values.
+     @return The span of right values.
      */
-    const std::vector<RightType>* findRight(const LeftType &left) const noexcept
+    std::span<const RightType> findRight(const LeftType &left) const noexcept
     {
-        auto l2r_it = m_LeftToRight.find(left);
-        if (l2r_it == m_LeftToRight.end())
-            return &m_EmptyRightVector;
-
-        return l2r_it->second;
+        return m_State->findRight(left);
     }
 
     /**
-     @brief Find all left values that are paired with this right value.
-     If nothing is found, you will get an empty array.
-     This works well with range-based-for.
+     @brief Find the single left value that is paired with this right value.
      @param right The right side of the pair to look for.
-     @return The vector of left values.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The singular left value.
      */
-    const std::vector<LeftType>* findLeft(const RightType &right) const noexcept
+    LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        if (r2l_it == m_RightToLeft.end())
-            return &m_EmptyLeftVector;
-
-        return r2l_it->second;
+        return m_State->findLeft(right, notFoundValue);
     }
 
     /**
      @brief Count the number of left values in the set.
-     @return The number of left values in the set.
      */
     int countLeft() const noexcept
     {
-        return m_LeftToRight.count();
+        return (int)m_State->m_LeftToRight.size();
     }
 
     /**
      @brief Count the number of right values in the set.
-     @return The number of right values in the set.
      */
     int countRight() const noexcept
     {
-        return m_RightToLeft.count();
+        return (int)m_State->m_RightToLeft.size();
     }
 
     /**
      @brief Count the number of pairs in the set.
-     @return The number of pairs in the set.
      */
     int count() const noexcept
     {
-        return m_Count;
+        return (int)m_State->m_RightToLeft.size();
     }
 
-    /**
-     @brief List all left elements.
-     @return A helper object to iterate over left elements using range-based-for.
-     */
-    UnorderedMapHelper<LeftType, std::vector<RightType> *> allLeft() const noexcept
+private:
+    // The current version, copied first if a snapshot still shares it
+    State *writableState() noexcept
     {
-        return UnorderedMapHelper(&m_LeftToRight);
+        if (!isSoleOwner(m_State))
+            m_State = std::make_shared<State>(*m_State);
+        return m_State.get();
     }
 
-    /**
-     @brief List all right elements.
-     @return A helper object to iterate over right elements using range-based-for.
-     */
-    UnorderedMapHelper<RightType, std::vector<LeftType> *> allRight() const noexcept
+    // The right values of a left value in the current version, copied first if an older version still shares them
+    RightVector *writableRights(State *state, const LeftType &left) noexcept
     {
-        return UnorderedMapHelper(&m_RightToLeft);
+        auto &rights = state->m_LeftToRight.try_emplace(left).first->second;
+        if (!rights)
+            rights = std::make_shared<RightVector>();
+        else if (!isSoleOwner(rights))
+            rights = std::make_shared<RightVector>(*rights);
+        return rights.get();
     }
 
-    /**
-     @brief A range-based-for compatible iterator.
-     */
-    class Iterator
+    void eraseFromRights(State *state, const LeftType &left, const RightType &right) noexcept
     {
-        /// @cond
-      public:
-        typename std::unordered_map<LeftType, std::vector<RightType> *>::const_iterator l2r_it;
-        typename std::unordered_map<LeftType, std::vector<RightType> *>::const_iterator l2r_it_end;
-        typename std::vector<RightType>::const_iterator l2r_vec_it;
+        RightVector *rights = writableRights(state, left);
+        eraseFromSortedVector(rights, right);
+        if (rights->empty())
+            state->m_LeftToRight.erase(left);
+    }
+};
 
-        inline Pair operator*() const noexcept
-        {
-            auto left = l2r_it->first;
-            auto right = *l2r_vec_it;
-            return Pair(left, right);
-        }
+// -------- Lock-free lookups --------
 
-        inline bool operator==(const Iterator &other) const noexcept
+/// @cond
+// An open-addressing hash map that any number of threads can look up in without locks, while one thread at a time
+// changes it. Keys and values must be trivially copyable, and small enough that their atomics need no lock.
+// Each slot is a seqlock: the writer makes its sequence number odd, changes the slot, and makes it even again. A reader
+// that sees the number change while it reads the slot reads it again. Slots are never moved within a table; growing
+// the map, or clearing out erased slots once they fill most of the table, builds a new table and publishes it. The old
+// tables stay alive until reclaim(), which the owner only calls while no thread is looking up, because a reader may
+// still be probing them. With a steady mix of inserts and erases the table keeps its size, but every cleanup retires
+// a table of that size, so retiredBytes() grows until the next reclaim().
+template <typename KeyType, typename ValueType> class AtomicHashMap
+{
+    static_assert(std::is_trivially_copyable_v<KeyType> && std::is_trivially_copyable_v<ValueType>,
+                  "AtomicHashMap needs trivially copyable keys and values");
+    static_assert(std::atomic<KeyType>::is_always_lock_free && std::atomic<ValueType>::is_always_lock_free,
+                  "AtomicHashMap needs keys and values that fit in a lock-free atomic, 8 bytes on most platforms");
+
+    enum : uint8_t
+    {
+        kEmpty,
+        kFull,
+        kErased
+    };
+
+    struct Slot
+    {
+        std::atomic<uint32_t> m_Sequence{0};
+        std::atomic<uint8_t> m_State{kEmpty};
+        std::atomic<KeyType> m_Key;
+        std::atomic<ValueType> m_Value;
+    };
+
+    struct Table
+    {
+        std::unique_ptr<Slot[]> m_Slots;
+        size_t m_Capacity;
+        int m_Shift;
+
+        explicit Table(size_t capacity) noexcept
+        : m_Slots(new Slot[capacity]), m_Capacity(capacity), m_Shift(64 - std::countr_zero(capacity))
+        {}
+
+        size_t homeOf(const KeyType &key) const noexcept
         {
-            return l2r_it == other.LeftIterator;
+            uint64_t hash;
+            if constexpr (DenseHandleTraits<KeyType>::kIsDense)
+                hash = DenseHandleTraits<KeyType>::index(key);
+            else
+                hash = TransparentHash<KeyType>()(key);
+            return (size_t)((hash * 0x9e3779b97f4a7c15ULL) >> m_Shift);
         }
+    };
 
-        inline bool operator!=(const Iterator &other) const noexcept
+    static constexpr size_t kMinCapacity = 16;
+
+    std::atomic<Table *> m_Table;
+    std::unique_ptr<Table> m_Current;
+    std::vector<std::unique_ptr<Table>> m_Retired;
+    size_t m_RetiredBytes = 0;
+    size_t m_Used = 0; // Full and erased slots
+    std::atomic<int> m_Count{0};
+
+public:
+    AtomicHashMap() noexcept
+    : m_Current(std::make_unique<Table>(kMinCapacity))
+    {
+        m_Table.store(m_Current.get(), std::memory_order_release);
+    }
+
+    AtomicHashMap(const AtomicHashMap &) = delete;
+    AtomicHashMap &operator=(const AtomicHashMap &) = delete;
+
+    // Lock-free
+    std::optional<ValueType> find(const KeyType &key) const noexcept
+    {
+        const Table *table = m_Table.load(std::memory_order_acquire);
+        size_t mask = table->m_Capacity - 1;
+        for (size_t index = table->homeOf(key);; index = (index + 1) & mask)
         {
-            return l2r_it != other.l2r_it;
+            const Slot &slot = table->m_Slots[index];
+            while (true)
+            {
+                uint32_t sequence = slot.m_Sequence.load(std::memory_order_acquire);
+                if (sequence & 1)
+                    continue;
+                // The acquire loads keep the second load of the sequence number after them
+                uint8_t state = slot.m_State.load(std::memory_order_acquire);
+                KeyType slot_key = slot.m_Key.load(std::memory_order_acquire);
+                ValueType value = slot.m_Value.load(std::memory_order_acquire);
+                if (slot.m_Sequence.load(std::memory_order_relaxed) != sequence)
+                    continue;
+                if (state == kEmpty)
+                    return std::nullopt;
+                if (state == kFull && slot_key == key)
+                    return value;
+                break;
+            }
         }
+    }
 
-        inline Iterator operator++() noexcept
+    int size() const noexcept
+    {
+        return m_Count.load(std::memory_order_relaxed);
+    }
+
+    // Writer only
+    size_t capacity() const noexcept
+    {
+        return m_Current->m_Capacity;
+    }
+
+    // Writer only. Bytes held by the tables that reclaim() would free.
+    size_t retiredBytes() const noexcept
+    {
+        return m_RetiredBytes;
+    }
+
+    // Writer only. Returns the old value, if the key was in the map.
+    std::optional<ValueType> insertOrAssign(const KeyType &key, const ValueType &value) noexcept
+    {
+        Table *table = m_Current.get();
+        size_t mask = table->m_Capacity - 1;
+        Slot *reuse = nullptr;
+        for (size_t index = table->homeOf(key);; index = (index + 1) & mask)
         {
-            l2r_vec_it++;
-            if (l2r_vec_it == (*l2r_it).second->cend())
+            Slot &slot = table->m_Slots[index];
+            uint8_t state = slot.m_State.load(std::memory_order_relaxed);
+            if (state == kFull && slot.m_Key.load(std::memory_order_relaxed) == key)
             {
-                l2r_it++;
-                if (l2r_it != l2r_it_end)
+                ValueType old_value = slot.m_Value.load(std::memory_order_relaxed);
+                // A single value store needs no seqlock: readers see either the old or the new value
+                slot.m_Value.store(value, std::memory_order_release);
+                return old_value;
+            }
+            if (state == kErased && !reuse)
+                reuse = &slot;
+            if (state == kEmpty)
+            {
+                if (!reuse)
                 {
-                    l2r_vec_it = (*l2r_it).second->cbegin();
+                    reuse = &slot;
+                    m_Used += 1;
                 }
+                break;
             }
-            return *this;
         }
-        /// @endcond
-    };
 
-    /**
-     @brief Required member to get range-based-for.
-     @return an Iterator set to the first pair in the set.
-     */
-    Iterator begin() const noexcept
+        writeSlot(reuse, kFull, key, value);
+        m_Count.fetch_add(1, std::memory_order_relaxed);
+        if (m_Used * 4 > table->m_Capacity * 3)
+            rehash();
+        return std::nullopt;
+    }
+
+    // Writer only. Returns the value, if the key was in the map.
+    std::optional<ValueType> erase(const KeyType &key) noexcept
     {
-        Iterator it;
-        it.l2r_it = m_LeftToRight.cbegin();
-        it.l2r_it_end = m_LeftToRight.cend();
-        if (it.l2r_it != it.l2r_it_end)
+        Table *table = m_Current.get();
+        size_t mask = table->m_Capacity - 1;
+        for (size_t index = table->homeOf(key);; index = (index + 1) & mask)
         {
-            auto l2r_vec = it.l2r_it->second;
-            it.l2r_vec_it = l2r_vec->cbegin();
+            Slot &slot = table->m_Slots[index];
+            uint8_t state = slot.m_State.load(std::memory_order_relaxed);
+            if (state == kEmpty)
+                return std::nullopt;
+            if (state == kFull && slot.m_Key.load(std::memory_order_relaxed) == key)
+            {
+                ValueType old_value = slot.m_Value.load(std::memory_order_relaxed);
+                // The slot stays in the probe sequence of the keys after it
+                writeSlot(&slot, kErased, key, old_value);
+                m_Count.fetch_sub(1, std::memory_order_relaxed);
+                return old_value;
+            }
         }
-        return it;
     }
 
-    /**
-     @brief Required member to get range-based-for.
-     @return an Iterator set to one after the last pair in the set.
-     */
-    Iterator end() const noexcept
+    // Writer only. Keeps the capacity.
+    void clear() noexcept
     {
-        Iterator it;
-        it.l2r_it = m_LeftToRight.cend();
-        return it;
+        Table *table = m_Current.get();
+        for (size_t index = 0; index < table->m_Capacity; ++index)
+        {
+            Slot &slot = table->m_Slots[index];
+            if (slot.m_State.load(std::memory_order_relaxed) != kEmpty)
+                writeSlot(&slot, kEmpty, slot.m_Key.load(std::memory_order_relaxed),
+                          slot.m_Value.load(std::memory_order_relaxed));
+        }
+        m_Used = 0;
+        m_Count.store(0, std::memory_order_relaxed);
     }
-};
 
-// ----------------------------------------------------------------------------
+    // Writer only, while no thread is in find()
+    void reclaim() noexcept
+    {
+        m_Retired.clear();
+        m_RetiredBytes = 0;
+    }
+
+    // Writer only. Calls function(key, value) for each element.
+    template <typename Function> void forEach(Function function) const noexcept
+    {
+        const Table *table = m_Current.get();
+        for (size_t index = 0; index < table->m_Capacity; ++index)
+        {
+            const Slot &slot = table->m_Slots[index];
+            if (slot.m_State.load(std::memory_order_relaxed) == kFull)
+                function(slot.m_Key.load(std::memory_order_relaxed), slot.m_Value.load(std::memory_order_relaxed));
+        }
+    }
+
+private:
+    static void writeSlot(Slot *slot, uint8_t state, const KeyType &key, const ValueType &value) noexcept
+    {
+        // The acquire half keeps the stores below after the sequence number turns odd, and readers that see any of
+        // them (with acquire) then also see the odd number
+        uint32_t sequence = slot->m_Sequence.fetch_add(1, std::memory_order_acq_rel);
+        slot->m_Key.store(key, std::memory_order_release);
+        slot->m_Value.store(value, std::memory_order_release);
+        slot->m_State.store(state, std::memory_order_release);
+        slot->m_Sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Move the elements to a new table, twice as large unless most used slots are erased ones
+    void rehash() noexcept
+    {
+        Table *table = m_Current.get();
+        size_t capacity = table->m_Capacity;
+        if ((size_t)m_Count.load(std::memory_order_relaxed) * 2 > capacity / 2)
+            capacity *= 2;
+
+        auto new_table = std::make_unique<Table>(capacity);
+        size_t mask = capacity - 1;
+        forEach([&](const KeyType &key, const ValueType &value) {
+            size_t index = new_table->homeOf(key);
+            while (new_table->m_Slots[index].m_State.load(std::memory_order_relaxed) != kEmpty)
+                index = (index + 1) & mask;
+            Slot &slot = new_table->m_Slots[index];
+            slot.m_Key.store(key, std::memory_order_relaxed);
+            slot.m_Value.store(value, std::memory_order_relaxed);
+            slot.m_State.store(kFull, std::memory_order_relaxed);
+        });
+        m_Used = (size_t)m_Count.load(std::memory_order_relaxed);
+
+        m_Table.store(new_table.get(), std::memory_order_release);
+        m_RetiredBytes += sizeof(Table) + table->m_Capacity * sizeof(Slot);
+        m_Retired.push_back(std::move(m_Current));
+        m_Current = std::move(new_table);
+    }
+};
+/// @endcond
 
 /**
- A one-to-one set of (left, right) pairs. Any left or right value can only be paired with one counterpart.
- @image html binary-relations-one-to-one.png "one-to-one"
+ A one-to-one set for many threads that look up pairs without ever taking a lock, while other threads change it.
+ Both sides are open-addressing hash tables with atomic slots. Writers take a lock, so that one changes the set at a
+ time. A lookup sees each side as it was just before or just after a change, but a change that touches both sides is
+ not atomic as a whole.
+ When a table is replaced, the old one stays alive, since a reader may still be in it. A table is replaced when it
+ grows, and also when erased slots fill most of it, so a set that keeps the same size while pairs come and go keeps
+ replacing tables too. Call `reclaim()` from time to time, at a moment that no thread is looking up, to free them;
+ `retiredBytes()` tells how much memory that would free.
+ Left and right values must be trivially copyable, such as integers, enums and handles, and no larger than what
+ `std::atomic` handles without a lock, which is 8 bytes on most platforms.
  */
-template <typename LeftType, typename RightType> class OneToOne
+template <typename LeftType, typename RightType> class LockFreeOneToOne
 {
-    std::unordered_map<LeftType, RightType> m_LeftToRight;
-    std::unordered_map<RightType, LeftType> m_RightToLeft;
+    mutable std::mutex m_WriteMutex;
+    AtomicHashMap<LeftType, RightType> m_LeftToRight;
+    AtomicHashMap<RightType, LeftType> m_RightToLeft;
+
+public:
+    /**
+     @brief Default constructor.
+     */
+    LockFreeOneToOne() noexcept
+    {}
+
+    /**
+     @brief Add a pair to the set. Pairs that have either value are erased first.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void insert(const LeftType &left, const RightType &right) noexcept
+    {
+        std::lock_guard lock(m_WriteMutex);
+        std::optional<RightType> old_right = m_LeftToRight.find(left);
+        if (old_right && *old_right == right)
+            return;
+        if (old_right)
+            m_RightToLeft.erase(*old_right);
+        std::optional<LeftType> old_left = m_RightToLeft.insertOrAssign(right, left);
+        if (old_left)
+            m_LeftToRight.erase(*old_left);
+        m_LeftToRight.insertOrAssign(left, right);
+    }
+
+    /**
+     @brief Erase a pair from the set. If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void erase(const LeftType &left, const RightType &right) noexcept
+    {
+        std::lock_guard lock(m_WriteMutex);
+        std::optional<RightType> old_right = m_LeftToRight.find(left);
+        if (!old_right || !(*old_right == right))
+            return;
+        m_LeftToRight.erase(left);
+        m_RightToLeft.erase(right);
+    }
+
+    /**
+     @brief Erase the pair with the given left value.
+     @param left The left side of the pair to erase.
+     */
+    void eraseLeft(const LeftType &left) noexcept
+    {
+        std::lock_guard lock(m_WriteMutex);
+        std::optional<RightType> right = m_LeftToRight.erase(left);
+        if (right)
+            m_RightToLeft.erase(*right);
+    }
+
+    /**
+     @brief Erase the pair with the given right value.
+     @param right The right side of the pair to erase.
+     */
+    void eraseRight(const RightType &right) noexcept
+    {
+        std::lock_guard lock(m_WriteMutex);
+        std::optional<LeftType> left = m_RightToLeft.erase(right);
+        if (left)
+            m_LeftToRight.erase(*left);
+    }
+
+    /**
+     @brief Erase all pairs from the set.
+     */
+    void clear() noexcept
+    {
+        std::lock_guard lock(m_WriteMutex);
+        m_LeftToRight.clear();
+        m_RightToLeft.clear();
+    }
+
+    /**
+     @brief Free the hash tables that were replaced, because the set grew or because erased slots were cleared out. Only
+     call this while no thread is looking up.
+     */
+    void reclaim() noexcept
+    {
+        std::lock_guard lock(m_WriteMutex);
+        m_LeftToRight.reclaim();
+        m_RightToLeft.reclaim();
+    }
+
+    /**
+     @brief Get the memory that `reclaim()` would free.
+     @return Bytes held by replaced hash tables.
+     */
+    size_t retiredBytes() const noexcept
+    {
+        std::lock_guard lock(m_WriteMutex);
+        return m_LeftToRight.retiredBytes() + m_RightToLeft.retiredBytes();
+    }
+
+    /**
+     @brief Test whether a given pair is in the set, without locking.
+     @param left The left side of the pair to look for.
+     @param right The right side of the pair to look for.
+     */
+    bool contains(const LeftType &left, const RightType &right) const noexcept
+    {
+        std::optional<RightType> found = m_LeftToRight.find(left);
+        return found && *found == right;
+    }
 
-public:
     /**
-    @brief A pair of (left, right) values.
+     @brief Test whether any pair in the set has this left value, without locking.
+     @param left The left side of the pair to look for.
      */
-    struct Pair
+    bool containsLeft(const LeftType &left) const noexcept
     {
-        LeftType left;
-        RightType right;
-        Pair(LeftType left, RightType right)
-        : left(left), right(right)
-        {}
-        Pair()
-        {}
-    };
+        return m_LeftToRight.find(left).has_value();
+    }
 
     /**
-     @brief Default constructor.
+     @brief Test whether any pair in the set has this right value, without locking.
+     @param right The right side of the pair to look for.
      */
-    OneToOne() noexcept
-    {}
+    bool containsRight(const RightType &right) const noexcept
+    {
+        return m_RightToLeft.find(right).has_value();
+    }
 
     /**
-     @brief Insert a pair into the set.
-     The rule for one-to-one is that if the rleft value or the ight value are part of an existing pairs in the set, those relations will be erased.
-     @param pair The pair to insert.
+     @brief Find the right value that is paired with this left value, without locking.
+     @param left The left side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The right value.
      */
-    void insert(const Pair &pair) noexcept
+    RightType findRight(const LeftType &left, const RightType &notFoundValue) const noexcept
     {
-        insert(pair.left, pair.right);
+        return m_LeftToRight.find(left).value_or(notFoundValue);
     }
 
     /**
-     @brief Insert a pair into the set.
-     The rule for one-to-one is that if the left value or the right value are part of existing pairs in the set, those relations will be erased.
-     @param left The left side of the pair to add.
-     @param right The right side of the pair to add.
+     @brief Find the left value that is paired with this right value, without locking.
+     @param right The right side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The left value.
      */
-    void insert(const LeftType &left, const RightType &right) noexcept
+    LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
     {
-        if (!contains(left, right))
-        {
-            eraseLeft(left);
-            eraseRight(right);
-            m_RightToLeft[right] = left;
-            m_LeftToRight[left] = right;
-        }
+        return m_RightToLeft.find(right).value_or(notFoundValue);
     }
 
     /**
-     @brief Insert multiple  pairs into the set.
-     The rule for one-to-one is that if the left value or the right value are part of existing pairs in the set, those relations will be erased.
-     @param pairs The pairs to add.
+     @brief Count the number of pairs in the set.
      */
-    void insert(const std::vector<Pair> &pairs) noexcept
+    int count() const noexcept
     {
-        for (auto pair : pairs)
-        {
-            insert(pair);
-        }
+        return m_LeftToRight.size();
     }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ A one-to-many set for many threads that look up the left value of a right value without ever taking a lock, while
+ other threads change it. See `LockFreeOneToOne`.
+ Only the lookups by right value are lock-free. The right values of each left value are kept in sorted arrays that
+ `findRight()` copies under the writer lock.
+ Left and right values must be trivially copyable, and no larger than what `std::atomic` handles without a lock,
+ which is 8 bytes on most platforms.
+ */
+template <typename LeftType, typename RightType, typename StoragePolicy = StdStoragePolicy> class LockFreeOneToMany
+{
+    using RightVector = std::vector<RightType>;
+    using LeftToRightMap = typename StoragePolicy::template Map<LeftType, RightVector>;
+
+    mutable std::mutex m_WriteMutex;
+    LeftToRightMap m_LeftToRight;
+    AtomicHashMap<RightType, LeftType> m_RightToLeft;
 
+public:
     /**
-     @brief Erase a pair from the set.
-     If there is no matching pair in the set, nothing happens.
-     @param pair The pair to erase.
+     @brief Default constructor.
      */
-    void erase(const Pair &pair) noexcept
+    LockFreeOneToMany() noexcept
+    {}
+
+    /**
+     @brief Add a pair to the set. If the right value already had a left value, that pair is erased first.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
+     */
+    void insert(const LeftType &left, const RightType &right) noexcept
     {
-        erase(pair.left, pair.right);
+        std::lock_guard lock(m_WriteMutex);
+        std::optional<LeftType> old_left = m_RightToLeft.insertOrAssign(right, left);
+        if (old_left && *old_left == left)
+            return;
+        if (old_left)
+            eraseFromMappedVector(&m_LeftToRight, *old_left, right);
+        insertIntoSortedVector(&m_LeftToRight[left], right);
     }
 
     /**
-     @brief Erase a pair from the set.
-     If there is no matching pair in the set, nothing happens.
-     @param left The left side of the pair to erase.
-     @param right The right side of the pair to erase.
+     @brief Erase a pair from the set. If there is no matching pair in the set, nothing happens.
+     @param left The left side of the pair.
+     @param right The right side of the pair.
      */
     void erase(const LeftType &left, const RightType &right) noexcept
     {
-        if (contains(left, right))
-        {
-            auto l2r_it = m_LeftToRight.find(left);
-            auto r2l_it = m_RightToLeft.find(right);
-
-            m_LeftToRight.erase(l2r_it);
-            m_RightToLeft.erase(r2l_it);
-        }
+        std::lock_guard lock(m_WriteMutex);
+        std::optional<LeftType> old_left = m_RightToLeft.find(right);
+        if (!old_left || !(*old_left == left))
+            return;
+        m_RightToLeft.erase(right);
+        eraseFromMappedVector(&m_LeftToRight, left, right);
     }
 
     /**
      @brief Erase all pairs with the given left value.
-     If there is no matching pair in the set, nothing happens.
      @param left The left side of the pairs to erase.
      */
     void eraseLeft(const LeftType &left) noexcept
     {
+        std::lock_guard lock(m_WriteMutex);
         auto l2r_it = m_LeftToRight.find(left);
-        if (l2r_it != m_LeftToRight.end())
-        {
-            auto right = l2r_it->second;
-            auto r2l_it = m_RightToLeft.find(right);
-            m_RightToLeft.erase(r2l_it);
-            m_LeftToRight.erase(l2r_it);
-        }
+        if (l2r_it == m_LeftToRight.end())
+            return;
+        for (auto &right : l2r_it->second)
+            m_RightToLeft.erase(right);
+        m_LeftToRight.erase(l2r_it);
     }
 
     /**
      @brief Erase the pair with the given right value.
-     If there is no matching pair in the set, nothing happens.
-     @param right The right side of the pairs to erase.
+     @param right The right side of the pair to erase.
      */
     void eraseRight(const RightType &right) noexcept
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        if (r2l_it != m_RightToLeft.end())
-        {
-            auto left = r2l_it->second;
-            auto l2r_it = m_LeftToRight.find(left);
-            m_LeftToRight.erase(l2r_it);
-            m_RightToLeft.erase(r2l_it);
-        }
+        std::lock_guard lock(m_WriteMutex);
+        std::optional<LeftType> left = m_RightToLeft.erase(right);
+        if (left)
+            eraseFromMappedVector(&m_LeftToRight, *left, right);
     }
 
     /**
-     @brief Erase multiple  pairs from the set.
-     This is equivalent to erasing the pairs one by one.
-     @param pairs The pairs to erase.
+     @brief Erase all pairs from the set.
      */
-    void erase(const std::vector<Pair> &pairs) noexcept
+    void clear() noexcept
     {
-        for (auto pair : pairs)
-        {
-            erase( pair);
-        }
+        std::lock_guard lock(m_WriteMutex);
+        m_LeftToRight.clear();
+        m_RightToLeft.clear();
     }
 
     /**
-     @brief Erase all pairs from the set.
+     @brief Free the hash tables that were replaced, because the set grew or because erased slots were cleared out. Only
+     call this while no thread is looking up.
      */
-    void clear() noexcept
+    void reclaim() noexcept
     {
-        m_RightToLeft.clear();
-        m_LeftToRight.clear();
+        std::lock_guard lock(m_WriteMutex);
+        m_RightToLeft.reclaim();
     }
 
     /**
-     @brief Test whether a given pair is in the set.
-     @param pair The pair to look for.
+     @brief Get the memory that `reclaim()` would free.
+     @return Bytes held by replaced hash tables.
      */
-    bool contains(const Pair &pair) const noexcept
+    size_t retiredBytes() const noexcept
     {
-        return contains(pair.left, pair.right);
+        std::lock_guard lock(m_WriteMutex);
+        return m_RightToLeft.retiredBytes();
     }
 
     /**
-     @brief Test whether a given pair is in the set.
+     @brief Test whether a given pair is in the set, without locking.
      @param left The left side of the pair to look for.
      @param right The right side of the pair to look for.
      */
     bool contains(const LeftType &left, const RightType &right) const noexcept
     {
-        auto l2r_it = m_LeftToRight.find(left);
-        return l2r_it != m_LeftToRight.end() && l2r_it->second == right;
+        std::optional<LeftType> found = m_RightToLeft.find(right);
+        return found && *found == left;
     }
 
     /**
-     @brief Test whether any pair in the set has this left value.
-     @param left The left side of the pair to look for.
+     @brief Test whether any pair in the set has this right value, without locking.
+     @param right The right side of the pair to look for.
      */
-    bool containsLeft(const LeftType &left) const noexcept
+    bool containsRight(const RightType &right) const noexcept
     {
-        auto l2r_it = m_LeftToRight.find(left);
-        return l2r_it != m_LeftToRight.end();
+        return m_RightToLeft.find(right).has_value();
     }
 
     /**
-     @brief Test whether any pair in the set has this right value.
+     @brief Find the single left value that is paired with this right value, without locking.
      @param right The right side of the pair to look for.
+     @param notFoundValue The value to return if no matching pair is found.
+     @return The left value.
      */
-    bool containsRight(const RightType &right) const noexcept
+    LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        return r2l_it != m_RightToLeft.end();
+        return m_RightToLeft.find(right).value_or(notFoundValue);
     }
 
     /**
-     @brief Find the single right value that is paired with this left value.
-     If nothing is found, you will get the notFoundValue.
+     @brief Test whether any pair in the set has this left value. This takes the writer lock.
      @param left The left side of the pair to look for.
-     @param notFoundValue The value to return if no matching pair is found.
-     @return The singular right value.
      */
-    RightType findRight(const LeftType &left, const RightType &notFoundValue) const noexcept
+    bool containsLeft(const LeftType &left) const noexcept
     {
-        auto l2r_it = m_LeftToRight.find(left);
-        return l2r_it != m_LeftToRight.end() ? l2r_it->second : notFoundValue;
+        std::lock_guard lock(m_WriteMutex);
+        return m_LeftToRight.contains(left);
     }
 
     /**
-     @brief Find the single left value that is paired with this right value.
-     If nothing is found, you will get the notFoundValue.
-     @param right The right side of the pair to look for.
-     @param notFoundValue The value to return if no matching pair is found.
-     @return The singular left value.
+     @brief Find all right values that are paired with this left value. This takes the writer lock.
+     @param left The left side of the pairs to look for.
+     @return A copy of the right values, sorted.
      */
-    LeftType findLeft(const RightType &right, const LeftType &notFoundValue) const noexcept
+    std::vector<RightType> findRight(const LeftType &left) const noexcept
     {
-        auto r2l_it = m_RightToLeft.find(right);
-        return r2l_it != m_RightToLeft.end() ? r2l_it->second : notFoundValue;
+        std::lock_guard lock(m_WriteMutex);
+        auto l2r_it = m_LeftToRight.find(left);
+        if (l2r_it == m_LeftToRight.end())
+            return std::vector<RightType>();
+        return l2r_it->second;
     }
 
     /**
-     @brief Count the number of left values in the set.
-     @return The number of left values in the set.
+     @brief Count the number of left values in the set. This takes the writer lock.
      */
     int countLeft() const noexcept
     {
+        std::lock_guard lock(m_WriteMutex);
         return (int)m_LeftToRight.size();
     }
 
     /**
      @brief Count the number of right values in the set.
-     @return The number of right values in the set.
      */
     int countRight() const noexcept
     {
-        return (int)m_RightToLeft.size();
+        return m_RightToLeft.size();
     }
 
     /**
      @brief Count the number of pairs in the set.
-     @return The number of pairs in the set.
      */
     int count() const noexcept
     {
-        return (int)m_LeftToRight.size();
+        return m_RightToLeft.size();
     }
+};
 
-    /**
-     @brief List all left elements.
-     @return A helper object to iterate over left elements using range-based-for.
-     */
-    UnorderedMapHelper<LeftType, RightType> allLeft() const noexcept
-    {
-        return UnorderedMapHelper(&m_LeftToRight);
-    }
+// -------- Command buffers --------
 
-    /**
-     @brief List all right elements.
-     @return A helper object to iterate over right elements using range-based-for.
-     */
-    UnorderedMapHelper<RightType, LeftType> allRight() const noexcept
-    {
-        return UnorderedMapHelper(&m_RightToLeft);
-    }
+/**
+ Records inserts and erases from many threads, to apply them to a `OneToOne`, `OneToMany` or `ManyToMany` later, in one
+ batch.
+ Each thread records into a lane of its own, so recording takes no locks and no atomics. `flush()` then puts the lanes
+ together, and applies them through the bulk insert and erase of the relation.
+ Commands are ordered by lane, then by the order in which they were recorded in the lane. The result of flush is the
+ same as applying them one by one in that order, so when two commands conflict, the last one wins. Since the order does
+ not depend on timing, the result is the same on every run, as long as each job records into the same lane.
+ */
+template <typename RelationType> class RelationCommandBuffer
+{
+    using Traits = RelationTraits<RelationType>;
+    static_assert(Traits::kKind != 0, "RelationCommandBuffer needs a OneToOne, OneToMany or ManyToMany");
+
+public:
+    using LeftType = typename Traits::LeftType;
+    using RightType = typename Traits::RightType;
+    using Pair = typename RelationType::Pair;
 
     /**
-     @brief A range-based-for compatible iterator.
+     @brief The commands of one thread. Only one thread at a time may record into a lane.
      */
-    class Iterator
+    class alignas(64) Lane
     {
-        /// @cond
-      public:
-        std::unordered_map<LeftType, RightType>::const_iterator l2r_it;
+        friend class RelationCommandBuffer;
 
-        inline Pair operator*() const noexcept
+        struct Command
         {
-            return Pair(l2r_it->first, l2r_it->second);
-        }
+            Pair pair;
+            bool is_insert;
+        };
 
-        inline bool operator==(const Iterator &other) const noexcept
+        std::vector<Command> m_Commands;
+
+    public:
+        /**
+         @brief Record an insert.
+         @param left The left side of the pair to add.
+         @param right The right side of the pair to add.
+         */
+        void insert(const LeftType &left, const RightType &right) noexcept
         {
-            return l2r_it == other.l2r_it;
+            m_Commands.push_back(Command{Pair(left, right), true});
         }
-        inline bool operator!=(const Iterator &other) const noexcept
+
+        /**
+         @brief Record an erase.
+         @param left The left side of the pair to erase.
+         @param right The right side of the pair to erase.
+         */
+        void erase(const LeftType &left, const RightType &right) noexcept
         {
-            return l2r_it != other.l2r_it;
+            m_Commands.push_back(Command{Pair(left, right), false});
         }
-        inline Iterator operator++() noexcept
+
+        /**
+         @brief Count the commands recorded in this lane since the last flush.
+         */
+        int count() const noexcept
         {
-            l2r_it++;
-            return *this;
+            return (int)m_Commands.size();
         }
-        /// @endcond
     };
 
     /**
-     @brief Required member to get range-based-for.
-     @return an Iterator set to the first pair in the set.
+     @brief Construct a buffer with a number of lanes.
+     @param laneCount The number of lanes, or 0 for one per hardware thread.
      */
-    Iterator begin() const noexcept
+    explicit RelationCommandBuffer(int laneCount = 0) noexcept
+    : m_Lanes((size_t)resolveThreadCount(laneCount))
+    {}
+
+    /**
+     @brief Get a lane to record into.
+     @param index The index of the lane, from 0 to laneCount() - 1.
+     @return The lane.
+     */
+    Lane &lane(int index) noexcept
     {
-        Iterator it;
-        it.l2r_it = m_LeftToRight.cbegin();
-        return it;
+        return m_Lanes[(size_t)index];
     }
 
     /**
-     @brief Required member to get range-based-for.
-     @return an Iterator set to one after the last pair in the set.
+     @brief Count the lanes.
      */
-    Iterator end() const noexcept
+    int laneCount() const noexcept
     {
-        Iterator it;
-        it.l2r_it = m_LeftToRight.cend();
-        return it;
+        return (int)m_Lanes.size();
+    }
+
+    /**
+     @brief Apply all recorded commands to a relation, and empty the lanes.
+     No thread may record while this runs.
+     @param relation The relation to change.
+     */
+    void flush(RelationType *relation) noexcept
+    {
+        using Command = typename Lane::Command;
+        std::vector<Command> commands;
+        size_t command_count = 0;
+        for (auto &lane : m_Lanes)
+            command_count += lane.m_Commands.size();
+        commands.reserve(command_count);
+        for (auto &lane : m_Lanes)
+        {
+            commands.insert(commands.end(), lane.m_Commands.begin(), lane.m_Commands.end());
+            lane.m_Commands.clear();
+        }
+        if (commands.empty())
+            return;
+
+        std::vector<Pair> pairs_to_erase;
+        std::vector<Pair> pairs_to_insert;
+        if constexpr (Traits::kKind == 3)
+        {
+            // Only commands on the same pair conflict. The last one decides whether the pair is in the set.
+            std::stable_sort(commands.begin(), commands.end(), [](const Command &a, const Command &b) {
+                return a.pair.left < b.pair.left || (!(b.pair.left < a.pair.left) && a.pair.right < b.pair.right);
+            });
+            for (size_t index = 0; index < commands.size(); ++index)
+            {
+                const Pair &pair = commands[index].pair;
+                if (index + 1 < commands.size() && commands[index + 1].pair.left == pair.left &&
+                    commands[index + 1].pair.right == pair.right)
+                    continue;
+                (commands[index].is_insert ? pairs_to_insert : pairs_to_erase).push_back(pair);
+            }
+            relation->erase(pairs_to_erase);
+            relation->insert(std::move(pairs_to_insert));
+        }
+        else if constexpr (Traits::kKind == 2)
+        {
+            // Commands on the same right value conflict. Play them in order to find the left value it ends up with.
+            std::stable_sort(commands.begin(), commands.end(),
+                             [](const Command &a, const Command &b) { return a.pair.right < b.pair.right; });
+            for (size_t first = 0; first < commands.size();)
+            {
+                const RightType &right = commands[first].pair.right;
+                size_t last = first;
+                bool is_inserted = false;
+                bool is_owned = false;
+                LeftType owner = LeftType();
+                for (; last < commands.size() && commands[last].pair.right == right; ++last)
+                {
+                    const Command &command = commands[last];
+                    if (command.is_insert)
+                    {
+                        is_inserted = true;
+                        is_owned = true;
+                        owner = command.pair.left;
+                    }
+                    else if (!is_inserted)
+                    {
+                        // Before any insert, an erase is up against the pair that is in the set now
+                        pairs_to_erase.push_back(command.pair);
+                    }
+                    else if (is_owned && owner == command.pair.left)
+                    {
+                        is_owned = false;
+                    }
+                }
+
+                if (is_owned)
+                    pairs_to_insert.push_back(Pair(owner, right));
+                else if (is_inserted && relation->containsRight(right))
+                    pairs_to_erase.push_back(Pair(relation->findLeft(right, LeftType()), right));
+                first = last;
+            }
+            relation->erase(pairs_to_erase);
+            relation->insert(std::move(pairs_to_insert));
+        }
+        else
+        {
+            // An insert can take both values from other pairs, so conflicts chain. Apply each run of inserts or erases
+            // in order; bulk insert into a OneToOne already applies its pairs one by one.
+            for (size_t first = 0; first < commands.size();)
+            {
+                bool is_insert = commands[first].is_insert;
+                std::vector<Pair> &pairs = is_insert ? pairs_to_insert : pairs_to_erase;
+                pairs.clear();
+                size_t last = first;
+                for (; last < commands.size() && commands[last].is_insert == is_insert; ++last)
+                    pairs.push_back(commands[last].pair);
+                if (is_insert)
+                    relation->insert(pairs);
+                else
+                    relation->erase(pairs);
+                first = last;
+            }
+        }
     }
+
+private:
+    std::vector<Lane> m_Lanes;
 };
 // ----------------------------------------------------------------------------
 } // namespace BinaryRelations
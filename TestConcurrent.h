@@ -0,0 +1,522 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "utest.h"
+#include "BinaryRelations/BinaryRelations.h"
+
+using namespace BinaryRelations;
+
+UTEST(TestConcurrent, OneToMany)
+{
+    ConcurrentOneToMany<int, int> relation(4);
+    relation.insert(1, 10);
+    relation.insert(1, 11);
+    relation.insert(2, 12);
+    ASSERT_TRUE(relation.contains(1, 10));
+    ASSERT_EQ(relation.findLeft(11, -1), 1);
+    ASSERT_EQ(relation.findRight(1).size(), 2u);
+    relation.insert(2, 11);
+    ASSERT_EQ(relation.findLeft(11, -1), 2);
+    ASSERT_EQ(relation.findRight(1).size(), 1u);
+    ASSERT_EQ(relation.count(), 3);
+    ASSERT_EQ(relation.countLeft(), 2);
+    relation.eraseLeft(2);
+    ASSERT_FALSE(relation.containsRight(11));
+    ASSERT_FALSE(relation.containsLeft(2));
+    relation.eraseRight(10);
+    ASSERT_EQ(relation.count(), 0);
+    ASSERT_EQ(relation.countLeft(), 0);
+
+    // Many threads move the same right values between left values. Whatever the order, each right value ends up with
+    // exactly one left value, and both sides agree.
+    const int thread_count = 8;
+    const int right_count = 64;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < thread_count; ++thread)
+    {
+        threads.emplace_back([&relation, thread]() {
+            for (int step = 0; step < 2000; ++step)
+            {
+                int right = (step * 7 + thread) % right_count;
+                int left = (step + thread * 3) % 5;
+                if (step % 11 == 0)
+                    relation.eraseLeft(left);
+                else if (step % 13 == 0)
+                    relation.eraseRight(right);
+                else
+                    relation.insert(left, right);
+                relation.findRight(left);
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    int pair_count = 0;
+    for (int left = 0; left < 5; ++left)
+    {
+        for (int right : relation.findRight(left))
+        {
+            ASSERT_EQ(relation.findLeft(right, -1), left);
+            pair_count += 1;
+        }
+    }
+    ASSERT_EQ(pair_count, relation.count());
+    ASSERT_EQ(relation.countRight(), relation.count());
+}
+
+UTEST(TestConcurrent, ManyToMany)
+{
+    ConcurrentManyToMany<std::string, int> relation(4);
+    relation.insert("a", 1);
+    relation.insert("a", 2);
+    relation.insert("b", 2);
+    relation.insert("b", 2);
+    ASSERT_EQ(relation.count(), 3);
+    ASSERT_EQ(relation.findLeft(2).size(), 2u);
+    relation.eraseRight(2);
+    ASSERT_EQ(relation.count(), 1);
+    ASSERT_FALSE(relation.containsLeft("b"));
+    relation.erase("a", 1);
+    ASSERT_EQ(relation.count(), 0);
+
+    ConcurrentManyToMany<int, int> numbers(8);
+    const int thread_count = 8;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < thread_count; ++thread)
+    {
+        threads.emplace_back([&numbers, thread]() {
+            for (int step = 0; step < 2000; ++step)
+            {
+                int left = (step + thread) % 16;
+                int right = (step * 5 + thread * 7) % 32;
+                if (step % 17 == 0)
+                    numbers.eraseLeft(left);
+                else if (step % 19 == 0)
+                    numbers.eraseRight(right);
+                else if (step % 3 == 0)
+                    numbers.erase(left, right);
+                else
+                    numbers.insert(left, right);
+                numbers.contains(left, right);
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    int pair_count = 0;
+    for (int left = 0; left < 16; ++left)
+    {
+        for (int right : numbers.findRight(left))
+        {
+            std::vector<int> lefts = numbers.findLeft(right);
+            ASSERT_TRUE(std::binary_search(lefts.begin(), lefts.end(), left));
+            pair_count += 1;
+        }
+    }
+    ASSERT_EQ(pair_count, numbers.count());
+}
+
+UTEST(TestConcurrent, OneToOne)
+{
+    ConcurrentOneToOne<int, std::string> relation(4);
+    relation.insert(1, "one");
+    relation.insert(2, "two");
+    relation.insert(1, "two");
+    ASSERT_FALSE(relation.containsLeft(2));
+    ASSERT_FALSE(relation.containsRight("one"));
+    ASSERT_TRUE(relation.findRight(1, "") == "two");
+    ASSERT_EQ(relation.count(), 1);
+    relation.eraseRight("two");
+    ASSERT_EQ(relation.count(), 0);
+
+    ConcurrentOneToOne<int, int> numbers(4);
+    const int thread_count = 8;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < thread_count; ++thread)
+    {
+        threads.emplace_back([&numbers, thread]() {
+            for (int step = 0; step < 2000; ++step)
+            {
+                int left = (step + thread) % 24;
+                int right = (step * 3 + thread * 5) % 24;
+                if (step % 7 == 0)
+                    numbers.eraseLeft(left);
+                else if (step % 11 == 0)
+                    numbers.eraseRight(right);
+                else
+                    numbers.insert(left, right);
+                numbers.findLeft(right, -1);
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    int pair_count = 0;
+    for (int left = 0; left < 24; ++left)
+    {
+        int right = numbers.findRight(left, -1);
+        if (right >= 0)
+        {
+            ASSERT_EQ(numbers.findLeft(right, -1), left);
+            pair_count += 1;
+        }
+    }
+    ASSERT_EQ(pair_count, numbers.count());
+    numbers.clear();
+    ASSERT_EQ(numbers.count(), 0);
+}
+
+UTEST(TestConcurrent, Snapshot)
+{
+    VersionedOneToMany<int, std::string> relation;
+    relation.insert(1, "a");
+    relation.insert(1, "b");
+    relation.insert(2, "c");
+
+    auto before = relation.snapshot();
+    relation.insert(2, "a");
+    relation.eraseLeft(1);
+    relation.insert(3, "d");
+
+    // The snapshot still sees the old version
+    ASSERT_EQ(before.count(), 3);
+    ASSERT_EQ(before.findRight(1).size(), 2u);
+    ASSERT_TRUE(before.findLeft("a", -1) == 1);
+    ASSERT_FALSE(before.containsLeft(3));
+    int pair_count = 0;
+    for (auto pair : before)
+    {
+        ASSERT_TRUE(before.contains(pair.left, pair.right));
+        pair_count += 1;
+    }
+    ASSERT_EQ(pair_count, 3);
+
+    ASSERT_EQ(relation.count(), 3);
+    ASSERT_TRUE(relation.findLeft("a", -1) == 2);
+    ASSERT_FALSE(relation.containsLeft(1));
+    ASSERT_TRUE(relation.findRight(2)[0] == "a");
+
+    // Left values that did not change share their right values with the older version
+    auto after = relation.snapshot();
+    relation.insert(2, "e");
+    ASSERT_EQ(after.findRight(3).data(), relation.findRight(3).data());
+    ASSERT_NE(after.findRight(2).data(), relation.findRight(2).data());
+    ASSERT_EQ(after.findRight(2).size(), 2u);
+
+    relation.clear();
+    ASSERT_EQ(relation.count(), 0);
+    ASSERT_EQ(after.count(), 3);
+}
+
+UTEST(TestConcurrent, SnapshotReaders)
+{
+    // Every snapshot holds 16 right values, spread over the left values. Readers check that, while the writer keeps
+    // moving right values around.
+    VersionedOneToMany<int, int> relation;
+    for (int right = 0; right < 16; ++right)
+        relation.insert(right % 4, right);
+
+    std::atomic<bool> is_done = false;
+    std::vector<VersionedOneToMany<int, int>::Snapshot> published(4);
+    std::vector<std::thread> threads;
+    std::atomic<int> failures = 0;
+    for (int thread = 0; thread < 4; ++thread)
+        published[thread] = relation.snapshot();
+
+    std::mutex mutex;
+    for (int thread = 0; thread < 4; ++thread)
+    {
+        threads.emplace_back([&, thread]() {
+            while (!is_done)
+            {
+                VersionedOneToMany<int, int>::Snapshot snapshot;
+                {
+                    std::lock_guard lock(mutex);
+                    snapshot = published[thread];
+                }
+                int right_count = 0;
+                for (int left = 0; left < 8; ++left)
+                {
+                    for (int right : snapshot.findRight(left))
+                    {
+                        if (snapshot.findLeft(right, -1) != left)
+                            failures += 1;
+                        right_count += 1;
+                    }
+                }
+                if (right_count != 16 || snapshot.count() != 16)
+                    failures += 1;
+            }
+        });
+    }
+
+    for (int step = 0; step < 5000; ++step)
+    {
+        relation.insert((step * 3) % 8, step % 16);
+        if (step % 10 == 0)
+        {
+            std::lock_guard lock(mutex);
+            published[(step / 10) % 4] = relation.snapshot();
+        }
+    }
+    is_done = true;
+    for (auto &thread : threads)
+        thread.join();
+    ASSERT_EQ(failures.load(), 0);
+    ASSERT_EQ(relation.count(), 16);
+}
+
+UTEST(TestConcurrent, LockFreeOneToOne)
+{
+    LockFreeOneToOne<int, int> relation;
+    relation.insert(1, 10);
+    relation.insert(2, 20);
+    relation.insert(1, 20);
+    ASSERT_EQ(relation.findRight(1, -1), 20);
+    ASSERT_FALSE(relation.containsLeft(2));
+    ASSERT_FALSE(relation.containsRight(10));
+    ASSERT_EQ(relation.count(), 1);
+
+    // Grow through several tables, and erase enough to reuse erased slots
+    for (int left = 0; left < 1000; ++left)
+        relation.insert(left, left + 5000);
+    for (int left = 0; left < 1000; left += 2)
+        relation.eraseLeft(left);
+    for (int left = 0; left < 1000; ++left)
+        relation.insert(left, left + 5000);
+    relation.reclaim();
+    ASSERT_EQ(relation.count(), 1000);
+    for (int left = 0; left < 1000; ++left)
+        ASSERT_EQ(relation.findLeft(left + 5000, -1), left);
+    relation.clear();
+    ASSERT_EQ(relation.count(), 0);
+    ASSERT_FALSE(relation.containsLeft(5));
+
+    // Readers look up while a writer keeps moving right values between left values. A right value is always
+    // either missing or paired with a left value of its own residue class.
+    std::atomic<bool> is_done = false;
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; ++thread)
+    {
+        threads.emplace_back([&]() {
+            while (!is_done)
+            {
+                for (int right = 0; right < 256; ++right)
+                {
+                    int left = relation.findLeft(right, -1);
+                    if (left != -1 && left % 16 != right % 16)
+                        failures += 1;
+                }
+            }
+        });
+    }
+    for (int step = 0; step < 20000; ++step)
+    {
+        int right = (step * 7) % 256;
+        if (step % 5 == 0)
+            relation.eraseRight(right);
+        else
+            relation.insert(right % 16 + 16 * (step % 64), right);
+    }
+    is_done = true;
+    for (auto &thread : threads)
+        thread.join();
+    ASSERT_EQ(failures.load(), 0);
+}
+
+UTEST(TestConcurrent, LockFreeOneToMany)
+{
+    LockFreeOneToMany<int, int> relation;
+    relation.insert(1, 10);
+    relation.insert(1, 11);
+    relation.insert(2, 11);
+    ASSERT_EQ(relation.findLeft(11, -1), 2);
+    ASSERT_EQ(relation.findRight(1).size(), 1u);
+    ASSERT_TRUE(relation.contains(1, 10));
+    relation.eraseLeft(1);
+    ASSERT_FALSE(relation.containsRight(10));
+    ASSERT_FALSE(relation.containsLeft(1));
+    ASSERT_EQ(relation.count(), 1);
+
+    std::atomic<bool> is_done = false;
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; ++thread)
+    {
+        threads.emplace_back([&]() {
+            while (!is_done)
+            {
+                for (int right = 0; right < 512; ++right)
+                {
+                    int left = relation.findLeft(right, -1);
+                    if (left != -1 && left != right % 8 && left != 2)
+                        failures += 1;
+                }
+            }
+        });
+    }
+    for (int step = 0; step < 20000; ++step)
+    {
+        int right = (step * 13) % 512;
+        if (step % 7 == 0)
+            relation.eraseRight(right);
+        else
+            relation.insert(right % 8, right);
+    }
+    is_done = true;
+    for (auto &thread : threads)
+        thread.join();
+    ASSERT_EQ(failures.load(), 0);
+
+    int pair_count = 0;
+    for (int left = 0; left < 8; ++left)
+    {
+        for (int right : relation.findRight(left))
+        {
+            ASSERT_EQ(relation.findLeft(right, -1), left);
+            pair_count += 1;
+        }
+    }
+    ASSERT_EQ(pair_count, relation.count());
+}
+
+UTEST(TestConcurrent, LockFreeChurn)
+{
+    // Keep 100 pairs while pairs come and go. Clearing out erased slots replaces the tables, but they keep their size,
+    // so each round retires about as much memory as the one before, and reclaim() frees all of it.
+    LockFreeOneToOne<int, int> relation;
+    for (int left = 0; left < 100; ++left)
+        relation.insert(left, left);
+    relation.reclaim();
+    ASSERT_EQ(relation.retiredBytes(), 0u);
+
+    size_t first_round_bytes = 0;
+    for (int round = 0; round < 20; ++round)
+    {
+        for (int step = 0; step < 1000; ++step)
+        {
+            int left = 100 + round * 1000 + step;
+            relation.eraseLeft(left - 100);
+            relation.insert(left, left);
+        }
+        ASSERT_EQ(relation.count(), 100);
+        size_t round_bytes = relation.retiredBytes();
+        ASSERT_GT(round_bytes, 0u);
+        if (round == 0)
+            first_round_bytes = round_bytes;
+        ASSERT_LE(round_bytes, first_round_bytes * 2);
+        relation.reclaim();
+        ASSERT_EQ(relation.retiredBytes(), 0u);
+    }
+    for (int left = 20000; left < 20100; ++left)
+        ASSERT_EQ(relation.findLeft(left, -1), left);
+}
+
+UTEST(TestConcurrent, CommandBuffer)
+{
+    // Each relation gets the same commands through a buffer, and one by one in lane order. The results must match.
+    OneToMany<int, int> one_to_many;
+    OneToMany<int, int> one_to_many_model;
+    ManyToMany<int, int> many_to_many;
+    ManyToMany<int, int> many_to_many_model;
+    OneToOne<int, int> one_to_one;
+    OneToOne<int, int> one_to_one_model;
+    for (int i = 0; i < 50; ++i)
+    {
+        one_to_many.insert(i % 7, i);
+        one_to_many_model.insert(i % 7, i);
+        many_to_many.insert(i % 7, i % 11);
+        many_to_many_model.insert(i % 7, i % 11);
+        one_to_one.insert(i, i + 1);
+        one_to_one_model.insert(i, i + 1);
+    }
+
+    const int lane_count = 4;
+    RelationCommandBuffer<OneToMany<int, int>> one_to_many_buffer(lane_count);
+    RelationCommandBuffer<ManyToMany<int, int>> many_to_many_buffer(lane_count);
+    RelationCommandBuffer<OneToOne<int, int>> one_to_one_buffer(lane_count);
+    auto record = [](auto &lane, int lane_index, int step, auto &&apply) {
+        int left = (step * 3 + lane_index) % 9;
+        int right = (step * 5 + lane_index * 7) % 60;
+        apply(lane, step % 3 == 0, left, right);
+    };
+
+    std::vector<std::thread> threads;
+    for (int lane_index = 0; lane_index < lane_count; ++lane_index)
+    {
+        threads.emplace_back([&, lane_index]() {
+            auto apply = [](auto &lane, bool is_erase, int left, int right) {
+                if (is_erase)
+                    lane.erase(left, right);
+                else
+                    lane.insert(left, right);
+            };
+            for (int step = 0; step < 500; ++step)
+            {
+                record(one_to_many_buffer.lane(lane_index), lane_index, step, apply);
+                record(many_to_many_buffer.lane(lane_index), lane_index, step, apply);
+                record(one_to_one_buffer.lane(lane_index), lane_index, step, apply);
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    ASSERT_EQ(one_to_many_buffer.lane(0).count(), 500);
+
+    for (int lane_index = 0; lane_index < lane_count; ++lane_index)
+    {
+        for (int step = 0; step < 500; ++step)
+        {
+            record(one_to_many_model, lane_index, step, [](auto &set, bool is_erase, int left, int right) {
+                is_erase ? set.erase(left, right) : set.insert(left, right);
+            });
+            record(many_to_many_model, lane_index, step, [](auto &set, bool is_erase, int left, int right) {
+                is_erase ? set.erase(left, right) : set.insert(left, right);
+            });
+            record(one_to_one_model, lane_index, step, [](auto &set, bool is_erase, int left, int right) {
+                is_erase ? set.erase(left, right) : set.insert(left, right);
+            });
+        }
+    }
+
+    one_to_many_buffer.flush(&one_to_many);
+    many_to_many_buffer.flush(&many_to_many);
+    one_to_one_buffer.flush(&one_to_one);
+    ASSERT_EQ(one_to_many_buffer.lane(0).count(), 0);
+
+    ASSERT_EQ(one_to_many.count(), one_to_many_model.count());
+    for (auto pair : one_to_many_model)
+        ASSERT_TRUE(one_to_many.contains(pair));
+    ASSERT_EQ(many_to_many.count(), many_to_many_model.count());
+    for (auto pair : many_to_many_model)
+        ASSERT_TRUE(many_to_many.contains(pair));
+    ASSERT_EQ(one_to_one.count(), one_to_one_model.count());
+    for (auto pair : one_to_one_model)
+        ASSERT_TRUE(one_to_one.contains(pair));
+}
+
+UTEST(TestConcurrent, CommandBufferLastWins)
+{
+    OneToMany<std::string, int> relation;
+    relation.insert("a", 1);
+    RelationCommandBuffer<OneToMany<std::string, int>> buffer(2);
+    buffer.lane(0).insert("b", 1);
+    buffer.lane(1).insert("c", 1);
+    buffer.lane(1).erase("c", 1);
+    buffer.lane(0).insert("b", 2);
+    buffer.lane(1).erase("a", 2);
+    buffer.flush(&relation);
+
+    // Lane 1 comes after lane 0, so "c" took 1 from "b" and then lost it
+    ASSERT_FALSE(relation.containsRight(1));
+    ASSERT_TRUE(relation.findLeft(2, "") == "b");
+    ASSERT_EQ(relation.count(), 1);
+}
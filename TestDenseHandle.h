@@ -0,0 +1,185 @@
+#pragma once
+
+#include <random>
+#include <type_traits>
+#include "utest.h"
+#include "BinaryRelations/BinaryRelations.h"
+
+using namespace BinaryRelations;
+
+struct DenseHandle
+{
+    uint32_t m_Index;
+
+    constexpr DenseHandle(uint32_t index = ~0u)
+    : m_Index(index)
+    {}
+
+    bool operator==(const DenseHandle &other) const
+    {
+        return m_Index == other.m_Index;
+    }
+
+    bool operator<(const DenseHandle &other) const
+    {
+        return m_Index < other.m_Index;
+    }
+};
+
+template <> struct BinaryRelations::DenseHandleTraits<DenseHandle>
+{
+    static constexpr bool kIsDense = true;
+    static constexpr DenseHandle kInvalid = DenseHandle(~0u);
+    static size_t index(const DenseHandle &handle) noexcept
+    {
+        return handle.m_Index;
+    }
+};
+
+UTEST(TestDenseHandle, SelectsDenseMap)
+{
+    static_assert(std::is_same_v<StdStoragePolicy::Map<DenseHandle, int>, DenseHandleMap<DenseHandle, int>>);
+    static_assert(std::is_same_v<FlatStoragePolicy::Map<DenseHandle, int>, DenseHandleMap<DenseHandle, int>>);
+    static_assert(!std::is_same_v<StdStoragePolicy::Map<int, int>, DenseHandleMap<int, int>>);
+
+    OneToOne<DenseHandle, DenseHandle> oto;
+    ASSERT_FALSE(oto.containsLeft(DenseHandle(5)));
+    ASSERT_FALSE(oto.containsLeft(DenseHandle()));
+    oto.insert(DenseHandle(5), DenseHandle(7));
+    ASSERT_TRUE(oto.contains(DenseHandle(5), DenseHandle(7)));
+    ASSERT_TRUE(oto.findLeft(DenseHandle(7), DenseHandle()) == DenseHandle(5));
+    ASSERT_TRUE(oto.findRight(DenseHandle(6), DenseHandle()) == DenseHandle());
+}
+
+UTEST(TestDenseHandle, OneToManyMatchesHashed)
+{
+    OneToMany<DenseHandle, DenseHandle> dense;
+    OneToMany<int, int> hashed;
+
+    std::mt19937 random(5);
+    for (int i = 0; i < 20000; ++i)
+    {
+        uint32_t left = random() % 50;
+        uint32_t right = random() % 500;
+        switch (random() % 4)
+        {
+        case 0:
+        case 1:
+            dense.insert(DenseHandle(left), DenseHandle(right));
+            hashed.insert(left, right);
+            break;
+        case 2:
+            dense.erase(DenseHandle(left), DenseHandle(right));
+            hashed.erase(left, right);
+            break;
+        default:
+            dense.eraseRight(DenseHandle(right));
+            hashed.eraseRight(right);
+            break;
+        }
+    }
+
+    ASSERT_EQ(dense.count(), hashed.count());
+    ASSERT_EQ(dense.countLeft(), hashed.countLeft());
+    for (uint32_t right = 0; right < 500; ++right)
+        ASSERT_EQ((int)dense.findLeft(DenseHandle(right), DenseHandle(99)).m_Index, hashed.findLeft(right, 99));
+    for (uint32_t left = 0; left < 50; ++left)
+    {
+        auto dense_right = dense.findRight(DenseHandle(left));
+        auto hashed_right = hashed.findRight(left);
+        ASSERT_EQ(dense_right.size(), hashed_right.size());
+        for (size_t i = 0; i < dense_right.size(); ++i)
+            ASSERT_EQ((int)dense_right[i].m_Index, hashed_right[i]);
+    }
+
+    int count = 0;
+    for (auto pair : dense)
+    {
+        ASSERT_TRUE(hashed.contains((int)pair.left.m_Index, (int)pair.right.m_Index));
+        count++;
+    }
+    ASSERT_EQ(count, hashed.count());
+
+    OneToMany<DenseHandle, DenseHandle> copy = dense;
+    dense.clear();
+    ASSERT_EQ(copy.count(), hashed.count());
+    ASSERT_EQ(dense.count(), 0);
+}
+
+UTEST(TestDenseHandle, ManyToMany)
+{
+    ManyToMany<DenseHandle, DenseHandle, FlatStoragePolicy> m2m;
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        for (uint32_t j = i % 5; j < 40; j += 5)
+            m2m.insert(DenseHandle(i), DenseHandle(j));
+    }
+
+    ASSERT_EQ(m2m.count(), 800);
+    ASSERT_EQ(m2m.countRight(), 40);
+    ASSERT_TRUE(m2m.contains(DenseHandle(7), DenseHandle(12)));
+    ASSERT_FALSE(m2m.contains(DenseHandle(7), DenseHandle(13)));
+    ASSERT_EQ((int)m2m.findLeft(DenseHandle(3)).size(), 20);
+
+    m2m.eraseRight(DenseHandle(3));
+    m2m.eraseLeft(DenseHandle(0));
+    ASSERT_EQ(m2m.count(), 772);
+    ASSERT_FALSE(m2m.containsRight(DenseHandle(3)));
+    ASSERT_TRUE(m2m.findLeft(DenseHandle(3)).empty());
+}
+
+UTEST(TestDenseHandle, BatchReserve)
+{
+    // A batch reserves room up to its largest handle index, not one slot per pair on top of what is there
+    DenseHandleMap<DenseHandle, int> map;
+    std::vector<DenseHandle> handles;
+    for (uint32_t index = 0; index < 100; ++index)
+        handles.push_back(DenseHandle(index));
+    for (int batch = 0; batch < 10; ++batch)
+    {
+        reserveForKeys(&map, handles, [](const DenseHandle &handle) { return handle; });
+        for (auto &handle : handles)
+            map.try_emplace(handle, batch);
+    }
+    ASSERT_EQ(map.capacity(), 100u);
+
+    // Bulk insert into a dense OneToOne resolves conflicts like the hashed one
+    OneToOne<DenseHandle, DenseHandle> dense;
+    OneToOne<int, int> hashed;
+    std::mt19937 random(11);
+    for (int batch = 0; batch < 10; ++batch)
+    {
+        std::vector<OneToOne<DenseHandle, DenseHandle>::Pair> dense_pairs;
+        std::vector<OneToOne<int, int>::Pair> hashed_pairs;
+        for (int i = 0; i < 300; ++i)
+        {
+            uint32_t left = random() % 200;
+            uint32_t right = random() % 200;
+            dense_pairs.push_back(OneToOne<DenseHandle, DenseHandle>::Pair(DenseHandle(left), DenseHandle(right)));
+            hashed_pairs.push_back(OneToOne<int, int>::Pair((int)left, (int)right));
+        }
+        dense.insert(dense_pairs);
+        hashed.insert(hashed_pairs);
+        ASSERT_EQ(dense.count(), hashed.count());
+        for (auto pair : hashed)
+            ASSERT_TRUE(dense.contains(DenseHandle(pair.left), DenseHandle(pair.right)));
+    }
+
+    // Bulk loading reserves up to the largest handle index, so sparse handles load like dense ones
+    std::vector<ManyToMany<DenseHandle, DenseHandle>::Pair> sparse_pairs;
+    std::vector<OneToMany<DenseHandle, DenseHandle>::Pair> sparse_one_to_many_pairs;
+    for (uint32_t i = 0; i < 50; ++i)
+    {
+        DenseHandle left(i * 37);
+        DenseHandle right(i % 5 * 91);
+        sparse_pairs.push_back(ManyToMany<DenseHandle, DenseHandle>::Pair(left, right));
+        sparse_one_to_many_pairs.push_back(OneToMany<DenseHandle, DenseHandle>::Pair(left, right));
+    }
+    ManyToMany<DenseHandle, DenseHandle> many_to_many(sparse_pairs);
+    OneToMany<DenseHandle, DenseHandle> one_to_many(sparse_one_to_many_pairs);
+    ASSERT_EQ(many_to_many.count(), 50);
+    ASSERT_EQ(one_to_many.count(), 5);
+    for (auto &pair : sparse_pairs)
+        ASSERT_TRUE(many_to_many.contains(pair.left, pair.right));
+    ASSERT_TRUE(one_to_many.contains(DenseHandle(45 * 37), DenseHandle(0)));
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <random>
+#include <unordered_map>
+#include "utest.h"
+#include "BinaryRelations/BinaryRelations.h"
+
+using namespace BinaryRelations;
+
+UTEST(TestFlatHashMap, InsertFind)
+{
+    FlatHashMap<std::string, int> map;
+    map["apple"] = 1;
+    map["banana"] = 2;
+    map.try_emplace("cherry", 3);
+    map.try_emplace("apple", 100); // Already there - no change
+
+    ASSERT_EQ((int)map.size(), 3);
+    ASSERT_EQ(map.find("apple")->second, 1);
+    ASSERT_EQ(map.find("banana")->second, 2);
+    ASSERT_EQ(map.find("cherry")->second, 3);
+    ASSERT_TRUE(map.find("date") == map.end());
+    ASSERT_FALSE(map.contains("date"));
+}
+
+UTEST(TestFlatHashMap, Iterate)
+{
+    FlatHashMap<int, int> map;
+    for (int i = 0; i < 1000; ++i)
+        map[i] = i * 2;
+
+    int count = 0;
+    for (auto &p : map)
+    {
+        ASSERT_EQ(p.second, p.first * 2);
+        count += 1;
+    }
+
+    ASSERT_EQ(count, 1000);
+}
+
+UTEST(TestFlatHashMap, Churn)
+{
+    // Compare against std::unordered_map under random insert and erase, to exercise the backward shift erase
+    FlatHashMap<int, int> map;
+    std::unordered_map<int, int> reference;
+    std::mt19937 random(1234);
+
+    for (int i = 0; i < 100000; ++i)
+    {
+        int key = (int)(random() % 2000);
+        if (random() % 3 == 0)
+        {
+            ASSERT_EQ(map.erase(key), reference.erase(key));
+        }
+        else
+        {
+            map[key] = i;
+            reference[key] = i;
+        }
+    }
+
+    ASSERT_EQ(map.size(), reference.size());
+    for (auto &p : reference)
+    {
+        auto it = map.find(p.first);
+        ASSERT_TRUE(it != map.end());
+        ASSERT_EQ(it->second, p.second);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <iostream>
+#include "utest.h"
+#include "BinaryRelations/BinaryRelations.h"
+
+using namespace BinaryRelations;
+
+UTEST(TestFrozen, OneToMany)
+{
+    OneToMany<int, std::string> otm;
+    otm.insert(2, "cherry");
+    otm.insert(1, "banana");
+    otm.insert(1, "apple");
+    otm.insert(3, "date");
+
+    FrozenOneToMany<int, std::string> frozen = otm.freeze();
+    otm.insert(4, "elderberry");
+
+    ASSERT_EQ(frozen.count(), 4);
+    ASSERT_EQ(frozen.countLeft(), 3);
+    ASSERT_EQ(frozen.countRight(), 4);
+    ASSERT_TRUE(frozen.contains(1, "apple"));
+    ASSERT_TRUE(frozen.contains(1, "banana"));
+    ASSERT_FALSE(frozen.contains(2, "apple"));
+    ASSERT_FALSE(frozen.containsLeft(4));
+    ASSERT_TRUE(frozen.containsRight("date"));
+    ASSERT_EQ(frozen.findLeft("cherry", 0), 2);
+    ASSERT_EQ(frozen.findLeft("elderberry", 0), 0);
+    ASSERT_EQ((int)frozen.findRight(1).size(), 2);
+    ASSERT_TRUE(frozen.findRight(1)[0] == "apple");
+    ASSERT_TRUE(frozen.findRight(5).empty());
+
+    int count = 0;
+    for (auto pair : frozen)
+    {
+        ASSERT_TRUE(otm.contains(pair.left, pair.right));
+        count++;
+    }
+    ASSERT_EQ(count, 4);
+}
+
+UTEST(TestFrozen, ManyToMany)
+{
+    ManyToMany<int, int> m2m;
+    for (int i = 0; i < 100; ++i)
+    {
+        for (int j = i % 7; j < 30; j += 3)
+            m2m.insert(i, j);
+    }
+
+    FrozenManyToMany<int, int> frozen = m2m.freeze();
+
+    ASSERT_EQ(frozen.count(), m2m.count());
+    ASSERT_EQ(frozen.countLeft(), m2m.countLeft());
+    ASSERT_EQ(frozen.countRight(), m2m.countRight());
+    for (int i = 0; i < 100; ++i)
+    {
+        ASSERT_TRUE(std::ranges::equal(frozen.findRight(i), m2m.findRight(i)));
+        for (int j = 0; j < 30; ++j)
+            ASSERT_TRUE(frozen.contains(i, j) == m2m.contains(i, j));
+    }
+    for (int j = 0; j < 30; ++j)
+        ASSERT_TRUE(std::ranges::equal(frozen.findLeft(j), m2m.findLeft(j)));
+
+    int count = 0;
+    for (auto pair : frozen)
+    {
+        ASSERT_TRUE(m2m.contains(pair.left, pair.right));
+        count++;
+    }
+    ASSERT_EQ(count, m2m.count());
+
+    FrozenManyToMany<int, int> empty;
+    ASSERT_EQ(empty.count(), 0);
+    ASSERT_TRUE(empty.begin() == empty.end());
+}
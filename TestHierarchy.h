@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <iostream>
+#include <random>
+#include "utest.h"
+#include "BinaryRelations/BinaryRelations.h"
+
+using namespace BinaryRelations;
+
+UTEST(TestHierarchy, Ancestors)
+{
+    Hierarchy<int> hierarchy;
+    hierarchy.insert(1, 2);
+    hierarchy.insert(1, 3);
+    hierarchy.insert(2, 4);
+    hierarchy.insert(2, 5);
+    hierarchy.insert(5, 6);
+    hierarchy.insert(10, 11);
+
+    ASSERT_TRUE(hierarchy.isAncestor(1, 6));
+    ASSERT_TRUE(hierarchy.isAncestor(2, 5));
+    ASSERT_FALSE(hierarchy.isAncestor(3, 6));
+    ASSERT_FALSE(hierarchy.isAncestor(6, 1));
+    ASSERT_FALSE(hierarchy.isAncestor(1, 1));
+    ASSERT_FALSE(hierarchy.isAncestor(1, 11));
+    ASSERT_FALSE(hierarchy.isAncestor(1, 99));
+    ASSERT_EQ(hierarchy.count(), 8);
+
+    std::vector<int> descendants = {2, 4, 5, 6, 3};
+    ASSERT_TRUE(std::ranges::equal(hierarchy.findDescendants(1), descendants));
+    std::vector<int> subtree = {5, 6};
+    ASSERT_TRUE(std::ranges::equal(hierarchy.findSubtree(5), subtree));
+    ASSERT_TRUE(hierarchy.findDescendants(4).empty());
+    ASSERT_TRUE(hierarchy.findSubtree(99).empty());
+
+    // Move a subtree, and the index follows
+    hierarchy.insert(3, 5);
+    ASSERT_TRUE(hierarchy.isAncestor(3, 6));
+    ASSERT_FALSE(hierarchy.isAncestor(2, 6));
+    ASSERT_EQ(hierarchy.findParent(5, 0), 3);
+
+    hierarchy.eraseParent(3);
+    ASSERT_FALSE(hierarchy.isAncestor(1, 6));
+    ASSERT_TRUE(hierarchy.isAncestor(3, 6));
+    std::vector<int> moved = {3, 5, 6};
+    ASSERT_TRUE(std::ranges::equal(hierarchy.findSubtree(3), moved));
+}
+
+UTEST(TestHierarchy, MatchesWalk)
+{
+    Hierarchy<int, FlatStoragePolicy> hierarchy;
+    std::mt19937 random(19);
+    for (int node = 1; node < 1000; ++node)
+        hierarchy.insert((int)(random() % node), node); // Every parent is smaller than its child, so there is no cycle
+
+    for (int node = 0; node < 1000; node += 37)
+    {
+        for (int other = 0; other < 1000; other += 13)
+        {
+            bool walked = false;
+            for (int parent = hierarchy.findParent(other, -1); parent != -1; parent = hierarchy.findParent(parent, -1))
+                walked = walked || parent == node;
+            ASSERT_TRUE(hierarchy.isAncestor(node, other) == walked);
+        }
+    }
+    ASSERT_EQ((int)hierarchy.findDescendants(0).size(), 999);
+}
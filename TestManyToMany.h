@@ -2,6 +2,7 @@
 
 #include <string>
 #include <iostream>
+#include <random>
 #include "utest.h"
 #include "BinaryRelations/BinaryRelations.h"
 
@@ -64,7 +65,7 @@ UTEST(TestManyToMany, FindLeft)
     mtm.insert(3, "date");
 
     int count = 0;
-    for (auto p : *mtm.findLeft("date"))
+    for (auto p : mtm.findLeft("date"))
     {
         (void)p; // Shut up compiler
         count += 1;
@@ -83,7 +84,7 @@ UTEST(TestManyToMany, FindRight)
     mtm.insert(3, "elderberry");
 
     int count = 0;
-    for (auto p : *mtm.findRight(1))
+    for (auto p : mtm.findRight(1))
     {
         (void)p; // Shut up compiler
         count += 1;
@@ -222,3 +223,491 @@ UTEST(TestManyToMany, BulkErase)
     ASSERT_TRUE(mtm.contains(3, "clementine"));
 }
 
+UTEST(TestManyToMany, FlatStorage)
+{
+    ManyToMany<int, std::string, FlatStoragePolicy> mtm;
+    mtm.insert(1, "apple");
+    mtm.insert(1, "banana");
+    mtm.insert(2, "banana");
+    mtm.insert(3, "cherry");
+    mtm.insert(3, "date");
+
+    mtm.eraseLeft(1);
+    mtm.eraseRight("date");
+
+    ASSERT_EQ(mtm.count(), 2);
+    ASSERT_EQ(mtm.countLeft(), 2);
+    ASSERT_EQ(mtm.countRight(), 2);
+    ASSERT_FALSE(mtm.contains(1, "apple"));
+    ASSERT_FALSE(mtm.contains(1, "banana"));
+    ASSERT_TRUE(mtm.contains(2, "banana"));
+    ASSERT_TRUE(mtm.contains(3, "cherry"));
+    ASSERT_FALSE(mtm.contains(3, "date"));
+}
+
+/// A memory resource that counts the bytes it has outstanding
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    size_t m_Outstanding = 0;
+    int m_Allocations = 0;
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        m_Outstanding += bytes;
+        m_Allocations += 1;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override
+    {
+        m_Outstanding -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+UTEST(TestManyToMany, MemoryResource)
+{
+    CountingResource resource;
+    {
+        ManyToMany<int, int> mtm(&resource);
+        for (int i = 0; i < 100; ++i)
+            mtm.insert(i % 10, i);
+
+        ASSERT_TRUE(resource.m_Allocations > 0);
+
+        ManyToMany<int, int> copy = mtm;
+        for (int i = 0; i < 100; i += 2)
+            copy.erase(i % 10, i);
+        copy.eraseLeft(1);
+
+        ASSERT_EQ(mtm.count(), 100);
+        ASSERT_EQ(copy.count(), 40);
+        ASSERT_TRUE(mtm.contains(1, 11));
+        ASSERT_FALSE(copy.contains(1, 11));
+        ASSERT_FALSE(copy.contains(2, 12));
+        ASSERT_TRUE(copy.contains(3, 13));
+        ASSERT_EQ((int)copy.findLeft(13).size(), 1);
+
+        ManyToMany<int, int> moved = std::move(copy);
+        ASSERT_EQ(moved.count(), 40);
+    }
+    ASSERT_EQ((int)resource.m_Outstanding, 0);
+}
+
+UTEST(TestManyToMany, TransparentLookup)
+{
+    ManyToMany<std::string, std::string> m2m;
+    m2m.insert("fruit", "apple");
+    m2m.insert("fruit", "banana");
+    m2m.insert("red", "apple");
+
+    std::string_view apple = "apple";
+    ASSERT_TRUE(m2m.contains("fruit", apple));
+    ASSERT_TRUE(m2m.contains(std::string_view("red"), "apple"));
+    ASSERT_FALSE(m2m.contains("red", "banana"));
+    ASSERT_TRUE(m2m.containsRight(apple));
+    ASSERT_EQ((int)m2m.findLeft(apple).size(), 2);
+    ASSERT_EQ((int)m2m.findRight("fruit").size(), 2);
+    ASSERT_TRUE(m2m.freeze().contains("red", apple));
+}
+
+UTEST(TestManyToMany, BulkInsertMatchesSingle)
+{
+    ManyToMany<int, int> single;
+    ManyToMany<int, int> bulk;
+    ManyToMany<int, int> sorted;
+
+    std::mt19937 random(10);
+    for (int batch = 0; batch < 20; ++batch)
+    {
+        std::vector<ManyToMany<int, int>::Pair> pairs;
+        for (int i = 0; i < 300; ++i)
+            pairs.push_back(ManyToMany<int, int>::Pair(random() % 40, random() % 100));
+
+        for (auto &pair : pairs)
+            single.insert(pair);
+
+        std::vector<ManyToMany<int, int>::Pair> sorted_pairs = pairs;
+        std::sort(sorted_pairs.begin(), sorted_pairs.end(),
+                  [](auto &a, auto &b) { return a.left < b.left || (a.left == b.left && a.right < b.right); });
+        sorted.insert(kAssumeSorted, sorted_pairs);
+        bulk.insert(std::move(pairs));
+
+        if (batch % 4 == 3)
+        {
+            std::vector<ManyToMany<int, int>::Pair> erase_pairs;
+            for (int i = 0; i < 500; ++i)
+                erase_pairs.push_back(ManyToMany<int, int>::Pair(random() % 40, random() % 100));
+            for (auto &pair : erase_pairs)
+                single.erase(pair);
+            bulk.erase(erase_pairs);
+            sorted.erase(erase_pairs);
+        }
+
+        ASSERT_EQ(bulk.count(), single.count());
+        ASSERT_EQ(sorted.count(), single.count());
+        ASSERT_EQ(bulk.countRight(), single.countRight());
+        for (int left = 0; left < 40; ++left)
+        {
+            ASSERT_TRUE(std::ranges::equal(bulk.findRight(left), single.findRight(left)));
+            ASSERT_TRUE(std::ranges::equal(sorted.findRight(left), single.findRight(left)));
+        }
+        for (int right = 0; right < 100; ++right)
+        {
+            ASSERT_TRUE(std::ranges::equal(bulk.findLeft(right), single.findLeft(right)));
+            ASSERT_TRUE(std::ranges::equal(sorted.findLeft(right), single.findLeft(right)));
+        }
+    }
+}
+
+enum class TestColor : int8_t
+{
+    kRed = -2,
+    kGreen = 0,
+    kBlue = 7,
+};
+
+UTEST(TestManyToMany, BulkInsertRadixKeys)
+{
+    // Large enough batches of integer and enum keys are radix sorted. Negative values must still sort first.
+    ManyToMany<int, TestColor> m2m;
+    ManyToMany<int, TestColor> single;
+    std::vector<ManyToMany<int, TestColor>::Pair> pairs;
+    const TestColor colors[] = {TestColor::kBlue, TestColor::kRed, TestColor::kGreen};
+    std::mt19937 random(11);
+    for (int i = 0; i < 2000; ++i)
+    {
+        int left = (int)(random() % 2000) - 1000;
+        if (i % 100 == 0)
+            left = i % 200 == 0 ? INT32_MIN : INT32_MAX;
+        pairs.push_back(ManyToMany<int, TestColor>::Pair(left, colors[random() % 3]));
+        single.insert(pairs.back());
+    }
+    m2m.insert(pairs);
+
+    ASSERT_EQ(m2m.count(), single.count());
+    ASSERT_TRUE(m2m.containsLeft(INT32_MIN));
+    for (TestColor color : colors)
+    {
+        auto left = m2m.findLeft(color);
+        ASSERT_TRUE(std::is_sorted(left.begin(), left.end()));
+        ASSERT_TRUE(std::ranges::equal(left, single.findLeft(color)));
+    }
+    for (int left : m2m.allLeft())
+    {
+        auto right = m2m.findRight(left);
+        ASSERT_TRUE(std::is_sorted(right.begin(), right.end()));
+        ASSERT_TRUE(std::ranges::equal(right, single.findRight(left)));
+    }
+
+    m2m.erase(pairs);
+    ASSERT_EQ(m2m.count(), 0);
+}
+
+UTEST(TestManyToMany, InsertParallel)
+{
+    ManyToMany<int, int> serial;
+    ManyToMany<int, int> parallel;
+    ManyToMany<int, std::string, FlatStoragePolicy> strings;
+    ManyToMany<int, std::string, FlatStoragePolicy> serial_strings;
+
+    std::mt19937 random(12);
+    for (int batch = 0; batch < 3; ++batch)
+    {
+        std::vector<ManyToMany<int, int>::Pair> pairs;
+        std::vector<ManyToMany<int, std::string, FlatStoragePolicy>::Pair> string_pairs;
+        for (int i = 0; i < 50000; ++i)
+        {
+            // Skewed, so that some keys are much larger than others
+            int left = (int)(random() % 1000) * (int)(random() % 3 == 0 ? 0 : 1);
+            int right = (int)(random() % 5000);
+            pairs.push_back(ManyToMany<int, int>::Pair(left, right));
+            if (i % 10 == 0)
+                string_pairs.push_back(ManyToMany<int, std::string, FlatStoragePolicy>::Pair(left, std::to_string(right)));
+        }
+
+        serial.insert(pairs);
+        parallel.insertParallel(std::move(pairs), 4);
+        serial_strings.insert(string_pairs);
+        strings.insertParallel(string_pairs, 3);
+
+        ASSERT_EQ(parallel.count(), serial.count());
+        ASSERT_EQ(parallel.countLeft(), serial.countLeft());
+        ASSERT_EQ(parallel.countRight(), serial.countRight());
+        for (int left : serial.allLeft())
+            ASSERT_TRUE(std::ranges::equal(parallel.findRight(left), serial.findRight(left)));
+        for (int right : serial.allRight())
+            ASSERT_TRUE(std::ranges::equal(parallel.findLeft(right), serial.findLeft(right)));
+    }
+
+    ASSERT_EQ(strings.count(), serial_strings.count());
+    for (int left : serial_strings.allLeft())
+        ASSERT_TRUE(std::ranges::equal(strings.findRight(left), serial_strings.findRight(left)));
+    for (std::string right : serial_strings.allRight())
+        ASSERT_TRUE(std::ranges::equal(strings.findLeft(right), serial_strings.findLeft(right)));
+}
+
+UTEST(TestManyToMany, BulkLoad)
+{
+    std::vector<ManyToMany<int, int>::Pair> pairs;
+    std::mt19937 random(14);
+    for (int i = 0; i < 5000; ++i)
+        pairs.push_back(ManyToMany<int, int>::Pair(random() % 200, random() % 300));
+
+    CountingResource resource;
+    {
+        ManyToMany<int, int> inserted;
+        inserted.insert(pairs);
+        ManyToMany<int, int> loaded(pairs.begin(), pairs.end(), &resource);
+        ManyToMany<int, int> from_span(pairs);
+
+        // All the vectors are in one block
+        ASSERT_EQ(resource.m_Allocations, 1);
+
+        ASSERT_EQ(loaded.count(), inserted.count());
+        ASSERT_EQ(from_span.count(), inserted.count());
+        ASSERT_EQ(loaded.countLeft(), inserted.countLeft());
+        ASSERT_EQ(loaded.countRight(), inserted.countRight());
+        for (int left : inserted.allLeft())
+            ASSERT_TRUE(std::ranges::equal(loaded.findRight(left), inserted.findRight(left)));
+        for (int right : inserted.allRight())
+            ASSERT_TRUE(std::ranges::equal(from_span.findLeft(right), inserted.findLeft(right)));
+
+        // Vectors that grow out of the block go to the resource
+        for (int i = 0; i < 1000; ++i)
+            loaded.insert(i % 10, 1000 + i);
+        loaded.eraseLeft(3);
+        ASSERT_EQ(loaded.count(), inserted.count() + 1000 - (int)inserted.findRight(3).size() - 100);
+        ManyToMany<int, int> moved = std::move(loaded);
+        ASSERT_TRUE(moved.contains(4, 1004));
+    }
+    ASSERT_EQ((int)resource.m_Outstanding, 0);
+}
+
+UTEST(TestManyToMany, BatchEraseKeys)
+{
+    ManyToMany<int, int> batch;
+    ManyToMany<int, int> single;
+    std::mt19937 random(15);
+    for (int i = 0; i < 5000; ++i)
+    {
+        int left = (int)(random() % 300);
+        int right = (int)(random() % 400);
+        batch.insert(left, right);
+        single.insert(left, right);
+    }
+
+    std::vector<int> lefts;
+    std::vector<int> rights;
+    for (int i = 0; i < 100; ++i)
+    {
+        lefts.push_back((int)(random() % 350));
+        rights.push_back((int)(random() % 450));
+    }
+
+    batch.eraseLeft(lefts);
+    batch.eraseRight(rights);
+    for (int left : lefts)
+        single.eraseLeft(left);
+    for (int right : rights)
+        single.eraseRight(right);
+
+    ASSERT_EQ(batch.count(), single.count());
+    ASSERT_EQ(batch.countLeft(), single.countLeft());
+    ASSERT_EQ(batch.countRight(), single.countRight());
+    for (int left : single.allLeft())
+        ASSERT_TRUE(std::ranges::equal(batch.findRight(left), single.findRight(left)));
+    for (int right : single.allRight())
+        ASSERT_TRUE(std::ranges::equal(batch.findLeft(right), single.findLeft(right)));
+}
+
+UTEST(TestManyToMany, BatchLookup)
+{
+    ManyToMany<int, std::string> mtm;
+    ManyToMany<int, std::string, FlatStoragePolicy> flat;
+    for (int i = 0; i < 300; ++i)
+    {
+        mtm.insert(i % 40, std::to_string(i % 70));
+        flat.insert(i % 40, std::to_string(i % 70));
+    }
+
+    std::vector<int> lefts;
+    for (int left = -5; left < 50; ++left)
+        lefts.push_back(left);
+    std::vector<std::string> rights;
+    for (int right = 60; right < 80; ++right)
+        rights.push_back(std::to_string(right));
+
+    std::vector<std::span<const std::string>> found_rights(lefts.size());
+    std::vector<std::span<const int>> found_lefts(rights.size());
+
+    flat.findRight(lefts, found_rights);
+    for (size_t i = 0; i < lefts.size(); ++i)
+        ASSERT_TRUE(std::ranges::equal(found_rights[i], mtm.findRight(lefts[i])));
+    mtm.findRight(lefts, found_rights);
+    for (size_t i = 0; i < lefts.size(); ++i)
+        ASSERT_TRUE(std::ranges::equal(found_rights[i], flat.findRight(lefts[i])));
+
+    flat.findLeft(rights, found_lefts);
+    for (size_t i = 0; i < rights.size(); ++i)
+        ASSERT_TRUE(std::ranges::equal(found_lefts[i], mtm.findLeft(rights[i])));
+
+    std::unique_ptr<bool[]> found(new bool[rights.size()]);
+    flat.containsRight(rights, std::span<bool>(found.get(), rights.size()));
+    for (size_t i = 0; i < rights.size(); ++i)
+        ASSERT_TRUE(found[i] == mtm.containsRight(rights[i]));
+}
+
+UTEST(TestManyToMany, SetOperations)
+{
+    ManyToMany<int, int> a;
+    ManyToMany<int, int> b;
+    std::mt19937 random(17);
+    for (int i = 0; i < 600; ++i)
+    {
+        a.insert((int)(random() % 30), (int)(random() % 40));
+        b.insert((int)(random() % 30), (int)(random() % 40));
+    }
+
+    ManyToMany<int, int> union_model = a;
+    for (auto pair : b)
+        union_model.insert(pair);
+    ManyToMany<int, int> intersection_model;
+    ManyToMany<int, int> difference_model;
+    for (auto pair : a)
+    {
+        if (b.contains(pair))
+            intersection_model.insert(pair);
+        else
+            difference_model.insert(pair);
+    }
+
+    ManyToMany<int, int> union_set = a;
+    union_set.insert(b);
+    ManyToMany<int, int> intersection_set = intersectionOf(a, b);
+    ManyToMany<int, int> difference_set = differenceOf(a, b);
+
+    ASSERT_EQ(union_set.count(), union_model.count());
+    ASSERT_EQ(intersection_set.count(), intersection_model.count());
+    ASSERT_EQ(difference_set.count(), difference_model.count());
+    ASSERT_EQ(intersection_set.countRight(), intersection_model.countRight());
+    ASSERT_EQ(difference_set.countRight(), difference_model.countRight());
+    for (int left = 0; left < 30; ++left)
+    {
+        ASSERT_TRUE(std::ranges::equal(union_set.findRight(left), union_model.findRight(left)));
+        ASSERT_TRUE(std::ranges::equal(intersection_set.findRight(left), intersection_model.findRight(left)));
+        ASSERT_TRUE(std::ranges::equal(difference_set.findRight(left), difference_model.findRight(left)));
+    }
+    for (int right = 0; right < 40; ++right)
+    {
+        ASSERT_TRUE(std::ranges::equal(union_set.findLeft(right), union_model.findLeft(right)));
+        ASSERT_TRUE(std::ranges::equal(intersection_set.findLeft(right), intersection_model.findLeft(right)));
+        ASSERT_TRUE(std::ranges::equal(difference_set.findLeft(right), difference_model.findLeft(right)));
+    }
+}
+
+UTEST(TestManyToMany, Compose)
+{
+    ManyToMany<int, int> groups_to_objects;
+    OneToMany<int, int> objects_to_parts;
+    std::mt19937 random(18);
+    for (int i = 0; i < 300; ++i)
+        groups_to_objects.insert((int)(random() % 20), (int)(random() % 100));
+    for (int part = 0; part < 400; ++part)
+        objects_to_parts.insert((int)(random() % 120), part);
+
+    auto groups_to_parts = compose(groups_to_objects, objects_to_parts);
+    static_assert(std::is_same_v<decltype(groups_to_parts), ManyToMany<int, int>>);
+
+    ManyToMany<int, int> model;
+    for (auto pair : groups_to_objects)
+        for (int part : objects_to_parts.findRight(pair.right))
+            model.insert(pair.left, part);
+
+    ASSERT_EQ(groups_to_parts.count(), model.count());
+    for (int group = 0; group < 20; ++group)
+        ASSERT_TRUE(std::ranges::equal(groups_to_parts.findRight(group), model.findRight(group)));
+    for (int part = 0; part < 400; ++part)
+        ASSERT_TRUE(std::ranges::equal(groups_to_parts.findLeft(part), model.findLeft(part)));
+}
+
+UTEST(TestManyToMany, RangeQueries)
+{
+    ManyToMany<int, int> mtm;
+    for (int left = 0; left < 10; ++left)
+        for (int right = left; right < 50; right += 5)
+            mtm.insert(left, right);
+
+    std::vector<int> rights = {12, 17};
+    ASSERT_TRUE(std::ranges::equal(mtm.findRightInRange(2, 10, 20), rights));
+    ASSERT_EQ(mtm.countRightInRange(2, 0, 50), 10);
+    ASSERT_EQ(mtm.lowerBoundRight(2, 40).front(), 42);
+
+    std::vector<int> lefts = {2, 7};
+    ASSERT_TRUE(std::ranges::equal(mtm.findLeftInRange(22, 0, 10), lefts));
+    ASSERT_EQ(mtm.countLeftInRange(22, 3, 7), 0);
+    ASSERT_EQ(mtm.lowerBoundLeft(22, 3).front(), 7);
+    ASSERT_TRUE(mtm.findLeftInRange(1000, 0, 10).empty());
+}
+
+UTEST(TestManyToMany, Transpose)
+{
+    ManyToMany<int, std::string> mtm;
+    for (int i = 0; i < 100; ++i)
+        mtm.insert(i % 10, std::to_string(i % 15));
+
+    auto view = mtm.transposed();
+    ASSERT_EQ(view.count(), mtm.count());
+    ASSERT_EQ(view.countLeft(), mtm.countRight());
+    ASSERT_TRUE(view.contains("3", 3));
+    ASSERT_FALSE(view.contains("3", 4));
+    ASSERT_TRUE(view.containsLeft("14"));
+    ASSERT_TRUE(std::ranges::equal(view.findRight("7"), mtm.findLeft("7")));
+    ASSERT_TRUE(std::ranges::equal(view.findLeft(2), mtm.findRight(2)));
+    int count = 0;
+    for (auto pair : view)
+    {
+        ASSERT_TRUE(mtm.contains(pair.right, pair.left));
+        count++;
+    }
+    ASSERT_EQ(count, mtm.count());
+
+    // The view sees later changes
+    mtm.insert(50, "fifty");
+    ASSERT_TRUE(view.contains("fifty", 50));
+
+    ManyToMany<int, std::string> copy = mtm;
+    ManyToMany<std::string, int> reversed = std::move(mtm).transpose();
+    ASSERT_EQ(mtm.count(), 0);
+    ASSERT_EQ(reversed.count(), copy.count());
+    for (auto pair : copy)
+        ASSERT_TRUE(reversed.contains(pair.right, pair.left));
+    reversed.insert("new", 1);
+    reversed.erase("3", 3);
+    ASSERT_TRUE(std::ranges::equal(reversed.findLeft(1), std::vector<std::string>{"1", "11", "6", "new"}));
+}
+
+UTEST(TestManyToMany, ForEachParallel)
+{
+    ManyToMany<int, int> relation;
+    for (int left = 0; left < 50; ++left)
+        for (int right = 0; right < (left == 7 ? 20000 : 100); right += 1 + left % 3)
+            relation.insert(left, right);
+
+    std::atomic<int> pair_count = 0;
+    std::atomic<int> missing = 0;
+    relation.forEachParallel([&](int left, int right) {
+        pair_count += 1;
+        if (!relation.contains(left, right))
+            missing += 1;
+    });
+    ASSERT_EQ(pair_count.load(), relation.count());
+    ASSERT_EQ(missing.load(), 0);
+}
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <iostream>
+#include <random>
 #include <unordered_set>
 #include "utest.h"
 #include "BinaryRelations/BinaryRelations.h"
@@ -83,7 +84,7 @@ UTEST(TestOneToMany, FindRight)
     otm.insert(3, "elderberry");
 
     int count = 0;
-    for (auto p : *otm.findRight(1))
+    for (auto p : otm.findRight(1))
         count += 1;
     
     ASSERT_EQ(count, 3);
@@ -97,7 +98,7 @@ bool isValid(const OneToMany<LeftType, RightType>& otm)
     
     for (int left : otm.allLeft())
     {
-        for (auto right : *otm.findRight(left))
+        for (auto right : otm.findRight(left))
         {
             auto right_it = right_set.find(right);
             if (right_it == right_set.end())
@@ -244,3 +245,398 @@ UTEST(TestOneToMany, BulkErase)
     ASSERT_TRUE(otm.contains(3, "clementine"));
 }
 
+UTEST(TestOneToMany, FlatStorage)
+{
+    OneToMany<int, std::string, FlatStoragePolicy> otm;
+    otm.insert(1, "apple");
+    otm.insert(1, "banana");
+    otm.insert(2, "cherry");
+    otm.insert(3, "date");
+    otm.insert(3, "cherry");
+    otm.erase(1, "banana");
+
+    ASSERT_EQ(otm.count(), 3);
+    ASSERT_EQ(otm.countLeft(), 2);
+    ASSERT_TRUE(otm.contains(1, "apple"));
+    ASSERT_FALSE(otm.contains(1, "banana"));
+    ASSERT_FALSE(otm.contains(2, "cherry"));
+    ASSERT_TRUE(otm.contains(3, "cherry"));
+    ASSERT_TRUE(otm.contains(3, "date"));
+    ASSERT_EQ(otm.findLeft("date", 0), 3);
+
+    int count = 0;
+    for (auto p : otm)
+        count += 1;
+    ASSERT_EQ(count, 3);
+}
+
+UTEST(TestOneToMany, InlineRightValues)
+{
+    // Left value 1 stays within the inline storage, left value 2 spills to the heap
+    OneToMany<int, int> otm;
+    for (int i = 0; i < 4; ++i)
+        otm.insert(1, 100 - i);
+    for (int i = 0; i < 100; ++i)
+        otm.insert(2, 1000 - i);
+
+    auto right1 = otm.findRight(1);
+    ASSERT_EQ((int)right1.size(), 4);
+    ASSERT_TRUE(std::is_sorted(right1.begin(), right1.end()));
+    ASSERT_EQ(right1[0], 97);
+
+    auto right2 = otm.findRight(2);
+    ASSERT_EQ((int)right2.size(), 100);
+    ASSERT_TRUE(std::is_sorted(right2.begin(), right2.end()));
+
+    // Steal right values back until left value 2 fits inline again
+    for (int i = 0; i < 98; ++i)
+        otm.insert(1, 1000 - i);
+
+    ASSERT_EQ((int)otm.findRight(1).size(), 102);
+    ASSERT_EQ((int)otm.findRight(2).size(), 2);
+    ASSERT_EQ(otm.count(), 104);
+    ASSERT_TRUE(isValid(otm));
+    ASSERT_TRUE(otm.findRight(3).empty());
+}
+
+UTEST(TestOneToMany, CopyAndMove)
+{
+    OneToMany<int, int> otm;
+    for (int i = 0; i < 100; ++i)
+        otm.insert(i % 3, i);
+
+    OneToMany<int, int> copy = otm;
+    copy.eraseLeft(0);
+    copy.insert(5, 1);
+
+    ASSERT_EQ(otm.count(), 100);
+    ASSERT_TRUE(otm.contains(1, 1));
+    ASSERT_EQ(copy.count(), 66);
+    ASSERT_TRUE(copy.contains(5, 1));
+    ASSERT_TRUE(isValid(copy));
+
+    OneToMany<int, int> moved;
+    moved = std::move(copy);
+    moved.insert(6, 2);
+    ASSERT_EQ(moved.count(), 66);
+    ASSERT_TRUE(isValid(moved));
+
+    otm = moved;
+    ASSERT_EQ(otm.count(), 66);
+    ASSERT_TRUE(isValid(otm));
+}
+
+UTEST(TestOneToMany, TransparentLookup)
+{
+    OneToMany<std::string, int> otm;
+    otm.insert("fruit", 1);
+    otm.insert("fruit", 2);
+    otm.insert("vegetable", 3);
+
+    std::string_view fruit = "fruit";
+    ASSERT_TRUE(otm.containsLeft(fruit));
+    ASSERT_TRUE(otm.contains(fruit, 2));
+    ASSERT_FALSE(otm.containsLeft("nut"));
+    ASSERT_EQ((int)otm.findRight(fruit).size(), 2);
+    ASSERT_TRUE(otm.findLeft(3, "") == "vegetable");
+
+    OneToMany<int, std::string, FlatStoragePolicy> flat;
+    flat.insert(1, "apple");
+    flat.insert(1, "banana");
+    ASSERT_TRUE(flat.containsRight(std::string_view("apple")));
+    ASSERT_TRUE(flat.contains(1, "banana"));
+    ASSERT_EQ(flat.findLeft("banana", 0), 1);
+    ASSERT_EQ(flat.findLeft("cherry", 0), 0);
+
+    auto frozen = flat.freeze();
+    ASSERT_TRUE(frozen.contains(1, std::string_view("apple")));
+    ASSERT_EQ(frozen.findLeft("banana", 0), 1);
+}
+
+UTEST(TestOneToMany, BulkInsertMatchesSingle)
+{
+    OneToMany<int, int> single;
+    OneToMany<int, int> bulk;
+    OneToMany<int, int, FlatStoragePolicy> sorted;
+
+    std::vector<int> right_values;
+    for (int right = 0; right < 500; ++right)
+        right_values.push_back(right);
+
+    std::mt19937 random(9);
+    for (int batch = 0; batch < 20; ++batch)
+    {
+        // A sorted batch, with each right value once
+        std::shuffle(right_values.begin(), right_values.end(), random);
+        std::vector<OneToMany<int, int, FlatStoragePolicy>::Pair> sorted_pairs;
+        for (int i = 0; i < 300; ++i)
+            sorted_pairs.push_back(OneToMany<int, int, FlatStoragePolicy>::Pair(random() % 40, right_values[i]));
+        std::sort(sorted_pairs.begin(), sorted_pairs.end(),
+                  [](auto &a, auto &b) { return a.left < b.left || (a.left == b.left && a.right < b.right); });
+        sorted.insert(kAssumeSorted, sorted_pairs);
+
+        // The same batch in random order, with duplicate pairs and right values that are claimed twice
+        std::vector<OneToMany<int, int>::Pair> pairs;
+        for (auto &pair : sorted_pairs)
+        {
+            if (random() % 4 == 0)
+                pairs.push_back(OneToMany<int, int>::Pair(random() % 40, pair.right));
+            if (random() % 4 == 0)
+                pairs.push_back(OneToMany<int, int>::Pair(pair.left, pair.right));
+            pairs.push_back(OneToMany<int, int>::Pair(pair.left, pair.right));
+        }
+        std::shuffle(pairs.begin(), pairs.end(), random);
+        std::stable_partition(pairs.begin(), pairs.end(), [&](auto &pair) {
+            return sorted.findLeft(pair.right, -1) != pair.left; // The winning pair goes last
+        });
+
+        for (auto &pair : pairs)
+            single.insert(pair);
+        bulk.insert(std::move(pairs));
+
+        ASSERT_EQ(bulk.count(), single.count());
+        ASSERT_EQ(sorted.count(), single.count());
+        ASSERT_EQ(bulk.countLeft(), single.countLeft());
+        ASSERT_TRUE(isValid(bulk));
+        for (int left = 0; left < 40; ++left)
+        {
+            ASSERT_TRUE(std::ranges::equal(bulk.findRight(left), single.findRight(left)));
+            ASSERT_TRUE(std::ranges::equal(sorted.findRight(left), single.findRight(left)));
+        }
+    }
+}
+
+UTEST(TestOneToMany, BulkLoad)
+{
+    std::vector<OneToMany<int, int>::Pair> pairs;
+    std::mt19937 random(13);
+    for (int i = 0; i < 2000; ++i)
+        pairs.push_back(OneToMany<int, int>::Pair(random() % 100, random() % 1500));
+
+    OneToMany<int, int> inserted;
+    for (auto &pair : pairs)
+        inserted.insert(pair);
+    OneToMany<int, int> loaded(pairs.begin(), pairs.end());
+    OneToMany<int, int> from_span(pairs);
+
+    ASSERT_EQ(loaded.count(), inserted.count());
+    ASSERT_EQ(from_span.count(), inserted.count());
+    ASSERT_EQ(loaded.countLeft(), inserted.countLeft());
+    ASSERT_TRUE(isValid(loaded));
+    for (int left = 0; left < 100; ++left)
+        ASSERT_TRUE(std::ranges::equal(loaded.findRight(left), inserted.findRight(left)));
+    for (int right = 0; right < 1500; ++right)
+        ASSERT_EQ(from_span.findLeft(right, -1), inserted.findLeft(right, -1));
+
+    // Still a normal set after the load
+    for (int right = 0; right < 1500; right += 3)
+        loaded.insert(right % 7, right);
+    loaded.eraseLeft(5);
+    ASSERT_TRUE(isValid(loaded));
+
+    std::vector<OneToMany<int, std::string>::Pair> string_pairs = {
+        {1, "apple"}, {2, "banana"}, {1, "cherry"}, {3, "banana"}, {1, "apple"}};
+    OneToMany<int, std::string> strings(string_pairs);
+    ASSERT_EQ(strings.count(), 3);
+    ASSERT_EQ(strings.findLeft("banana", 0), 3);
+    ASSERT_TRUE(strings.contains(1, "apple"));
+    ASSERT_TRUE(strings.contains(1, "cherry"));
+}
+
+UTEST(TestOneToMany, BatchEraseKeys)
+{
+    OneToMany<int, int> batch;
+    OneToMany<int, int> single;
+    for (int right = 0; right < 1000; ++right)
+    {
+        batch.insert(right % 30, right);
+        single.insert(right % 30, right);
+    }
+
+    std::vector<int> rights;
+    for (int right = 0; right < 1200; right += 3)
+        rights.push_back(right);
+    std::vector<int> lefts = {4, 9, 9, 50};
+
+    batch.eraseRight(rights);
+    batch.eraseLeft(lefts);
+    for (int right : rights)
+        single.eraseRight(right);
+    for (int left : lefts)
+        single.eraseLeft(left);
+
+    ASSERT_EQ(batch.count(), single.count());
+    ASSERT_EQ(batch.countLeft(), single.countLeft());
+    ASSERT_TRUE(isValid(batch));
+    for (int left = 0; left < 30; ++left)
+        ASSERT_TRUE(std::ranges::equal(batch.findRight(left), single.findRight(left)));
+}
+
+UTEST(TestOneToMany, BatchLookup)
+{
+    OneToMany<int, int> std_storage;
+    OneToMany<int, int, FlatStoragePolicy> flat_storage;
+    for (int right = 0; right < 1000; ++right)
+    {
+        std_storage.insert(right % 50, right);
+        flat_storage.insert(right % 50, right);
+    }
+
+    std::vector<int> keys;
+    for (int key = -20; key < 1100; key += 7)
+        keys.push_back(key);
+
+    std::vector<int> lefts(keys.size());
+    std::vector<std::span<const int>> rights(keys.size());
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+
+    flat_storage.findLeft(keys, lefts, -1);
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_EQ(lefts[i], std_storage.findLeft(keys[i], -1));
+
+    std_storage.findLeft(keys, lefts, -1);
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_EQ(lefts[i], flat_storage.findLeft(keys[i], -1));
+
+    flat_storage.findRight(keys, rights);
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_TRUE(std::ranges::equal(rights[i], std_storage.findRight(keys[i])));
+
+    flat_storage.containsLeft(keys, std::span<bool>(found.get(), keys.size()));
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_TRUE(found[i] == std_storage.containsLeft(keys[i]));
+
+    flat_storage.containsRight(keys, std::span<bool>(found.get(), keys.size()));
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_TRUE(found[i] == std_storage.containsRight(keys[i]));
+}
+
+UTEST(TestOneToMany, SetOperations)
+{
+    OneToMany<int, int> a;
+    OneToMany<int, int> b;
+    std::mt19937 random(16);
+    for (int i = 0; i < 400; ++i)
+    {
+        a.insert((int)(random() % 30), (int)(random() % 500));
+        b.insert((int)(random() % 30), (int)(random() % 500));
+    }
+
+    // The same operations, pair by pair
+    OneToMany<int, int> union_model = a;
+    for (auto pair : b)
+        union_model.insert(pair);
+    OneToMany<int, int> intersection_model;
+    OneToMany<int, int> difference_model;
+    for (auto pair : a)
+    {
+        if (b.contains(pair))
+            intersection_model.insert(pair);
+        else
+            difference_model.insert(pair);
+    }
+
+    OneToMany<int, int> union_set = unionOf(a, b);
+    OneToMany<int, int> intersection_set = intersectionOf(a, b);
+    OneToMany<int, int> difference_set = a;
+    difference_set.erase(b);
+
+    for (auto *set : {&union_set, &intersection_set, &difference_set})
+        ASSERT_TRUE(isValid(*set));
+    ASSERT_EQ(union_set.count(), union_model.count());
+    ASSERT_EQ(intersection_set.count(), intersection_model.count());
+    ASSERT_EQ(difference_set.count(), difference_model.count());
+    ASSERT_EQ(difference_set.countLeft(), difference_model.countLeft());
+    for (int left = 0; left < 30; ++left)
+    {
+        ASSERT_TRUE(std::ranges::equal(union_set.findRight(left), union_model.findRight(left)));
+        ASSERT_TRUE(std::ranges::equal(intersection_set.findRight(left), intersection_model.findRight(left)));
+        ASSERT_TRUE(std::ranges::equal(difference_set.findRight(left), difference_model.findRight(left)));
+    }
+
+    a.intersectWith(a);
+    ASSERT_TRUE(isValid(a));
+    a.differenceWith(a);
+    ASSERT_EQ(a.count(), 0);
+}
+
+UTEST(TestOneToMany, Compose)
+{
+    OneToMany<int, int> zone_to_handles;
+    OneToMany<int, std::string> handle_to_assets;
+    for (int handle = 0; handle < 200; ++handle)
+        zone_to_handles.insert(handle % 7, handle);
+    for (int asset = 0; asset < 300; ++asset)
+        handle_to_assets.insert((asset * 13) % 250, std::to_string(asset));
+
+    auto zone_to_assets = compose(zone_to_handles, handle_to_assets);
+    static_assert(std::is_same_v<decltype(zone_to_assets), OneToMany<int, std::string>>);
+
+    // The nested loop
+    OneToMany<int, std::string> model;
+    for (int zone : zone_to_handles.allLeft())
+        for (int handle : zone_to_handles.findRight(zone))
+            for (auto &asset : handle_to_assets.findRight(handle))
+                model.insert(zone, asset);
+
+    ASSERT_EQ(zone_to_assets.count(), model.count());
+    for (int zone = 0; zone < 7; ++zone)
+        ASSERT_TRUE(std::ranges::equal(zone_to_assets.findRight(zone), model.findRight(zone)));
+
+    // With the second relation smaller than the first
+    OneToMany<int, std::string> few_assets;
+    for (int handle = 0; handle < 200; handle += 20)
+        few_assets.insert(handle, "asset" + std::to_string(handle));
+    auto zone_to_few_assets = compose(zone_to_handles, few_assets);
+    ASSERT_EQ(zone_to_few_assets.count(), 10);
+    ASSERT_EQ(zone_to_few_assets.findLeft("asset60", -1), 60 % 7);
+
+    OneToOne<std::string, int> names;
+    names.insert("kitchen", 3);
+    names.insert("garden", 5);
+    auto name_to_handles = compose(names, zone_to_handles);
+    static_assert(std::is_same_v<decltype(name_to_handles), OneToMany<std::string, int>>);
+    ASSERT_TRUE(std::ranges::equal(name_to_handles.findRight("garden"), zone_to_handles.findRight(5)));
+}
+
+UTEST(TestOneToMany, RangeQueries)
+{
+    OneToMany<int, int> cells;
+    for (int right = 0; right < 100; right += 3)
+        cells.insert(right % 2, right);
+
+    std::vector<int> expected = {12, 18, 24};
+    ASSERT_TRUE(std::ranges::equal(cells.findRightInRange(0, 10, 25), expected));
+    ASSERT_EQ(cells.countRightInRange(0, 10, 25), 3);
+    ASSERT_EQ(cells.countRightInRange(0, 13, 18), 0);
+    ASSERT_EQ(cells.countRightInRange(1, 0, 1000), (int)cells.findRight(1).size());
+    ASSERT_EQ(cells.countRightInRange(7, 0, 1000), 0);
+    ASSERT_EQ(cells.lowerBoundRight(1, 90).front(), 93);
+    ASSERT_EQ((int)cells.lowerBoundRight(1, 90).size(), 2);
+    ASSERT_TRUE(cells.lowerBoundRight(1, 100).empty());
+}
+
+UTEST(TestOneToMany, ForEachParallel)
+{
+    // One left value holds most of the pairs. It is split over several chunks.
+    OneToMany<int, int> relation;
+    for (int right = 0; right < 40000; ++right)
+        relation.insert(right < 30000 ? 0 : right % 100 + 1, right);
+
+    std::vector<std::atomic<int>> visits(40000);
+    std::atomic<int> wrong_left = 0;
+    relation.forEachParallel([&](int left, int right) {
+        visits[right] += 1;
+        if (relation.findLeft(right, -1) != left)
+            wrong_left += 1;
+    }, 4);
+
+    for (auto &visit : visits)
+        ASSERT_EQ(visit.load(), 1);
+    ASSERT_EQ(wrong_left.load(), 0);
+
+    OneToMany<int, int> empty;
+    int calls = 0;
+    empty.forEachParallel([&](int, int) { calls += 1; });
+    ASSERT_EQ(calls, 0);
+}
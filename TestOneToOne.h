@@ -2,6 +2,8 @@
 
 #include <string>
 #include <iostream>
+#include <map>
+#include <random>
 #include "utest.h"
 #include "BinaryRelations/BinaryRelations.h"
 
@@ -163,3 +165,151 @@ UTEST(TestOneToOne, AllRight)
     ASSERT_EQ(count, 5);
 }
 
+UTEST(TestOneToOne, FlatStorage)
+{
+    OneToOne<int, std::string, FlatStoragePolicy> oto;
+    oto.insert(1, "apple");
+    oto.insert(2, "banana");
+    oto.insert(3, "cherry");
+    oto.insert(5, "cherry");
+    oto.erase(2, "banana");
+
+    ASSERT_EQ(oto.count(), 2);
+    ASSERT_TRUE(oto.contains(1, "apple"));
+    ASSERT_FALSE(oto.contains(2, "banana"));
+    ASSERT_FALSE(oto.contains(3, "cherry"));
+    ASSERT_TRUE(oto.contains(5, "cherry"));
+    ASSERT_TRUE(oto.findRight(1, "") == "apple");
+}
+
+template <typename Relation> bool matchesModel(const Relation &oto, const std::map<int, int> &model)
+{
+    if (oto.count() != (int)model.size() || oto.countRight() != (int)model.size())
+        return false;
+    for (auto &entry : model)
+    {
+        if (!oto.contains(entry.first, entry.second) || oto.findLeft(entry.second, -1) != entry.first)
+            return false;
+    }
+    return true;
+}
+
+UTEST(TestOneToOne, BulkInsertErase)
+{
+    // Pairs in a batch conflict with each other and with the set. The result must be as if inserted one by one.
+    OneToOne<int, int> oto;
+    OneToOne<int, int, FlatStoragePolicy> flat;
+    std::map<int, int> model;
+
+    std::mt19937 random(8);
+    for (int batch = 0; batch < 20; ++batch)
+    {
+        std::vector<OneToOne<int, int>::Pair> pairs;
+        std::vector<OneToOne<int, int, FlatStoragePolicy>::Pair> flat_pairs;
+        for (int i = 0; i < 200; ++i)
+        {
+            int left = random() % 300;
+            int right = random() % 300;
+            pairs.push_back(OneToOne<int, int>::Pair(left, right));
+            flat_pairs.push_back(OneToOne<int, int, FlatStoragePolicy>::Pair(left, right));
+        }
+
+        if (batch % 3 != 2)
+        {
+            oto.insert(pairs);
+            flat.insert(flat_pairs);
+            for (auto &pair : pairs)
+            {
+                std::erase_if(model, [&](auto &entry) { return entry.first == pair.left || entry.second == pair.right; });
+                model[pair.left] = pair.right;
+            }
+        }
+        else
+        {
+            // Erase half of the existing pairs, plus pairs that are not there
+            for (auto &entry : model)
+            {
+                if (random() % 2)
+                {
+                    pairs.push_back(OneToOne<int, int>::Pair(entry.first, entry.second));
+                    flat_pairs.push_back(OneToOne<int, int, FlatStoragePolicy>::Pair(entry.first, entry.second));
+                }
+            }
+            oto.erase(pairs);
+            flat.erase(flat_pairs);
+            for (auto &pair : pairs)
+            {
+                auto it = model.find(pair.left);
+                if (it != model.end() && it->second == pair.right)
+                    model.erase(it);
+            }
+        }
+        ASSERT_TRUE(matchesModel(oto, model));
+        ASSERT_TRUE(matchesModel(flat, model));
+    }
+}
+
+UTEST(TestOneToOne, BatchLookup)
+{
+    OneToOne<int, int, FlatStoragePolicy> oto;
+    for (int i = 0; i < 500; ++i)
+        oto.insert(i, 1000 - i);
+
+    std::vector<int> keys;
+    for (int key = 0; key < 1100; key += 3)
+        keys.push_back(key);
+
+    std::vector<int> values(keys.size());
+    oto.findRight(keys, values, -1);
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_EQ(values[i], oto.findRight(keys[i], -1));
+
+    oto.findLeft(keys, values, -1);
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_EQ(values[i], oto.findLeft(keys[i], -1));
+
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+    oto.containsRight(keys, std::span<bool>(found.get(), keys.size()));
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_TRUE(found[i] == oto.containsRight(keys[i]));
+}
+
+UTEST(TestOneToOne, SetOperations)
+{
+    OneToOne<int, int> a;
+    OneToOne<int, int> b;
+    for (int i = 0; i < 100; ++i)
+    {
+        a.insert(i, i % 60);
+        b.insert(i % 70, i % 60);
+    }
+
+    OneToOne<int, int> union_model = a;
+    for (auto pair : b)
+        union_model.insert(pair);
+
+    OneToOne<int, int> union_set = unionOf(a, b);
+    OneToOne<int, int> intersection_set = intersectionOf(a, b);
+    OneToOne<int, int> difference_set = differenceOf(a, b);
+
+    ASSERT_EQ(union_set.count(), union_model.count());
+    for (auto pair : union_model)
+        ASSERT_TRUE(union_set.contains(pair));
+    for (auto pair : a)
+    {
+        ASSERT_TRUE(intersection_set.contains(pair) == b.contains(pair));
+        ASSERT_TRUE(difference_set.contains(pair) == !b.contains(pair));
+    }
+    ASSERT_EQ(intersection_set.count() + difference_set.count(), a.count());
+}
+
+UTEST(TestOneToOne, ForEachParallel)
+{
+    OneToOne<int, int> relation;
+    for (int left = 0; left < 5000; ++left)
+        relation.insert(left, left * 3);
+
+    std::atomic<int64_t> sum = 0;
+    relation.forEachParallel([&](int left, int right) { sum += right - left; }, 3);
+    ASSERT_EQ(sum.load(), (int64_t)4999 * 5000);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <iostream>
+#include <random>
+#include "utest.h"
+#include "BinaryRelations/BinaryRelations.h"
+
+using namespace BinaryRelations;
+
+// A sorted set of count values below limit
+static std::vector<int> randomSortedSet(std::mt19937 *random, int count, int limit)
+{
+    std::vector<int> set;
+    for (int i = 0; i < count; ++i)
+        set.push_back((int)((*random)() % limit) - limit / 2);
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+    return set;
+}
+
+UTEST(TestSortedSets, MatchesStd)
+{
+    std::mt19937 random(20);
+    for (int round = 0; round < 50; ++round)
+    {
+        // Similar sizes, and a skewed size
+        auto a = randomSortedSet(&random, 200 + round * 10, 2000);
+        auto b = randomSortedSet(&random, 300, 2000);
+        auto c = randomSortedSet(&random, round % 2 == 0 ? 10 : 1000, 2000);
+
+        std::vector<int> ab;
+        std::vector<int> expected;
+        std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(ab));
+        std::set_intersection(ab.begin(), ab.end(), c.begin(), c.end(), std::back_inserter(expected));
+        std::vector<int> result;
+        ASSERT_EQ(intersectSorted<int>({a, b, c}, &result), (int)expected.size());
+        ASSERT_TRUE(result == expected);
+        ASSERT_EQ(intersectSorted<int>({a, c}), (int)std::count_if(a.begin(), a.end(), [&](int value) {
+                      return std::binary_search(c.begin(), c.end(), value);
+                  }));
+
+        expected.clear();
+        ab.clear();
+        std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(ab));
+        std::set_union(ab.begin(), ab.end(), c.begin(), c.end(), std::back_inserter(expected));
+        ASSERT_EQ(unionSorted<int>({a, b, c}, &result), (int)expected.size());
+        ASSERT_TRUE(result == expected);
+
+        expected.clear();
+        ab.clear();
+        std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(ab));
+        std::set_difference(ab.begin(), ab.end(), c.begin(), c.end(), std::back_inserter(expected));
+        ASSERT_EQ(differenceSorted<int>({a, b, c}, &result), (int)expected.size());
+        ASSERT_TRUE(result == expected);
+    }
+}
+
+UTEST(TestSortedSets, Relations)
+{
+    OneToMany<int, std::string> zone_to_objects;
+    ManyToMany<int, std::string> group_to_objects;
+    for (int i = 0; i < 100; ++i)
+    {
+        zone_to_objects.insert(i % 3, std::to_string(i));
+        group_to_objects.insert(i % 4, std::to_string(i));
+        group_to_objects.insert(i % 5 + 10, std::to_string(i));
+    }
+
+    std::vector<std::span<const std::string>> sets = {zone_to_objects.findRight(1), group_to_objects.findRight(2),
+                                                      group_to_objects.findRight(13)};
+    std::vector<std::string> result;
+    intersectSorted(sets, &result);
+    ASSERT_EQ((int)result.size(), 1); // i % 60 == 58
+    ASSERT_TRUE(result[0] == "58");
+    ASSERT_EQ(differenceSorted(sets), 20);
+    ASSERT_EQ(unionSorted<std::string>({}), 0);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <type_traits>
+#include "utest.h"
+#include "BinaryRelations/BinaryRelations.h"
+
+using namespace BinaryRelations;
+
+UTEST(TestStringPool, Intern)
+{
+    StringPool pool;
+    StringId apple = pool.intern("apple");
+    StringId banana = pool.intern(std::string("banana"));
+
+    ASSERT_TRUE(apple.isValid());
+    ASSERT_TRUE(apple != banana);
+    ASSERT_TRUE(pool.intern("apple") == apple);
+    ASSERT_TRUE(pool.find("banana") == banana);
+    ASSERT_FALSE(pool.find("cherry").isValid());
+    ASSERT_TRUE(pool.str(apple) == "apple");
+    ASSERT_TRUE(pool.intern("").isValid());
+    ASSERT_TRUE(pool.str(pool.find("")).empty());
+    ASSERT_EQ(pool.count(), 3);
+
+    // Views stay valid while the pool grows, including strings larger than a block
+    std::string_view view = pool.str(banana);
+    std::string large(100000, 'x');
+    StringId large_id = pool.intern(large);
+    for (int i = 0; i < 20000; ++i)
+        pool.intern("path/to/asset_" + std::to_string(i));
+    ASSERT_TRUE(view == "banana");
+    ASSERT_TRUE(pool.str(large_id) == large);
+    ASSERT_TRUE(pool.str(pool.find("path/to/asset_1234")) == "path/to/asset_1234");
+    ASSERT_EQ(pool.count(), 20004);
+
+    StringPool moved = std::move(pool);
+    ASSERT_TRUE(moved.find("apple") == apple);
+    ASSERT_TRUE(moved.str(banana) == "banana");
+}
+
+UTEST(TestStringPool, Relation)
+{
+    StringPool pool;
+    ManyToMany<int, StringId> m2m;
+    m2m.insert(1, pool.intern("apple"));
+    m2m.insert(1, pool.intern("banana"));
+    m2m.insert(2, pool.intern("cherry"));
+    m2m.insert(3, pool.intern("cherry"));
+
+    ASSERT_EQ(m2m.count(), 4);
+    ASSERT_TRUE(m2m.contains(1, pool.find("apple")));
+    ASSERT_FALSE(m2m.contains(1, pool.find("date")));
+    ASSERT_EQ((int)m2m.findLeft(pool.find("cherry")).size(), 2);
+
+    std::string names;
+    for (StringId id : m2m.findRight(1))
+        names += pool.str(id);
+    ASSERT_TRUE(names == "applebanana");
+
+    OneToMany<StringId, StringId> otm;
+    otm.insert(pool.intern("fruit"), pool.intern("apple"));
+    otm.insert(pool.intern("fruit"), pool.intern("banana"));
+    ASSERT_TRUE(pool.str(otm.findLeft(pool.find("banana"), StringId())) == "fruit");
+}
+
+UTEST(TestStringPool, InternedRelation)
+{
+    // Two relations share one pool, so each asset path is stored once
+    StringPool pool;
+    InternedRelation<ManyToMany<int, std::string>> tags(&pool);
+    InternedRelation<OneToMany<std::string, std::string>> folders(&pool);
+
+    tags.insert(1, "textures/rock.png");
+    tags.insert(1, "textures/grass.png");
+    tags.insert(2, std::string("textures/rock.png"));
+    folders.insert("textures", "textures/rock.png");
+    folders.insert("textures", "textures/grass.png");
+    folders.insert("models", "textures/grass.png");
+    ASSERT_EQ(pool.count(), 4);
+
+    ASSERT_EQ(tags.count(), 3);
+    ASSERT_TRUE(tags.contains(1, "textures/rock.png"));
+    ASSERT_FALSE(tags.contains(2, "textures/grass.png"));
+    ASSERT_FALSE(tags.contains(1, "textures/sky.png"));
+    ASSERT_TRUE(tags.containsRight("textures/grass.png"));
+
+    // Sorted by ID, which is the order the strings were first interned in
+    std::string names;
+    for (std::string_view name : tags.findRight(1))
+        names += std::string(name) + ";";
+    ASSERT_TRUE(names == "textures/rock.png;textures/grass.png;");
+    ASSERT_EQ(tags.findLeft("textures/rock.png").size(), 2u);
+    ASSERT_TRUE(tags.findRight(99).empty());
+
+    ASSERT_TRUE(folders.findLeft("textures/grass.png", "") == "models");
+    ASSERT_TRUE(folders.findLeft("textures/sky.png", "none") == "none");
+    ASSERT_EQ(folders.findRight("textures").size(), 1u);
+    ASSERT_TRUE(folders.findRight("textures")[0] == "textures/rock.png");
+
+    // The relation inside stores IDs only
+    ASSERT_TRUE(folders.relation().contains(pool.find("models"), pool.find("textures/grass.png")));
+
+    int pair_count = 0;
+    for (auto pair : tags)
+    {
+        ASSERT_TRUE(tags.contains(pair.left, pair.right));
+        pair_count += 1;
+    }
+    ASSERT_EQ(pair_count, 3);
+
+    // Erasing strings that were never interned does not add them to the pool
+    tags.erase(1, "textures/sky.png");
+    tags.eraseRight("textures/sky.png");
+    folders.eraseLeft("sounds");
+    ASSERT_EQ(pool.count(), 4);
+
+    tags.eraseRight("textures/rock.png");
+    ASSERT_EQ(tags.count(), 1);
+    folders.erase("models", "textures/grass.png");
+    ASSERT_FALSE(folders.containsLeft("models"));
+
+    InternedRelation<OneToOne<std::string, int>> ids;
+    ids.insert("alpha", 1);
+    ids.insert("beta", 2);
+    ids.insert("alpha", 2);
+    ASSERT_EQ(ids.count(), 1);
+    ASSERT_EQ(ids.findRight("alpha", -1), 2);
+    ASSERT_EQ(ids.findRight("beta", -1), -1);
+    ASSERT_TRUE(ids.findLeft(2, "") == "alpha");
+    ASSERT_EQ(ids.pool().count(), 2);
+
+    // A const set only hands out its pool and relation for looking up
+    const auto &const_ids = ids;
+    static_assert(std::is_same_v<decltype(const_ids.pool()), const StringPool &>);
+    static_assert(std::is_same_v<decltype(const_ids.relation()), const OneToOne<StringId, int> &>);
+    ids.relation().insert(ids.pool().intern("gamma"), 3);
+    ASSERT_TRUE(ids.findLeft(3, "") == "gamma");
+}
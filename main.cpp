@@ -4,5 +4,12 @@
 #include "TestOneToMany.h"
 #include "TestOneToOne.h"
 #include "TestManyToMany.h"
+#include "TestFlatHashMap.h"
+#include "TestFrozen.h"
+#include "TestDenseHandle.h"
+#include "TestStringPool.h"
+#include "TestHierarchy.h"
+#include "TestSortedSets.h"
+#include "TestConcurrent.h"
 
 UTEST_MAIN();